@@ -0,0 +1,804 @@
+/*
+ * Copyright 2008 Evan Miller
+ */
+
+/*
+ * Micro-benchmark for the strip parser, no nginx required:
+ *
+ *     cc -O2 -I. -o strip_bench bench/strip_bench.c bench/strip_ref.c \
+ *         strip_core.c
+ *     ./strip_bench [file.html ...]
+ *
+ * Without arguments it runs over a built-in corpus of generated pages;
+ * with arguments the given files are used instead.  Every input is fed
+ * to the parser at each level split into chunks from 1 byte to 64 KB,
+ * and the output for each chunk size is checked against that of the
+ * whole input in one buffer, which at level 1 is checked in turn against
+ * strip_ref(), the rules written out by hand.  The two are only the same
+ * for HTML outside script and style at level 1, as the edits that take
+ * back output are lost where they span two buffers: elsewhere the output
+ * in chunks may only have more of the bytes that these edits take out,
+ * each where it could be left, and what they leave in 1 byte buffers is
+ * checked exactly by strip_bench_cases[].  A blank page has to strip to
+ * nothing in chunks of any size, see strip_bench_blank().  Built with
+ * -DSTRIP_PROFILE=1, it ends with the parser's counters for the whole
+ * run, the timings being those of the profiling parser.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#if (defined __x86_64__ || defined __i386__)
+#include <x86intrin.h>
+#define STRIP_BENCH_RDTSC  1
+#endif
+
+#include "strip_core.h"
+#include "strip_ref.h"
+
+#define STRIP_BENCH_MIN_BYTES  (64 * 1024 * 1024)
+
+typedef struct {
+    const char  *name;
+    u_char      *data;
+    size_t       len;
+} strip_bench_input_t;
+
+typedef struct {
+    unsigned     level;
+    const char  *in;
+    const char  *whole;     /* the output in one buffer */
+    const char  *split;     /* and in 1 byte buffers */
+} strip_bench_case_t;
+
+static size_t chunk_sizes[] = { 1, 16, 256, 4096, 16384, 65536 };
+
+/*
+ * What an edit that spans two buffers leaves behind: the spaces cut
+ * before punctuation and the comments dropped in a script or style sheet
+ * at every level, and the comments, quotes, tag whitespace and end tags
+ * of levels 2 and 3.  HTML outside script and style comes out the same
+ * at level 1.
+ */
+
+static strip_bench_case_t  strip_bench_cases[] = {
+
+    { 1, "<p> a  <b>\n c </b>\n\n</p>",
+         "<p> a <b> c </b></p>",
+         "<p> a <b> c </b></p>" },
+
+    { 1, "<script>var a = 1 + b; if (x) { y() }</script>",
+         "<script>var a=1+b;if(x){y()}</script>",
+         "<script>var a =1 + b;if (x) {y() }</script>" },
+
+    { 1, "<script>a = 1; /* c */ b // d\nc</script>",
+         "<script>a=1;b \nc</script>",
+         "<script>a =1;/**/b //\nc</script>" },
+
+    { 1, "<script type=\"text/template\"> a  =  b </script>",
+         "<script type=\"text/template\"> a  =  b </script>",
+         "<script type=\"text/template\"> a  =  b </script>" },
+
+    { 1, "<style>a , b { color : red }</style>",
+         "<style>a,b{color :red}</style>",
+         "<style>a ,b {color :red }</style>" },
+
+    { 2, "<p>a <!-- c --> b</p>",
+         "<p>a b</p>",
+         "<p>a <!-- -->b</p>" },
+
+    { 3, "<a  href = \"x\" >y</a>",
+         "<a href=x>y</a>",
+         "<a href =\"x\" >y</a>" },
+
+    { 3, "<ul><li>a</li> <li>b</li>\n<li>c</li></ul>"
+         "<table><tr><td>1</td> <td>2</td></tr></table>",
+         "<ul><li>a</li> <li>b<li>c</ul><table><tr><td>1<td>2</table>",
+         "<ul><li>a</li> <li>b</li><li>c</li></ul>"
+         "<table><tr><td>1</td><td>2</td></tr></table>" }
+};
+
+static const char *words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+    "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore"
+};
+
+static unsigned long  seed = 1;
+
+static unsigned
+strip_bench_rand(unsigned n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (unsigned) (seed >> 16) % n;
+}
+
+static void
+strip_bench_append(u_char **p, u_char *end, const char *s)
+{
+    size_t  len;
+
+    len = strlen(s);
+
+    if ((size_t) (end - *p) < len) {
+        *p = end;
+        return;
+    }
+
+    memcpy(*p, s, len);
+    *p += len;
+}
+
+static void
+strip_bench_words(u_char **p, u_char *end, unsigned n)
+{
+    while (n--) {
+        strip_bench_append(p, end, words[strip_bench_rand(15)]);
+        strip_bench_append(p, end, " ");
+    }
+}
+
+static void
+strip_bench_indent(u_char **p, u_char *end, unsigned depth)
+{
+    strip_bench_append(p, end, "\n");
+
+    while (depth--) {
+        strip_bench_append(p, end, "    ");
+    }
+}
+
+static size_t
+strip_bench_generate(const char *kind, u_char *buf, size_t size)
+{
+    u_char    *p, *end;
+    unsigned   depth;
+
+    p = buf;
+    end = buf + size - 64;
+    depth = 0;
+
+    strip_bench_append(&p, end, "<!DOCTYPE html>\n<html>\n<body>");
+
+    while (p < end) {
+
+        if (strcmp(kind, "minified") == 0) {
+            strip_bench_append(&p, end, "<div class=\"row\"><p>");
+            strip_bench_words(&p, end, 12);
+            strip_bench_append(&p, end, "</p><a href=\"/x\">link</a></div>");
+
+        } else if (strcmp(kind, "whitespace") == 0) {
+            depth = 1 + strip_bench_rand(8);
+            strip_bench_indent(&p, end, depth);
+            strip_bench_append(&p, end, "<div   class=\"cell\"   >");
+            strip_bench_indent(&p, end, depth + 1);
+            strip_bench_words(&p, end, 4);
+            strip_bench_indent(&p, end, depth);
+            strip_bench_append(&p, end, "</div>\t\t\r\n");
+
+        } else if (strcmp(kind, "preformatted") == 0) {
+            strip_bench_append(&p, end, "\n  <pre>\n    ");
+            strip_bench_words(&p, end, 20);
+            strip_bench_append(&p, end, "\n  </pre>\n  <textarea rows=4>\n  ");
+            strip_bench_words(&p, end, 20);
+            strip_bench_append(&p, end, "\n  </textarea>  <p> ");
+            strip_bench_words(&p, end, 6);
+
+        } else if (strcmp(kind, "scripts") == 0) {
+            strip_bench_append(&p, end, "\n  <script>\n    // ");
+            strip_bench_words(&p, end, 8);
+            strip_bench_append(&p, end, "\n    var s = \"");
+            strip_bench_words(&p, end, 4);
+            strip_bench_append(&p, end, "\",  re = /a+  b/g;\n"
+                               "    if (i < n) {  f(s,  re);  }\n"
+                               "  </script>\n  <style>\n    p  >  a { "
+                               "margin : 0  auto; }  /* ");
+            strip_bench_words(&p, end, 6);
+            strip_bench_append(&p, end, "*/\n  </style>");
+
+        } else if (strcmp(kind, "comments") == 0) {
+            strip_bench_append(&p, end, "\n  <!-- ");
+            strip_bench_words(&p, end, 16);
+            strip_bench_append(&p, end, "-- - -->\n  <span>");
+            strip_bench_words(&p, end, 3);
+            strip_bench_append(&p, end, "</span>");
+
+        } else {
+            strip_bench_append(&p, end, "\n  <![CDATA[ ");
+            strip_bench_words(&p, end, 16);
+            strip_bench_append(&p, end, " ]] > ]]>\n  <b> ");
+            strip_bench_words(&p, end, 3);
+            strip_bench_append(&p, end, "</b>");
+        }
+    }
+
+    memcpy(p, "</body>\n</html>\n", sizeof("</body>\n</html>\n") - 1);
+
+    return p - buf + sizeof("</body>\n</html>\n") - 1;
+}
+
+static int
+strip_bench_load(const char *name, strip_bench_input_t *in)
+{
+    long   size;
+    FILE  *f;
+
+    f = fopen(name, "rb");
+    if (f == NULL) {
+        perror(name);
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    in->name = name;
+    in->data = malloc(size ? size : 1);
+    if (in->data == NULL) {
+        fclose(f);
+        return -1;
+    }
+
+    in->len = fread(in->data, 1, size, f);
+    fclose(f);
+
+    return 0;
+}
+
+#if (STRIP_PROFILE)
+
+static void
+strip_bench_profile(void *data, char *line)
+{
+    printf("%s\n", line);
+}
+
+#endif
+
+/*
+ * Strips the input in chunk byte buffers into out, the output of each
+ * buffer following that of the one before, and returns the output size.
+ */
+
+static size_t
+strip_bench_strip(strip_bench_input_t *in, u_char *out, size_t chunk,
+    unsigned level)
+{
+    u_char          *pos, *last;
+    size_t           off, len, n;
+    strip_parser_t   parser;
+
+    memmove(out, in->data, in->len);
+    memset(&parser, 0, sizeof(strip_parser_t));
+    parser.level = level;
+
+    n = 0;
+
+    for (off = 0; off < in->len; off += len) {
+        len = in->len - off < chunk ? in->len - off : chunk;
+        pos = out + off;
+        last = strip_compact(&parser, pos, pos + len);
+        memmove(out + n, pos, last - pos);
+        n += last - pos;
+    }
+
+    return n;
+}
+
+/*
+ * Where the output of the whole input is, for strip_bench_extra(): in
+ * text, in a tag, in a comment, or in the body of a script or style.
+ */
+
+typedef enum {
+    strip_bench_text = 0,
+    strip_bench_tag,
+    strip_bench_comment,
+    strip_bench_script
+} strip_bench_context_e;
+
+typedef struct {
+    strip_bench_context_e   context;
+    u_char                  quote;
+    unsigned                script;     /* the tag opens a script or style */
+} strip_bench_context_t;
+
+/* the end tags strip_level 3 leaves out */
+static const char  *strip_bench_optional[] = {
+    "li", "dt", "dd", "option", "optgroup", "tr", "td", "th", "thead",
+    "tbody", "tfoot", "body", "html"
+};
+
+static int
+strip_bench_name(u_char *p, u_char *last, const char *name)
+{
+    size_t  len;
+
+    len = strlen(name);
+
+    return (size_t) (last - p) > len
+           && strncasecmp((char *) p, name, len) == 0
+           && !isalnum(p[len]);
+}
+
+/*
+ * Moves the context past the byte at p of the output of the whole input.
+ * Only the markup the parser writes has to be told apart: its output has
+ * no whitespace at the ends of tags or around the '=' of an attribute.
+ */
+
+static void
+strip_bench_context(strip_bench_context_t *ctx, u_char *p, u_char *last)
+{
+    switch (ctx->context) {
+
+    case strip_bench_text:
+        if (*p != '<') {
+            break;
+        }
+
+        if (last - p >= 4 && memcmp(p, "<!--", 4) == 0) {
+            ctx->context = strip_bench_comment;
+            break;
+        }
+
+        ctx->context = strip_bench_tag;
+        ctx->quote = 0;
+        ctx->script = strip_bench_name(p + 1, last, "script")
+                      || strip_bench_name(p + 1, last, "style");
+        break;
+
+    case strip_bench_tag:
+        if (ctx->quote) {
+            if (*p == ctx->quote) {
+                ctx->quote = 0;
+            }
+
+        } else if ((*p == '"' || *p == '\'') && p[-1] == '=') {
+            ctx->quote = *p;
+
+        } else if (*p == '>') {
+            ctx->context = ctx->script ? strip_bench_script : strip_bench_text;
+        }
+
+        break;
+
+    case strip_bench_comment:
+        if (*p == '>' && p[-1] == '-' && p[-2] == '-') {
+            ctx->context = strip_bench_text;
+        }
+
+        break;
+
+    case strip_bench_script:
+        if (*p == '<' && *(p + 1) == '/'
+            && (strip_bench_name(p + 2, last, "script")
+                || strip_bench_name(p + 2, last, "style")))
+        {
+            ctx->context = strip_bench_tag;
+            ctx->quote = 0;
+            ctx->script = 0;
+        }
+
+        break;
+    }
+}
+
+/*
+ * Returns the length of what an edit that spans two buffers can leave at
+ * p in the output in chunks, where that of the whole input goes on with
+ * other bytes, or 0: in a script or style, a space cut before punctuation
+ * or an emptied comment, "/ * * /" with the stars it started with or
+ * "//"; from level 2 in text, an emptied comment of whitespace and dashes
+ * ended by "-->", "--!>" or the '>' of "<!-->"; at level 3 in a tag, its
+ * whitespace or a quote, and in text an end tag left out.
+ */
+
+static size_t
+strip_bench_extra(strip_bench_context_t *ctx, u_char *p, u_char *last,
+    unsigned level)
+{
+    u_char  *q;
+    size_t   k, len;
+
+    switch (ctx->context) {
+
+    case strip_bench_script:
+        if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+            return 1;
+        }
+
+        if (last - p >= 4 && memcmp(p, "/**", 3) == 0) {
+            for (q = p + 3; q < last && *q == '*'; q++) {
+                /* void */
+            }
+
+            return (q < last && *q == '/') ? q + 1 - p : 0;
+        }
+
+        if (last - p >= 2 && memcmp(p, "//", 2) == 0) {
+            return 2;
+        }
+
+        return 0;
+
+    case strip_bench_tag:
+        if (level < 3 || ctx->quote) {
+            return 0;
+        }
+
+        return (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'
+                || *p == '"' || *p == '\'');
+
+    case strip_bench_text:
+        if (level < 2 || last - p < 4 || *p != '<') {
+            return 0;
+        }
+
+        if (memcmp(p, "<!--", 4) == 0) {
+            for (q = p + 4; q < last && strchr(" \t\r\n-", *q); q++) {
+                /* void */
+            }
+
+            if (q < last && *q == '!') {
+                q++;
+            }
+
+            return (q < last && *q == '>') ? q + 1 - p : 0;
+        }
+
+        if (level < 3 || p[1] != '/') {
+            return 0;
+        }
+
+        for (k = 0; k < sizeof(strip_bench_optional) / sizeof(char *); k++) {
+            len = strlen(strip_bench_optional[k]);
+
+            if ((size_t) (last - p) > len + 2
+                && strncasecmp((char *) p + 2, strip_bench_optional[k], len)
+                   == 0
+                && p[len + 2] == '>')
+            {
+                return len + 3;
+            }
+        }
+
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+/*
+ * The edits that take back output are lost where they span two buffers,
+ * so the output in chunks may keep bytes that the whole input loses.  It
+ * has to be the same as the output of the whole input but for those,
+ * skipped where the whole output does not go on with the same bytes;
+ * returns the offset in the output in chunks of the first byte that is
+ * not, or -1.
+ */
+
+static long
+strip_bench_check(strip_bench_input_t *in, u_char *check, size_t chunk,
+    unsigned level)
+{
+    u_char                 *whole, *split;
+    size_t                  n, m, i, j, k;
+    strip_bench_context_t   ctx;
+
+    whole = check;
+    split = check + in->len;
+
+    n = strip_bench_strip(in, whole, in->len, level);
+    m = strip_bench_strip(in, split, chunk, level);
+
+    memset(&ctx, 0, sizeof(strip_bench_context_t));
+
+    i = 0;
+    j = 0;
+
+    while (j < m) {
+        k = strip_bench_extra(&ctx, split + j, split + m, level);
+
+        if (k && (n - i < k || memcmp(whole + i, split + j, k) != 0)) {
+            j += k;
+            continue;
+        }
+
+        if (i == n || whole[i] != split[j]) {
+            return (long) j;
+        }
+
+        strip_bench_context(&ctx, whole + i, whole + n);
+        i++;
+        j++;
+    }
+
+    return (i == n) ? -1 : (long) j;
+}
+
+/*
+ * Returns the offset of the first byte where the output of the whole
+ * input at level 1 and that of strip_ref() part, or -1 if they do not.
+ */
+
+static long
+strip_bench_reference(strip_bench_input_t *in, u_char *check)
+{
+    u_char  *whole, *ref;
+    size_t   n, m, i;
+
+    whole = check;
+    ref = check + in->len;
+
+    n = strip_bench_strip(in, whole, in->len, 1);
+    m = strip_ref(ref, in->data, in->len);
+
+    for (i = 0; i < n && i < m; i++) {
+        if (whole[i] != ref[i]) {
+            return (long) i;
+        }
+    }
+
+    return (n == m) ? -1 : (long) i;
+}
+
+/*
+ * Strips each of strip_bench_cases[] in one buffer and in 1 byte buffers,
+ * and returns the number of outputs that are not as listed.
+ */
+
+static unsigned
+strip_bench_test(u_char *work)
+{
+    size_t               i, n;
+    unsigned             failed;
+    const char          *want;
+    strip_bench_case_t  *c;
+    strip_bench_input_t  in;
+
+    failed = 0;
+
+    for (i = 0; i < sizeof(strip_bench_cases) / sizeof(strip_bench_cases[0]);
+         i++)
+    {
+        c = &strip_bench_cases[i];
+
+        in.name = "case";
+        in.data = (u_char *) c->in;
+        in.len = strlen(c->in);
+
+        n = strip_bench_strip(&in, work, in.len, c->level);
+        want = c->whole;
+
+        if (n == strlen(want) && memcmp(work, want, n) == 0) {
+            n = strip_bench_strip(&in, work, 1, c->level);
+            want = c->split;
+
+            if (n == strlen(want) && memcmp(work, want, n) == 0) {
+                continue;
+            }
+        }
+
+        printf("case %zu at level %u gives \"%.*s\", not \"%s\"\n",
+               i, c->level, (int) n, work, want);
+        failed++;
+    }
+
+    return failed;
+}
+
+/*
+ * The flush and last_buf of a buffer that strips to nothing are carried
+ * on by the module, which strip_macro.sh checks with the blank pages of
+ * strip_upstream.  Here only what that check relies on is: such a page,
+ * tabs and a newline after every seventh, strips to nothing at every
+ * level and in buffers of any size, so that each of its buffers goes to
+ * the next filter empty.  Returns the number of outputs that are not.
+ */
+
+static unsigned
+strip_bench_blank(u_char *work)
+{
+    u_char               blank[256];
+    size_t               i, n;
+    unsigned             level, failed;
+    strip_bench_input_t  in;
+
+    for (i = 0; i < sizeof(blank); i++) {
+        blank[i] = (i % 8 == 7) ? '\n' : '\t';
+    }
+
+    in.name = "blank";
+    in.data = blank;
+    in.len = sizeof(blank);
+
+    failed = 0;
+
+    for (level = 1; level <= 3; level++) {
+        for (i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) {
+            n = strip_bench_strip(&in, work, chunk_sizes[i], level);
+
+            if (n != 0) {
+                printf("blank page at level %u chunk %zu gives %zu bytes\n",
+                       level, chunk_sizes[i], n);
+                failed++;
+            }
+        }
+    }
+
+    return failed;
+}
+
+static double
+strip_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+strip_bench_run(strip_bench_input_t *in, u_char *work, u_char *check,
+    unsigned level)
+{
+    u_char            *pos, *last;
+    long               diff, at;
+    size_t             c, chunk, off, len, out, total;
+    double             start, elapsed;
+    unsigned           rounds, i;
+    strip_parser_t     parser;
+#if (STRIP_BENCH_RDTSC)
+    unsigned long long  cycles;
+#endif
+
+    if (level == 1) {
+        diff = strip_bench_reference(in, check);
+
+        if (diff != -1) {
+            printf("%-14s output differs from the reference at byte %ld\n",
+                   in->name, diff);
+        }
+    }
+
+    rounds = STRIP_BENCH_MIN_BYTES / (in->len ? in->len : 1) + 1;
+
+    for (c = 0; c < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); c++) {
+        chunk = chunk_sizes[c];
+
+        /* small chunks are slow, keep the run time bounded */
+        i = (chunk < 256) ? rounds / 16 + 1 : rounds;
+
+        out = 0;
+        total = 0;
+
+#if (STRIP_BENCH_RDTSC)
+        cycles = __rdtsc();
+#endif
+        start = strip_bench_now();
+
+        while (i--) {
+            memcpy(work, in->data, in->len);
+            memset(&parser, 0, sizeof(strip_parser_t));
+            parser.level = level;
+
+            out = 0;
+
+            for (off = 0; off < in->len; off += len) {
+                len = in->len - off < chunk ? in->len - off : chunk;
+                pos = work + off;
+                last = strip_compact(&parser, pos, pos + len);
+                out += last - pos;
+            }
+
+            total += in->len;
+        }
+
+        elapsed = strip_bench_now() - start;
+
+        at = strip_bench_check(in, check, chunk, level);
+
+        if (at != -1) {
+            printf("%-14s output differs at level %u chunk %zu byte %ld\n",
+                   in->name, level, chunk, at);
+        }
+
+        printf("%-14s %5u %6zu %10zu %9.1f%% %9.1f",
+               in->name, level, chunk, in->len,
+               in->len ? 100.0 * (in->len - out) / in->len : 0.0,
+               total / elapsed / 1e6);
+
+#if (STRIP_BENCH_RDTSC)
+        printf(" %11.2f", (double) (__rdtsc() - cycles) / total);
+#endif
+
+        printf("\n");
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int                   i, n;
+    u_char               *work, *check;
+    unsigned              level;
+    size_t                max;
+    strip_bench_input_t  *in;
+
+    static const char  *kinds[] = {
+        "minified", "whitespace", "preformatted", "scripts", "comments",
+        "cdata"
+    };
+
+    strip_init();
+
+    n = (argc > 1) ? argc - 1 : (int) (sizeof(kinds) / sizeof(kinds[0]));
+
+    in = calloc(n, sizeof(strip_bench_input_t));
+    if (in == NULL) {
+        return 1;
+    }
+
+    /* room for strip_bench_cases[] and the blank page */
+    max = 256;
+
+    for (i = 0; i < n; i++) {
+
+        if (argc > 1) {
+            if (strip_bench_load(argv[i + 1], &in[i]) != 0) {
+                return 1;
+            }
+
+        } else {
+            in[i].name = kinds[i];
+            in[i].data = malloc(512 * 1024);
+            if (in[i].data == NULL) {
+                return 1;
+            }
+
+            in[i].len = strip_bench_generate(kinds[i], in[i].data,
+                                             512 * 1024);
+        }
+
+        if (in[i].len > max) {
+            max = in[i].len;
+        }
+    }
+
+    work = malloc(max);
+    check = malloc(2 * max);
+    if (work == NULL || check == NULL) {
+        return 1;
+    }
+
+    if (strip_bench_test(work) + strip_bench_blank(work) != 0) {
+        return 1;
+    }
+
+    printf("%-14s %5s %6s %10s %10s %9s", "input", "level", "chunk", "bytes",
+           "saved", "MB/s");
+#if (STRIP_BENCH_RDTSC)
+    printf(" %11s", "cycles/byte");
+#endif
+    printf("\n");
+
+    for (level = 1; level <= 3; level++) {
+        for (i = 0; i < n; i++) {
+            strip_bench_run(&in[i], work, check, level);
+        }
+    }
+
+#if (STRIP_PROFILE)
+    printf("\n");
+    strip_profile_dump(strip_bench_profile, NULL);
+#endif
+
+    return 0;
+}
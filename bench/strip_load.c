@@ -0,0 +1,515 @@
+/*
+ * Copyright 2008 Evan Miller
+ */
+
+/*
+ * Closed-loop HTTP load generator for strip_macro.sh, no network
+ * required:
+ *
+ *     cc -O2 -pthread -o strip_load bench/strip_load.c
+ *     ./strip_load [-c connections] [-d seconds] [-H header] port uri
+ *
+ * Each connection is a thread sending keep-alive GETs for uri to
+ * 127.0.0.1:port, the next one as soon as the last response is read,
+ * for the given time (default 10 s), and connecting again when the server
+ * closes.  Responses may come with a Content-Length, chunked, or up to
+ * the close; one that stalls for 10 s fails.  Prints one line of name
+ * value pairs: responses, errors (failed connections and responses
+ * other than 200 or cut short), responses per second, the median and
+ * 99th percentile latency in milliseconds, and the bytes received per
+ * response, headers included.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/* seconds without a byte of the response before it counts as failed */
+#define STRIP_LOAD_TIMEOUT  10
+
+typedef struct {
+    int        fd;
+    size_t     pos;
+    size_t     last;
+    uint64_t   bytes;
+    unsigned   timedout;
+    u_char     buf[65536];
+} strip_reader_t;
+
+typedef struct {
+    pthread_t        tid;
+    double          *latency;       /* in seconds */
+    size_t           n;
+    size_t           nalloc;
+    size_t           errors;
+    uint64_t         bytes;
+    strip_reader_t   reader;
+} strip_conn_t;
+
+static int          port;
+static char         request[4096];
+static size_t       request_len;
+static double       deadline;
+
+static double
+strip_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+strip_fill(strip_reader_t *r)
+{
+    ssize_t  n;
+
+    do {
+        n = read(r->fd, r->buf, sizeof(r->buf));
+    } while (n == -1 && errno == EINTR);
+
+    if (n <= 0) {
+        r->timedout = (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        return -1;
+    }
+
+    r->pos = 0;
+    r->last = n;
+    r->bytes += n;
+
+    return 0;
+}
+
+/* a line without its CRLF, cut to size - 1 bytes */
+
+static int
+strip_line(strip_reader_t *r, char *line, size_t size)
+{
+    u_char  c;
+    size_t  len;
+
+    for (len = 0; /* void */ ; /* void */ ) {
+
+        if (r->pos == r->last && strip_fill(r) == -1) {
+            return -1;
+        }
+
+        c = r->buf[r->pos++];
+
+        if (c == '\n') {
+            break;
+        }
+
+        if (c != '\r' && len < size - 1) {
+            line[len++] = c;
+        }
+    }
+
+    line[len] = '\0';
+
+    return (int) len;
+}
+
+static int
+strip_skip(strip_reader_t *r, uint64_t n)
+{
+    size_t  len;
+
+    while (n) {
+
+        if (r->pos == r->last && strip_fill(r) == -1) {
+            return -1;
+        }
+
+        len = r->last - r->pos;
+
+        if (len > n) {
+            len = n;
+        }
+
+        r->pos += len;
+        n -= len;
+    }
+
+    return 0;
+}
+
+/*
+ * Reads one response, returns its status or -1 if the connection failed;
+ * *keepalive tells whether the connection can take another request.
+ */
+
+static int
+strip_response(strip_reader_t *r, int *keepalive)
+{
+    int        status, chunked, eof;
+    char       line[1024], *value;
+    uint64_t   length;
+
+    if (strip_line(r, line, sizeof(line)) < 12
+        || strncmp(line, "HTTP/1.", 7) != 0)
+    {
+        return -1;
+    }
+
+    status = atoi(line + 9);
+    *keepalive = (line[7] != '0');
+    chunked = 0;
+    eof = 1;
+    length = 0;
+
+    for ( ;; ) {
+        if (strip_line(r, line, sizeof(line)) == -1) {
+            return -1;
+        }
+
+        if (line[0] == '\0') {
+            break;
+        }
+
+        value = strchr(line, ':');
+        if (value == NULL) {
+            continue;
+        }
+
+        *value++ = '\0';
+
+        if (strcasecmp(line, "content-length") == 0) {
+            length = strtoull(value, NULL, 10);
+            eof = 0;
+
+        } else if (strcasecmp(line, "transfer-encoding") == 0) {
+            chunked = (strcasestr(value, "chunked") != NULL);
+
+        } else if (strcasecmp(line, "connection") == 0) {
+            if (strcasestr(value, "close")) {
+                *keepalive = 0;
+
+            } else if (strcasestr(value, "keep-alive")) {
+                *keepalive = 1;
+            }
+        }
+    }
+
+    if (chunked) {
+        for ( ;; ) {
+            if (strip_line(r, line, sizeof(line)) == -1) {
+                return -1;
+            }
+
+            length = strtoull(line, NULL, 16);
+
+            if (length == 0) {
+                break;
+            }
+
+            if (strip_skip(r, length) == -1
+                || strip_line(r, line, sizeof(line)) == -1)
+            {
+                return -1;
+            }
+        }
+
+        /* the trailer, if any, up to an empty line */
+
+        do {
+            if (strip_line(r, line, sizeof(line)) == -1) {
+                return -1;
+            }
+        } while (line[0] != '\0');
+
+        return status;
+    }
+
+    if (!eof) {
+        return (strip_skip(r, length) == -1) ? -1 : status;
+    }
+
+    /* the body ends with the connection */
+
+    r->pos = r->last;
+
+    while (strip_fill(r) == 0) {
+        r->pos = r->last;
+    }
+
+    *keepalive = 0;
+
+    return status;
+}
+
+static int
+strip_connect(void)
+{
+    int                 fd, one;
+    struct timeval      tv;
+    struct sockaddr_in  sin;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
+
+    /* a response that stalls, one that never ends included, is an error */
+
+    tv.tv_sec = STRIP_LOAD_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(struct timeval));
+
+    memset(&sin, 0, sizeof(struct sockaddr_in));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *) &sin, sizeof(struct sockaddr_in))
+        == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void *
+strip_worker(void *data)
+{
+    strip_conn_t  *conn = data;
+
+    int              rc, keepalive;
+    double           start, *latency;
+    ssize_t          n;
+    size_t           sent;
+    strip_reader_t  *r;
+
+    r = &conn->reader;
+    r->fd = -1;
+
+    while (strip_now() < deadline) {
+
+        if (r->fd == -1) {
+            r->fd = strip_connect();
+
+            if (r->fd == -1) {
+                conn->errors++;
+                usleep(10000);
+                continue;
+            }
+
+            r->pos = 0;
+            r->last = 0;
+        }
+
+        start = strip_now();
+
+        for (sent = 0; sent < request_len; sent += n) {
+            n = write(r->fd, request + sent, request_len - sent);
+
+            if (n == -1) {
+                if (errno == EINTR) {
+                    n = 0;
+                    continue;
+                }
+                break;
+            }
+        }
+
+        r->bytes = 0;
+        r->timedout = 0;
+
+        rc = (sent == request_len) ? strip_response(r, &keepalive) : -1;
+
+        conn->bytes += r->bytes;
+
+        if (rc == -1) {
+            /* a keep-alive connection closed by the server is no error */
+
+            if (r->bytes || r->timedout) {
+                conn->errors++;
+            }
+
+            close(r->fd);
+            r->fd = -1;
+            continue;
+        }
+
+        if (rc != 200) {
+            conn->errors++;
+
+        } else {
+            if (conn->n == conn->nalloc) {
+                conn->nalloc = conn->nalloc ? conn->nalloc * 2 : 4096;
+
+                latency = realloc(conn->latency,
+                                  conn->nalloc * sizeof(double));
+                if (latency == NULL) {
+                    break;
+                }
+
+                conn->latency = latency;
+            }
+
+            conn->latency[conn->n++] = strip_now() - start;
+        }
+
+        if (!keepalive) {
+            close(r->fd);
+            r->fd = -1;
+        }
+    }
+
+    if (r->fd != -1) {
+        close(r->fd);
+    }
+
+    return NULL;
+}
+
+static int
+strip_cmp(const void *one, const void *two)
+{
+    double  a = *(const double *) one, b = *(const double *) two;
+
+    return (a > b) - (a < b);
+}
+
+static void
+strip_usage(void)
+{
+    fprintf(stderr, "usage: strip_load [-c connections] [-d seconds] "
+                    "[-H header] port uri\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    int            c, i, connections, duration;
+    char          *headers[16];
+    size_t         j, n, errors, nheaders;
+    double        *all, start, elapsed;
+    uint64_t       bytes;
+    strip_conn_t  *conns;
+
+    connections = 16;
+    duration = 10;
+    nheaders = 0;
+
+    while ((c = getopt(argc, argv, "c:d:H:")) != -1) {
+        switch (c) {
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'H':
+            if (nheaders == sizeof(headers) / sizeof(headers[0])) {
+                strip_usage();
+            }
+
+            headers[nheaders++] = optarg;
+            break;
+        default:
+            strip_usage();
+        }
+    }
+
+    if (argc - optind != 2 || connections < 1 || duration < 1) {
+        strip_usage();
+    }
+
+    port = atoi(argv[optind]);
+
+    if (port <= 0 || port > 65535 || argv[optind + 1][0] != '/') {
+        strip_usage();
+    }
+
+    n = snprintf(request, sizeof(request),
+                 "GET %s HTTP/1.1\r\nHost: localhost\r\n", argv[optind + 1]);
+
+    for (j = 0; j < nheaders && n < sizeof(request); j++) {
+        n += snprintf(request + n, sizeof(request) - n, "%s\r\n",
+                      headers[j]);
+    }
+
+    if (n < sizeof(request)) {
+        n += snprintf(request + n, sizeof(request) - n, "\r\n");
+    }
+
+    if (n >= sizeof(request)) {
+        strip_usage();
+    }
+
+    request_len = n;
+
+    conns = calloc(connections, sizeof(strip_conn_t));
+    if (conns == NULL) {
+        return 1;
+    }
+
+    start = strip_now();
+    deadline = start + duration;
+
+    for (i = 0; i < connections; i++) {
+        if (pthread_create(&conns[i].tid, NULL, strip_worker, &conns[i])
+            != 0)
+        {
+            fprintf(stderr, "strip_load: cannot create thread\n");
+            return 1;
+        }
+    }
+
+    n = 0;
+    errors = 0;
+    bytes = 0;
+
+    for (i = 0; i < connections; i++) {
+        pthread_join(conns[i].tid, NULL);
+
+        n += conns[i].n;
+        errors += conns[i].errors;
+        bytes += conns[i].bytes;
+    }
+
+    elapsed = strip_now() - start;
+
+    all = malloc((n ? n : 1) * sizeof(double));
+    if (all == NULL) {
+        return 1;
+    }
+
+    for (n = 0, i = 0; i < connections; i++) {
+        memcpy(all + n, conns[i].latency, conns[i].n * sizeof(double));
+        n += conns[i].n;
+    }
+
+    qsort(all, n, sizeof(double), strip_cmp);
+
+    printf("responses %zu errors %zu rps %.1f p50 %.3f p99 %.3f bytes %.0f\n",
+           n, errors, n / elapsed,
+           n ? all[n / 2] * 1000 : 0.0,
+           n ? all[n * 99 / 100] * 1000 : 0.0,
+           n ? (double) bytes / n : 0.0);
+
+    return (n == 0);
+}
@@ -0,0 +1,281 @@
+#!/bin/sh
+
+#
+# Copyright 2008 Evan Miller
+#
+
+# End to end benchmark, on one box and without network: nginx built with
+# this module, in front of static files and of strip_upstream, loaded by
+# strip_load over 127.0.0.1.
+#
+#     bench/strip_macro.sh nginx-source-dir [work-dir]
+#
+# nginx is configured from nginx-source-dir with this directory as an
+# addon and installed into work-dir (default /tmp/strip_macro), where the
+# pages, logs and caches go too; the build is kept until a source of the
+# module is newer.  For each page size, each mode and each origin, a
+# static file or the same page proxied, it prints the responses per
+# second, the median and 99th percentile latency, the CPU time of the
+# nginx workers per response and the bytes received per response.  Before
+# that it checks that a proxied page that strips to nothing still ends,
+# with proxy_buffering on and off, and stops if it does not.  Settings
+# come from the environment:
+#
+#     SIZES         page sizes, default "1k 10k 100k 1m 10m"
+#     MODES         default all of them, see strip_macro_mode
+#     DURATION      seconds per run, default 10
+#     CONNECTIONS   concurrent connections, default 16
+#     CHUNK         bytes per write of the upstream, default 4096
+#     WORKERS       nginx worker processes, default 1
+#     PORT          nginx port, default 8480; the upstream uses PORT + 1
+#     CONFIGURE     more arguments to nginx's ./configure
+
+set -e
+
+SIZES=${SIZES:-"1k 10k 100k 1m 10m"}
+MODES=${MODES:-"off on level3 slices coalesce buffer threads cache static
+                proxy_cache upstream_cache gzip"}
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-16}
+CHUNK=${CHUNK:-4096}
+WORKERS=${WORKERS:-1}
+PORT=${PORT:-8480}
+CC=${CC:-cc}
+
+if [ $# -lt 1 ] || [ ! -x "$1/configure" ]; then
+    echo "usage: $0 nginx-source-dir [work-dir]" >&2
+    exit 2
+fi
+
+src=$(cd "$1" && pwd)
+work=${2:-/tmp/strip_macro}
+here=$(cd "$(dirname "$0")/.." && pwd)
+
+mkdir -p "$work/conf" "$work/logs" "$work/pages" "$work/cache"
+
+# the directives of each mode
+
+strip_macro_mode() {
+    case $1 in
+    off)            echo "strip off;" ;;
+    on)             echo "strip on;" ;;
+    level3)         echo "strip on; strip_level 3;" ;;
+    slices)         echo "strip on; strip_slices on;" ;;
+    coalesce)       echo "strip on; strip_coalesce 64k;" ;;
+    buffer)         echo "strip on; strip_buffer_size 1m;" ;;
+    threads)        echo "strip on; strip_thread_pool default;" ;;
+    cache)          echo "strip on; strip_cache strip_cache;" ;;
+    static)         echo "strip on; strip_static on;" ;;
+    proxy_cache)    echo "strip on; proxy_cache strip_proxy;" ;;
+    upstream_cache) echo "strip on; strip_upstream_cache on;" \
+                         "proxy_cache strip_proxy;" ;;
+    gzip)           echo "strip on; strip_gzip on;" ;;
+    *)              echo "$0: unknown mode $1" >&2; exit 2 ;;
+    esac
+}
+
+# the origins a mode applies to
+
+strip_macro_origins() {
+    case $1 in
+    cache|static)                   echo "static" ;;
+    proxy_cache|upstream_cache)     echo "proxy" ;;
+    gzip)                           echo "proxy" ;;
+    *)                              echo "static proxy" ;;
+    esac
+}
+
+# user and system time of the workers, in clock ticks
+
+strip_macro_cpu() {
+    master=$(cat "$work/logs/nginx.pid")
+    total=0
+
+    for dir in /proc/[0-9]*; do
+        stat=$(cat "$dir/stat" 2>/dev/null) || continue
+
+        # the fields after the command: state ppid ... utime stime
+
+        set -- ${stat##*) }
+
+        if [ "$2" = "$master" ] \
+           && tr '\0' ' ' < "$dir/cmdline" | grep -q "worker process"
+        then
+            total=$((total + ${12} + ${13}))
+        fi
+    done
+
+    echo $total
+}
+
+strip_macro_stop() {
+    if [ -f "$work/logs/nginx.pid" ]; then
+        "$work/sbin/nginx" -p "$work/" -c conf/strip_macro.conf -s stop \
+            2>/dev/null || true
+    fi
+
+    if [ -n "$upstream" ]; then
+        kill "$upstream" 2>/dev/null || true
+    fi
+}
+
+if [ ! -x "$work/sbin/nginx" ] \
+   || [ -n "$(find "$here" -maxdepth 1 \( -name '*.[ch]' -o -name config \) \
+                   -newer "$work/sbin/nginx")" ]
+then
+    echo "building nginx in $work, see $work/build.log" >&2
+
+    (cd "$src" \
+     && ./configure --prefix="$work" --add-module="$here" --with-threads \
+                    --without-http_rewrite_module $CONFIGURE \
+     && make -j"$(getconf _NPROCESSORS_ONLN)" \
+     && make install) > "$work/build.log" 2>&1
+fi
+
+$CC -O2 -pthread -o "$work/strip_upstream" "$here/bench/strip_upstream.c" -lz
+$CC -O2 -pthread -o "$work/strip_load" "$here/bench/strip_load.c"
+$CC -O2 -pthread -I"$here" -o "$work/strip" "$here/tools/strip.c" \
+    "$here/strip_core.c"
+
+for size in $SIZES; do
+    "$work/strip_upstream" -g "$size" > "$work/pages/$size.html"
+done
+
+# the copies that strip_static sends
+
+"$work/strip" -f "$work/pages" > /dev/null
+
+rm -rf "$work/cache"/*
+
+{
+    cat <<EOF
+worker_processes $WORKERS;
+pid logs/nginx.pid;
+error_log logs/error.log;
+
+events {
+    worker_connections 4096;
+}
+
+http {
+    access_log off;
+    default_type text/html;
+    sendfile on;
+    keepalive_requests 1000000;
+    open_file_cache max=64;
+
+    strip_cache_zone strip_cache:64m;
+    strip_cache_max_size 16m;
+
+    proxy_cache_path $work/cache keys_zone=strip_proxy:16m;
+    proxy_cache_valid 200 1h;
+    proxy_http_version 1.1;
+    proxy_set_header Connection "";
+
+    upstream strip_upstream {
+        server 127.0.0.1:$((PORT + 1));
+        keepalive 64;
+    }
+
+    server {
+        listen 127.0.0.1:$PORT;
+EOF
+
+    for mode in $MODES; do
+        directives=$(strip_macro_mode "$mode")
+
+        for origin in $(strip_macro_origins "$mode"); do
+            if [ "$origin" = static ]; then
+                target="alias $work/pages/;"
+
+            elif [ "$mode" = gzip ]; then
+                target="proxy_pass http://strip_upstream/gz/;"
+
+            else
+                target="proxy_pass http://strip_upstream/;"
+            fi
+
+            echo "        location /$origin/$mode/ { $target $directives }"
+        done
+    done
+
+    for buffering in on off; do
+        echo "        location /blank/$buffering/ {" \
+             "proxy_pass http://strip_upstream/blank/;" \
+             "proxy_buffering $buffering; strip on; }"
+    done
+
+    cat <<EOF
+    }
+}
+EOF
+} > "$work/conf/strip_macro.conf"
+
+upstream=
+trap strip_macro_stop EXIT
+trap 'exit 1' INT TERM
+
+"$work/strip_upstream" -p $((PORT + 1)) -c "$CHUNK" &
+upstream=$!
+
+"$work/sbin/nginx" -p "$work/" -c conf/strip_macro.conf
+
+sleep 1
+
+# every buffer of the page is emptied, the flags it carries, flush and in
+# the end last_buf, have to go on without it or the response never ends
+
+for buffering in on off; do
+    result=$("$work/strip_load" -c 1 -d 2 "$PORT" \
+                                "/blank/$buffering/100k?chunk=512") || true
+
+    set -- $result
+
+    if [ $# -ne 12 ] || [ "$2" -eq 0 ] || [ "$4" -ne 0 ]; then
+        echo "$0: a page that strips to nothing did not end" \
+             "with proxy_buffering $buffering: $result" >&2
+        exit 1
+    fi
+done
+
+ticks=$(getconf CLK_TCK)
+
+printf "%-5s %-6s %-14s %9s %8s %8s %10s %10s %6s\n" \
+       size origin mode "req/s" "p50 ms" "p99 ms" "cpu us/req" "bytes/req" \
+       errors
+
+for size in $SIZES; do
+    for mode in $MODES; do
+        for origin in $(strip_macro_origins "$mode"); do
+
+            uri=/$origin/$mode/$size
+
+            if [ "$origin" = static ]; then
+                uri=$uri.html
+            fi
+
+            before=$(strip_macro_cpu)
+
+            result=$("$work/strip_load" -c "$CONNECTIONS" -d "$DURATION" \
+                                        "$PORT" "$uri") || true
+
+            after=$(strip_macro_cpu)
+
+            # responses N errors N rps N p50 N p99 N bytes N
+
+            set -- $result
+
+            if [ $# -ne 12 ]; then
+                echo "$size $origin $mode: strip_load failed" >&2
+                continue
+            fi
+
+            cpu=$(awk "BEGIN { printf \"%.1f\", ($after - $before) * 1e6 \
+                                                / $ticks / ($2 ? $2 : 1) }")
+
+            printf "%-5s %-6s %-14s %9s %8s %8s %10s %10s %6s\n" \
+                   "$size" "$origin" "$mode" "$6" "$8" "${10}" "$cpu" \
+                   "${12}" "$4"
+        done
+    done
+done
@@ -0,0 +1,1447 @@
+/*
+ * Copyright 2008 Evan Miller
+ */
+
+/*
+ * A slow reference for the strip parser: the level 1 HTML rules of
+ * strip_core.c written out by hand as nested loops and switches, so that
+ * strip_bench can check that the tables built from them, with their
+ * copied rows, tries, edits and skips, come out the same.  Where a rule
+ * has a quirk, such as a '>' right after "</" being part of the name, it
+ * is followed here too.
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+#include "strip_ref.h"
+
+#define STRIP_REF_NONE  ((size_t) -1)
+
+#define STRIP_REF_SPACE     " \t\r\n"
+#define STRIP_REF_JS_PUNCT  "{(,;=:[!?&|*%^~>"
+
+/* a raw body waiting for '<', or for '/' after one */
+#define STRIP_REF_BODY   -2
+#define STRIP_REF_ANGLE  -1
+
+typedef struct {
+    const u_char  *p;
+    const u_char  *last;
+    u_char        *out;
+    size_t         n;
+    size_t         mark;    /* STRIP_REF_NONE or an offset in out */
+} strip_ref_t;
+
+typedef enum {
+    ref_js = 0,
+    ref_js_operator,
+    ref_js_operator_space,
+    ref_js_operator_newline,
+    ref_js_operand,
+    ref_js_operand_space,
+    ref_js_operand_newline,
+    ref_js_keyword_r,
+    ref_js_keyword_re,
+    ref_js_keyword_ret,
+    ref_js_keyword_retu,
+    ref_js_keyword_retur,
+    ref_js_keyword_return,
+    ref_js_keyword_space,
+    ref_js_operand_slash,
+    ref_js_regex_slash,
+    ref_js_angle,
+    ref_js_angle_bang,
+    ref_js_angle_bang_dash,
+    ref_js_double_quote,
+    ref_js_double_quote_escape,
+    ref_js_double_quote_angle,
+    ref_js_single_quote,
+    ref_js_single_quote_escape,
+    ref_js_single_quote_angle,
+    ref_js_template,
+    ref_js_template_escape,
+    ref_js_template_dollar,
+    ref_js_template_angle,
+    ref_js_regex,
+    ref_js_regex_escape,
+    ref_js_regex_angle,
+    ref_js_regex_class,
+    ref_js_regex_class_escape,
+    ref_js_regex_class_angle,
+    ref_js_line_comment,
+    ref_js_line_comment_kept,
+    ref_js_line_comment_kept_angle,
+    ref_js_block_comment,
+    ref_js_block_comment_newline,
+    ref_js_block_comment_star,
+    ref_js_block_comment_kept,
+    ref_js_block_comment_kept_star,
+    ref_js_block_comment_kept_angle,
+
+    /* a comment that is dropped, back to where it started */
+    ref_js_slash,
+    ref_js_slash_block,
+    ref_js_slash_block_star,
+    ref_js_slash_line,
+
+    /* the script ends, or the rest of it is copied unchanged */
+    ref_js_end_slash,
+    ref_js_raw
+} strip_ref_js_e;
+
+typedef enum {
+    ref_css = 0,
+    ref_css_token,
+    ref_css_space,
+    ref_css_slash,
+    ref_css_angle,
+    ref_css_comment,
+    ref_css_comment_star,
+    ref_css_double_quote,
+    ref_css_double_quote_escape,
+    ref_css_double_quote_angle,
+    ref_css_single_quote,
+    ref_css_single_quote_escape,
+    ref_css_single_quote_angle,
+
+    ref_css_slash_dropped,
+    ref_css_slash_block,
+    ref_css_slash_block_star,
+
+    ref_css_end_slash,
+    ref_css_raw_angle,
+    ref_css_raw
+} strip_ref_css_e;
+
+static void strip_ref_text(strip_ref_t *r);
+static void strip_ref_tag(strip_ref_t *r);
+static void strip_ref_end_tag(strip_ref_t *r);
+static void strip_ref_bang(strip_ref_t *r);
+static void strip_ref_name(strip_ref_t *r);
+static void strip_ref_attributes(strip_ref_t *r);
+static void strip_ref_script_attributes(strip_ref_t *r);
+static void strip_ref_style_attributes(strip_ref_t *r);
+static void strip_ref_js(strip_ref_t *r);
+static void strip_ref_css(strip_ref_t *r);
+static void strip_ref_raw(strip_ref_t *r, const char *name, int k);
+
+static const char  *strip_ref_names[] = {
+    "script", "style", "pre", "textarea"
+};
+
+static int
+strip_ref_in(u_char c, const char *chars)
+{
+    return c != '\0' && strchr(chars, c) != NULL;
+}
+
+static int
+strip_ref_end(strip_ref_t *r)
+{
+    return r->p == r->last;
+}
+
+static void
+strip_ref_keep(strip_ref_t *r)
+{
+    r->out[r->n++] = *r->p++;
+}
+
+/* keeps bytes up to and including the next c */
+
+static void
+strip_ref_until(strip_ref_t *r, u_char c)
+{
+    while (!strip_ref_end(r)) {
+        if (*r->p == c) {
+            strip_ref_keep(r);
+            return;
+        }
+
+        strip_ref_keep(r);
+    }
+}
+
+static void
+strip_ref_cut(strip_ref_t *r, size_t n)
+{
+    if (r->mark == STRIP_REF_NONE) {
+        return;
+    }
+
+    memmove(r->out + r->mark, r->out + r->mark + n, r->n - r->mark - n);
+    r->n -= n;
+}
+
+size_t
+strip_ref(u_char *out, const u_char *in, size_t len)
+{
+    strip_ref_t  r;
+
+    r.p = in;
+    r.last = in + len;
+    r.out = out;
+    r.n = 0;
+    r.mark = STRIP_REF_NONE;
+
+    strip_ref_text(&r);
+
+    return r.n;
+}
+
+/* a space is kept and the rest of a run of whitespace dropped */
+
+static void
+strip_ref_text(strip_ref_t *r)
+{
+    while (!strip_ref_end(r)) {
+
+        switch(*r->p) {
+            case '\r':
+            case '\n':
+            case '\t':
+                r->p++;
+                break;
+
+            case ' ':
+                strip_ref_keep(r);
+
+                while (!strip_ref_end(r)
+                       && strip_ref_in(*r->p, STRIP_REF_SPACE))
+                {
+                    r->p++;
+                }
+
+                break;
+
+            case '<':
+                strip_ref_keep(r);
+                strip_ref_tag(r);
+                break;
+
+            default:
+                strip_ref_keep(r);
+                break;
+        }
+    }
+}
+
+/* after '<'; a tag that starts with none of these ends the parse */
+
+static void
+strip_ref_tag(strip_ref_t *r)
+{
+    u_char  c;
+
+    while (!strip_ref_end(r) && *r->p == ' ') {
+        strip_ref_keep(r);
+    }
+
+    if (strip_ref_end(r)) {
+        return;
+    }
+
+    c = *r->p;
+
+    if (c == '!') {
+        strip_ref_keep(r);
+        strip_ref_bang(r);
+
+    } else if (c == '/') {
+        strip_ref_keep(r);
+        strip_ref_end_tag(r);
+
+    } else if (isalpha(c)) {
+        strip_ref_name(r);
+
+    } else {
+        memcpy(r->out + r->n, r->p, r->last - r->p);
+        r->n += r->last - r->p;
+        r->p = r->last;
+    }
+}
+
+static void
+strip_ref_end_tag(strip_ref_t *r)
+{
+    while (!strip_ref_end(r) && *r->p == ' ') {
+        r->p++;
+    }
+
+    if (strip_ref_end(r)) {
+        return;
+    }
+
+    /* the first byte of the name is not looked at, even if it is '>' */
+
+    strip_ref_keep(r);
+    strip_ref_until(r, '>');
+}
+
+/*
+ * After "<!": a comment runs to the first "-->" and a CDATA section to
+ * the first "]]>", anything else to the first '>'.  The byte that shows
+ * it is not one of the first two is read as part of the third.
+ */
+
+static void
+strip_ref_bang(strip_ref_t *r)
+{
+    u_char       c;
+    unsigned     n;
+    const char  *s;
+
+    if (strip_ref_end(r)) {
+        return;
+    }
+
+    if (*r->p == '-') {
+        strip_ref_keep(r);
+
+        if (strip_ref_end(r)) {
+            return;
+        }
+
+        if (*r->p == '-') {
+            strip_ref_keep(r);
+
+            for (n = 0; !strip_ref_end(r); /* void */) {
+                c = *r->p;
+                strip_ref_keep(r);
+
+                if (c == '>' && n >= 2) {
+                    return;
+                }
+
+                n = (c == '-') ? n + 1 : 0;
+            }
+
+            return;
+        }
+
+    } else if (*r->p == '[') {
+        strip_ref_keep(r);
+
+        for (s = "CDATA["; *s; s++) {
+            if (strip_ref_end(r)) {
+                return;
+            }
+
+            if (*r->p != (u_char) *s) {
+                break;
+            }
+
+            strip_ref_keep(r);
+        }
+
+        if (*s == '\0') {
+
+            for (n = 0; !strip_ref_end(r); /* void */) {
+                c = *r->p;
+                strip_ref_keep(r);
+
+                if (c == '>' && n == 2) {
+                    return;
+                }
+
+                n = (c == ']' && n < 2) ? n + 1 : 0;
+            }
+
+            return;
+        }
+    }
+
+    if (strip_ref_end(r)) {
+        return;
+    }
+
+    strip_ref_keep(r);
+    strip_ref_until(r, '>');
+}
+
+/* whether the n bytes at p start one of strip_ref_names[] */
+
+static const char *
+strip_ref_prefix(const u_char *p, size_t n)
+{
+    size_t  k;
+
+    for (k = 0; k < sizeof(strip_ref_names) / sizeof(char *); k++) {
+        if (strlen(strip_ref_names[k]) >= n
+            && strncasecmp(strip_ref_names[k], (const char *) p, n) == 0)
+        {
+            return strip_ref_names[k];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * A tag name.  As long as it starts one of strip_ref_names[] it may turn
+ * out to be one, which once complete goes on to its own rules after
+ * whitespace, '/' or '>'.
+ */
+
+static void
+strip_ref_name(strip_ref_t *r)
+{
+    u_char         c;
+    size_t         len;
+    const char    *name;
+    const u_char  *start;
+
+    start = r->p;
+    strip_ref_keep(r);
+
+    len = 1;
+    name = strip_ref_prefix(start, len);
+
+    while (!strip_ref_end(r)) {
+        c = *r->p;
+
+        if (name != NULL) {
+
+            if (strlen(name) == len
+                && (c == '>' || strip_ref_in(c, " \t\r\n/")))
+            {
+                strip_ref_keep(r);
+
+                if (strcmp(name, "script") == 0) {
+                    if (c == '>') {
+                        strip_ref_js(r);
+                    } else {
+                        strip_ref_script_attributes(r);
+                    }
+
+                } else if (strcmp(name, "style") == 0) {
+                    if (c == '>') {
+                        strip_ref_css(r);
+                    } else {
+                        strip_ref_style_attributes(r);
+                    }
+
+                } else {
+                    strip_ref_raw(r, name, STRIP_REF_BODY);
+                }
+
+                return;
+            }
+
+            name = isalpha(c) ? strip_ref_prefix(start, len + 1) : NULL;
+
+            if (name != NULL) {
+                strip_ref_keep(r);
+                len++;
+                continue;
+            }
+        }
+
+        strip_ref_keep(r);
+
+        if (c == '>') {
+            return;
+        }
+
+        if (c == ' ') {
+            strip_ref_attributes(r);
+            return;
+        }
+    }
+}
+
+/* after the space that follows a tag name */
+
+static void
+strip_ref_attributes(strip_ref_t *r)
+{
+    u_char  c;
+    enum {
+        sw_space = 0,
+        sw_name,
+        sw_equals,
+        sw_value,
+        sw_double_quote,
+        sw_single_quote
+    } state;
+
+    state = sw_space;
+
+    while (!strip_ref_end(r)) {
+        c = *r->p;
+
+        if (state == sw_space && c == ' ') {
+            r->p++;
+            continue;
+        }
+
+        strip_ref_keep(r);
+
+        switch(state) {
+            case sw_space:
+                if (c == '>') {
+                    return;
+                }
+                state = sw_name;
+                break;
+
+            case sw_name:
+                if (c == '=') {
+                    state = sw_equals;
+                } else if (c == '>') {
+                    return;
+                } else if (c == ' ') {
+                    state = sw_space;
+                }
+                break;
+
+            /* any byte starts an unquoted value, even '>' */
+
+            case sw_equals:
+                if (c == '"') {
+                    state = sw_double_quote;
+                } else if (c == '\'') {
+                    state = sw_single_quote;
+                } else {
+                    state = sw_value;
+                }
+                break;
+
+            case sw_value:
+                if (c == '>') {
+                    return;
+                }
+                if (c == ' ') {
+                    state = sw_space;
+                }
+                break;
+
+            case sw_double_quote:
+                if (c == '"') {
+                    state = sw_value;
+                }
+                break;
+
+            case sw_single_quote:
+                if (c == '\'') {
+                    state = sw_value;
+                }
+                break;
+        }
+    }
+}
+
+/*
+ * The attributes of a script are copied; after "type", the script is
+ * minified only if "java" comes before the next '>'.
+ */
+
+static void
+strip_ref_script_attributes(strip_ref_t *r)
+{
+    u_char  c, quote;
+    size_t  k;
+
+    quote = '\0';
+    k = 0;
+
+    while (!strip_ref_end(r)) {
+        c = *r->p;
+        strip_ref_keep(r);
+
+        if (quote) {
+            if (c == quote) {
+                quote = '\0';
+            }
+            continue;
+        }
+
+        if (c == '>') {
+            strip_ref_js(r);
+            return;
+        }
+
+        if (c == '"' || c == '\'') {
+            quote = c;
+            k = 0;
+            continue;
+        }
+
+        if (tolower(c) == "type"[k]) {
+            if (++k < 4) {
+                continue;
+            }
+            break;
+        }
+
+        k = (tolower(c) == 't') ? 1 : 0;
+    }
+
+    k = 0;
+
+    while (!strip_ref_end(r)) {
+        c = *r->p;
+        strip_ref_keep(r);
+
+        if (c == '>') {
+            strip_ref_raw(r, "script", STRIP_REF_BODY);
+            return;
+        }
+
+        if (tolower(c) == "java"[k]) {
+            if (++k < 4) {
+                continue;
+            }
+            break;
+        }
+
+        k = (tolower(c) == 'j') ? 1 : 0;
+    }
+
+    while (!strip_ref_end(r)) {
+        c = *r->p;
+        strip_ref_keep(r);
+
+        if (c == '>') {
+            strip_ref_js(r);
+            return;
+        }
+    }
+}
+
+static void
+strip_ref_style_attributes(strip_ref_t *r)
+{
+    u_char  c, quote;
+
+    quote = '\0';
+
+    while (!strip_ref_end(r)) {
+        c = *r->p;
+        strip_ref_keep(r);
+
+        if (quote) {
+            if (c == quote) {
+                quote = '\0';
+            }
+
+        } else if (c == '>') {
+            strip_ref_css(r);
+            return;
+
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        }
+    }
+}
+
+/* what follows a byte after an operator, or at the start of a script */
+
+static unsigned
+strip_ref_js_operator(u_char c)
+{
+    switch(c) {
+        case ' ':
+        case '\t':
+            return ref_js_operator_space;
+        case '\r':
+        case '\n':
+            return ref_js_operator_newline;
+        case '}':
+        case '+':
+        case '-':
+        case '.':
+            return ref_js_operator;
+        case 'r':
+            return ref_js_keyword_r;
+        case '/':
+            return ref_js_regex_slash;
+        case '<':
+            return ref_js_angle;
+        case '"':
+            return ref_js_double_quote;
+        case '\'':
+            return ref_js_single_quote;
+        case '`':
+            return ref_js_template;
+    }
+
+    return strip_ref_in(c, STRIP_REF_JS_PUNCT) ? ref_js : ref_js_operand;
+}
+
+/* a slash after an operand divides, and "r" in a word starts no keyword */
+
+static unsigned
+strip_ref_js_operand(u_char c)
+{
+    switch(c) {
+        case ' ':
+        case '\t':
+            return ref_js_operand_space;
+        case '\r':
+        case '\n':
+            return ref_js_operand_newline;
+        case 'r':
+            return ref_js_operand;
+        case '/':
+            return ref_js_operand_slash;
+    }
+
+    return strip_ref_js_operator(c);
+}
+
+static int
+strip_ref_js_spaced(unsigned state)
+{
+    return state == ref_js_operator_space
+           || state == ref_js_operand_space
+           || state == ref_js_keyword_space;
+}
+
+/*
+ * A script.  The space kept after a token is marked and cut if the next
+ * byte cannot run into the token, a comment where one is dropped is
+ * marked at its '/' and taken back at its end, and a line comment after
+ * a space leaves only its newline.
+ */
+
+static void
+strip_ref_js(strip_ref_t *r)
+{
+    u_char     c;
+    unsigned   state, next, from, drop, mark, cut, retract;
+
+    state = ref_js;
+    from = ref_js;
+
+    while (!strip_ref_end(r)) {
+        c = *r->p;
+
+        drop = 0;
+        mark = 0;
+        cut = 0;
+        retract = 0;
+
+        switch(state) {
+
+            case ref_js:
+                if (strip_ref_in(c, STRIP_REF_SPACE)) {
+                    next = state;
+                    drop = 1;
+                } else if (c == '/') {
+                    next = ref_js_slash;
+                    mark = 1;
+                } else {
+                    next = strip_ref_js_operator(c);
+                }
+                break;
+
+            case ref_js_operator:
+                next = strip_ref_js_operator(c);
+                break;
+
+            case ref_js_operator_space:
+                if (c == ' ' || c == '\t') {
+                    next = state;
+                    drop = 1;
+                } else if (c == '/') {
+                    next = ref_js_slash;
+                    mark = 1;
+                } else if (c == '\r' || c == '\n') {
+                    next = ref_js_operator_newline;
+                } else if (c == '+' || c == '-') {
+                    next = ref_js_operator;
+                } else if (c == 'r') {
+                    next = ref_js_keyword_r;
+                    cut = 1;
+                } else if (isalnum(c) || strip_ref_in(c, "_$)]")) {
+                    next = ref_js_operand;
+                    cut = 1;
+                } else {
+                    next = strip_ref_js_operator(c);
+                    cut = (next != ref_js_operand);
+                }
+                break;
+
+            case ref_js_operator_newline:
+                if (strip_ref_in(c, STRIP_REF_SPACE)) {
+                    next = state;
+                    drop = 1;
+                } else if (c == '/') {
+                    next = ref_js_slash;
+                    mark = 1;
+                } else {
+                    next = strip_ref_js_operator(c);
+                }
+                break;
+
+            case ref_js_operand:
+                next = strip_ref_js_operand(c);
+                break;
+
+            case ref_js_operand_space:
+            case ref_js_keyword_space:
+                if (c == ' ' || c == '\t') {
+                    next = state;
+                    drop = 1;
+                } else if (c == '/') {
+                    next = ref_js_slash;
+                    mark = 1;
+                } else if (c == '\r' || c == '\n') {
+                    next = (state == ref_js_operand_space)
+                           ? ref_js_operand_newline : ref_js_operator_newline;
+                } else if (c == 'r') {
+                    next = ref_js_keyword_r;
+                } else if (strip_ref_in(c, STRIP_REF_JS_PUNCT)) {
+                    next = ref_js;
+                    cut = 1;
+                } else if (c == ')' || c == ']') {
+                    next = ref_js_operand;
+                    cut = 1;
+                } else if (strip_ref_in(c, "}+-")) {
+                    next = ref_js_operator;
+                    cut = 1;
+                } else if (c == '<') {
+                    next = ref_js_angle;
+                    cut = 1;
+                } else {
+                    next = strip_ref_js_operand(c);
+                }
+                break;
+
+            case ref_js_operand_newline:
+                if (strip_ref_in(c, STRIP_REF_SPACE)) {
+                    next = state;
+                    drop = 1;
+                } else if (c == '/') {
+                    next = ref_js_slash;
+                    mark = 1;
+                } else if (c == 'r') {
+                    next = ref_js_keyword_r;
+                } else {
+                    next = strip_ref_js_operand(c);
+                }
+                break;
+
+            case ref_js_keyword_r:
+            case ref_js_keyword_re:
+            case ref_js_keyword_ret:
+            case ref_js_keyword_retu:
+            case ref_js_keyword_retur:
+                if (c == "return"[state - ref_js_keyword_r + 1]) {
+                    next = state + 1;
+                } else {
+                    next = strip_ref_js_operand(c);
+                }
+                break;
+
+            case ref_js_keyword_return:
+                if (isalnum(c) || c == '_' || c == '$') {
+                    next = ref_js_operand;
+                } else if (c == ' ' || c == '\t') {
+                    next = ref_js_keyword_space;
+                } else {
+                    next = strip_ref_js_operator(c);
+                }
+                break;
+
+            case ref_js_operand_slash:
+                if (c == '/') {
+                    next = ref_js_line_comment;
+                } else if (c == '*') {
+                    next = ref_js_block_comment;
+                } else {
+                    next = strip_ref_js_operator(c);
+                }
+                break;
+
+            case ref_js_regex_slash:
+                if (c == '/') {
+                    next = ref_js_line_comment;
+                } else if (c == '*') {
+                    next = ref_js_block_comment;
+                } else {
+                    state = ref_js_regex;
+                    continue;
+                }
+                break;
+
+            case ref_js_angle:
+                if (c == '/') {
+                    next = ref_js_end_slash;
+                } else if (c == '!') {
+                    next = ref_js_angle_bang;
+                } else {
+                    next = strip_ref_js_operator(c);
+                }
+                break;
+
+            /* read as after punctuation, the comment helper aside */
+
+            case ref_js_angle_bang:
+                if (c == '-') {
+                    next = ref_js_angle_bang_dash;
+                } else if (strip_ref_in(c, STRIP_REF_SPACE)) {
+                    next = ref_js;
+                    drop = 1;
+                } else {
+                    next = strip_ref_js_operator(c);
+                }
+                break;
+
+            case ref_js_angle_bang_dash:
+                if (c == '-') {
+                    next = ref_js_line_comment;
+                } else {
+                    next = strip_ref_js_operator(c);
+                }
+                break;
+
+            case ref_js_double_quote:
+            case ref_js_single_quote:
+                if (c == (state == ref_js_double_quote ? '"' : '\'')) {
+                    next = ref_js_operand;
+                } else if (c == '\\') {
+                    next = state + 1;
+                } else if (c == '<') {
+                    next = state + 2;
+                } else {
+                    next = state;
+                }
+                break;
+
+            case ref_js_double_quote_escape:
+            case ref_js_single_quote_escape:
+                next = (c == '<') ? state + 1 : state - 1;
+                break;
+
+            case ref_js_double_quote_angle:
+            case ref_js_single_quote_angle:
+                if (c == '/') {
+                    next = ref_js_end_slash;
+                } else {
+                    state -= 2;
+                    continue;
+                }
+                break;
+
+            case ref_js_template:
+                if (c == '`') {
+                    next = ref_js_operand;
+                } else if (c == '\\') {
+                    next = ref_js_template_escape;
+                } else if (c == '$') {
+                    next = ref_js_template_dollar;
+                } else if (c == '<') {
+                    next = ref_js_template_angle;
+                } else {
+                    next = state;
+                }
+                break;
+
+            case ref_js_template_escape:
+                next = (c == '<') ? ref_js_template_angle : ref_js_template;
+                break;
+
+            case ref_js_template_dollar:
+                if (c == '{') {
+                    next = ref_js_raw;
+                } else {
+                    state = ref_js_template;
+                    continue;
+                }
+                break;
+
+            case ref_js_template_angle:
+                if (c == '/') {
+                    next = ref_js_end_slash;
+                } else {
+                    state = ref_js_template;
+                    continue;
+                }
+                break;
+
+            case ref_js_regex:
+                if (c == '/') {
+                    next = ref_js_operand;
+                } else if (c == '\\') {
+                    next = ref_js_regex_escape;
+                } else if (c == '[') {
+                    next = ref_js_regex_class;
+                } else if (c == '<') {
+                    next = ref_js_regex_angle;
+                } else if (c == '\r' || c == '\n') {
+                    next = ref_js_operator_newline;
+                } else {
+                    next = state;
+                }
+                break;
+
+            case ref_js_regex_escape:
+                next = (c == '<') ? ref_js_regex_angle : ref_js_regex;
+                break;
+
+            case ref_js_regex_angle:
+                if (c == '/') {
+                    next = ref_js_end_slash;
+                } else {
+                    state = ref_js_regex;
+                    continue;
+                }
+                break;
+
+            case ref_js_regex_class:
+                if (c == ']') {
+                    next = ref_js_regex;
+                } else if (c == '\\') {
+                    next = ref_js_regex_class_escape;
+                } else if (c == '<') {
+                    next = ref_js_regex_class_angle;
+                } else if (c == '\r' || c == '\n') {
+                    next = ref_js_operator_newline;
+                } else {
+                    next = state;
+                }
+                break;
+
+            case ref_js_regex_class_escape:
+                next = (c == '<') ? ref_js_regex_class_angle
+                                  : ref_js_regex_class;
+                break;
+
+            case ref_js_regex_class_angle:
+                if (c == '/') {
+                    next = ref_js_end_slash;
+                } else {
+                    state = ref_js_regex_class;
+                    continue;
+                }
+                break;
+
+            /* comments that are not dropped keep their delimiters */
+
+            case ref_js_line_comment:
+            case ref_js_line_comment_kept:
+                if (c == '\r' || c == '\n') {
+                    next = ref_js_operator_newline;
+                } else if (c == '<') {
+                    next = ref_js_line_comment_kept_angle;
+                } else {
+                    next = state;
+                    drop = (state == ref_js_line_comment);
+                }
+                break;
+
+            case ref_js_line_comment_kept_angle:
+                if (c == '/') {
+                    next = ref_js_end_slash;
+                } else {
+                    state = ref_js_line_comment_kept;
+                    continue;
+                }
+                break;
+
+            case ref_js_block_comment:
+                if (c == '*') {
+                    next = ref_js_block_comment_star;
+                } else if (c == '\r' || c == '\n') {
+                    next = ref_js_block_comment_newline;
+                } else if (c == '<') {
+                    next = ref_js_block_comment_kept_angle;
+                } else {
+                    next = state;
+                    drop = 1;
+                }
+                break;
+
+            case ref_js_block_comment_newline:
+                if (c == '\r' || c == '\n') {
+                    next = state;
+                    drop = 1;
+                } else {
+                    state = ref_js_block_comment;
+                    continue;
+                }
+                break;
+
+            case ref_js_block_comment_star:
+                if (c == '*') {
+                    next = state;
+                } else if (c == '/') {
+                    next = ref_js_operator;
+                } else {
+                    state = ref_js_block_comment;
+                    continue;
+                }
+                break;
+
+            case ref_js_block_comment_kept:
+            case ref_js_block_comment_kept_star:
+                if (c == '*') {
+                    next = ref_js_block_comment_kept_star;
+                } else if (c == '/'
+                           && state == ref_js_block_comment_kept_star)
+                {
+                    next = ref_js_operator;
+                } else if (c == '<') {
+                    next = ref_js_block_comment_kept_angle;
+                } else {
+                    next = ref_js_block_comment_kept;
+                }
+                break;
+
+            case ref_js_block_comment_kept_angle:
+                if (c == '/') {
+                    next = ref_js_end_slash;
+                } else {
+                    state = ref_js_block_comment_kept;
+                    continue;
+                }
+                break;
+
+            /*
+             * from is where the comment started; a block comment that
+             * spans lines after a space is only emptied, as its newline
+             * may be needed
+             */
+
+            case ref_js_slash:
+                if (c == '*') {
+                    next = ref_js_slash_block;
+                } else if (c == '/') {
+                    next = ref_js_slash_line;
+                } else if (from == ref_js_operand_space
+                           || from == ref_js_operand_newline)
+                {
+                    state = ref_js_operand_slash;
+                    continue;
+                } else {
+                    state = ref_js_regex_slash;
+                    continue;
+                }
+                break;
+
+            case ref_js_slash_block:
+            case ref_js_slash_block_star:
+                if (c == '*') {
+                    next = ref_js_slash_block_star;
+                    drop = (state == ref_js_slash_block_star);
+                } else if (c == '/' && state == ref_js_slash_block_star) {
+                    next = from;
+                    retract = 1;
+                } else if (c == '<') {
+                    next = ref_js_block_comment_kept_angle;
+                } else if ((c == '\r' || c == '\n')
+                           && strip_ref_js_spaced(from))
+                {
+                    next = ref_js_block_comment_newline;
+                } else {
+                    next = ref_js_slash_block;
+                    drop = 1;
+                }
+                break;
+
+            case ref_js_slash_line:
+                if (c == '<') {
+                    next = ref_js_line_comment_kept_angle;
+                } else if (c != '\r' && c != '\n') {
+                    next = state;
+                    drop = 1;
+                } else if (strip_ref_js_spaced(from)) {
+                    next = ref_js_operator_newline;
+                    cut = 2;
+                } else {
+                    next = from;
+                    retract = 1;
+                }
+                break;
+
+            default:
+                return;
+        }
+
+        if (retract && r->mark != STRIP_REF_NONE) {
+            r->n = r->mark;
+            r->mark = STRIP_REF_NONE;
+            r->p++;
+            state = next;
+            continue;
+        }
+
+        if (cut) {
+            strip_ref_cut(r, cut);
+        }
+
+        if ((c == ' ' || c == '\t') && next != state
+            && strip_ref_js_spaced(next))
+        {
+            mark = 1;
+        }
+
+        if (mark) {
+            r->mark = r->n;
+        }
+
+        if (next == ref_js_slash) {
+            from = state;
+        }
+
+        if (drop) {
+            r->p++;
+        } else {
+            strip_ref_keep(r);
+        }
+
+        if (next == ref_js_end_slash) {
+            strip_ref_raw(r, "script", 0);
+            return;
+        }
+
+        if (next == ref_js_raw) {
+            strip_ref_raw(r, "script", STRIP_REF_BODY);
+            return;
+        }
+
+        state = next;
+    }
+}
+
+/* what follows a byte of a token, a selector, property or value */
+
+static unsigned
+strip_ref_css_token(u_char c)
+{
+    switch(c) {
+        case '/':
+            return ref_css_slash;
+        case '<':
+            return ref_css_angle;
+        case '"':
+            return ref_css_double_quote;
+        case '\'':
+            return ref_css_single_quote;
+    }
+
+    if (strip_ref_in(c, STRIP_REF_SPACE)) {
+        return ref_css_space;
+    }
+
+    return strip_ref_in(c, "{};:,>(") ? ref_css : ref_css_token;
+}
+
+/* a style sheet, with its marks and cuts as in a script */
+
+static void
+strip_ref_css(strip_ref_t *r)
+{
+    u_char     c;
+    unsigned   state, next, from, drop, mark, cut, retract;
+
+    state = ref_css;
+    from = ref_css;
+
+    while (!strip_ref_end(r)) {
+        c = *r->p;
+
+        drop = 0;
+        mark = 0;
+        cut = 0;
+        retract = 0;
+
+        switch(state) {
+
+            case ref_css:
+            case ref_css_space:
+                if (strip_ref_in(c, STRIP_REF_SPACE)) {
+                    next = state;
+                    drop = 1;
+                } else if (c == '/') {
+                    next = ref_css_slash_dropped;
+                    mark = 1;
+                } else if (state == ref_css_space
+                           && strip_ref_in(c, "{};,>"))
+                {
+                    next = ref_css;
+                    cut = 1;
+                } else {
+                    next = strip_ref_css_token(c);
+                }
+                break;
+
+            case ref_css_token:
+                next = strip_ref_css_token(c);
+                break;
+
+            case ref_css_slash:
+            case ref_css_slash_dropped:
+                if (c == '*') {
+                    next = (state == ref_css_slash) ? ref_css_comment
+                                                    : ref_css_slash_block;
+                } else {
+                    next = strip_ref_css_token(c);
+                }
+                break;
+
+            case ref_css_angle:
+                if (c == '/') {
+                    next = ref_css_end_slash;
+                } else {
+                    next = strip_ref_css_token(c);
+                }
+                break;
+
+            case ref_css_comment:
+            case ref_css_comment_star:
+                if (c == '*') {
+                    next = ref_css_comment_star;
+                } else if (c == '/' && state == ref_css_comment_star) {
+                    next = ref_css_token;
+                } else if (c == '<') {
+                    next = ref_css_raw_angle;
+                } else {
+                    next = ref_css_comment;
+                    drop = 1;
+                }
+                break;
+
+            case ref_css_double_quote:
+            case ref_css_single_quote:
+                if (c == (state == ref_css_double_quote ? '"' : '\'')) {
+                    next = ref_css_token;
+                } else if (c == '\\') {
+                    next = state + 1;
+                } else if (c == '<') {
+                    next = state + 2;
+                } else {
+                    next = state;
+                }
+                break;
+
+            case ref_css_double_quote_escape:
+            case ref_css_single_quote_escape:
+                next = (c == '<') ? state + 1 : state - 1;
+                break;
+
+            /* a '<' in a string is taken as the end of the style sheet */
+
+            case ref_css_double_quote_angle:
+            case ref_css_single_quote_angle:
+                if (c == '/') {
+                    next = ref_css_end_slash;
+                } else if (c == '<') {
+                    next = ref_css_raw_angle;
+                } else {
+                    next = ref_css_raw;
+                }
+                break;
+
+            case ref_css_slash_block:
+            case ref_css_slash_block_star:
+                if (c == '*') {
+                    next = ref_css_slash_block_star;
+                    drop = (state == ref_css_slash_block_star);
+                } else if (c == '/' && state == ref_css_slash_block_star) {
+                    next = from;
+                    retract = 1;
+                } else if (c == '<') {
+                    next = ref_css_raw_angle;
+                } else {
+                    next = ref_css_slash_block;
+                    drop = 1;
+                }
+                break;
+
+            default:
+                return;
+        }
+
+        if (retract && r->mark != STRIP_REF_NONE) {
+            r->n = r->mark;
+            r->mark = STRIP_REF_NONE;
+            r->p++;
+            state = next;
+            continue;
+        }
+
+        if (cut) {
+            strip_ref_cut(r, cut);
+        }
+
+        if (strip_ref_in(c, STRIP_REF_SPACE) && next != state
+            && next == ref_css_space)
+        {
+            mark = 1;
+        }
+
+        if (mark) {
+            r->mark = r->n;
+        }
+
+        if (next == ref_css_slash_dropped) {
+            from = state;
+        }
+
+        if (drop) {
+            r->p++;
+        } else {
+            strip_ref_keep(r);
+        }
+
+        switch(next) {
+            case ref_css_end_slash:
+                strip_ref_raw(r, "style", 0);
+                return;
+            case ref_css_raw_angle:
+                strip_ref_raw(r, "style", STRIP_REF_ANGLE);
+                return;
+            case ref_css_raw:
+                strip_ref_raw(r, "style", STRIP_REF_BODY);
+                return;
+        }
+
+        state = next;
+    }
+}
+
+/*
+ * Copies a body up to "</" and its name, any case, then whitespace, '/'
+ * or '>'; k is STRIP_REF_BODY, STRIP_REF_ANGLE after '<', or the number
+ * of bytes of the name read after "</".
+ */
+
+static void
+strip_ref_raw(strip_ref_t *r, const char *name, int k)
+{
+    u_char  c;
+    int     len;
+
+    len = (int) strlen(name);
+
+    while (!strip_ref_end(r)) {
+        c = *r->p;
+        strip_ref_keep(r);
+
+        if (k == len) {
+            if (c == '>') {
+                return;
+            }
+
+            if (strip_ref_in(c, " \t\r\n/")) {
+                strip_ref_until(r, '>');
+                return;
+            }
+        }
+
+        if (c == '<') {
+            k = STRIP_REF_ANGLE;
+        } else if (k == STRIP_REF_ANGLE && c == '/') {
+            k = 0;
+        } else if (k >= 0 && k < len && tolower(c) == name[k]) {
+            k++;
+        } else {
+            k = STRIP_REF_BODY;
+        }
+    }
+}
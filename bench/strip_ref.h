@@ -0,0 +1,19 @@
+/*
+ * Copyright 2008 Evan Miller
+ */
+
+#ifndef _STRIP_REF_H_INCLUDED_
+#define _STRIP_REF_H_INCLUDED_
+
+#include <sys/types.h>
+
+/*
+ * Strips len bytes of HTML at in into out and returns the output size,
+ * as strip_compact() does at level 1 with the input in one buffer and pre
+ * and textarea preserved.  It reads the rules of strip_core.c written
+ * out by hand, a byte at a time and with no tables, to check the parser
+ * against.
+ */
+size_t strip_ref(u_char *out, const u_char *in, size_t len);
+
+#endif /* _STRIP_REF_H_INCLUDED_ */
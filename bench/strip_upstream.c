@@ -0,0 +1,558 @@
+/*
+ * Copyright 2008 Evan Miller
+ */
+
+/*
+ * Stand-in upstream for strip_macro.sh, no network required:
+ *
+ *     cc -O2 -pthread -o strip_upstream bench/strip_upstream.c -lz
+ *     ./strip_upstream [-p port] [-c chunk]
+ *     ./strip_upstream -g size > page.html
+ *
+ * Serves GET /size, as /1k, /100k or /10m, on 127.0.0.1 with an HTML page
+ * of exactly that many bytes, GET /gz/size with the same page gzipped,
+ * and GET /blank/size with as many newlines and tabs, which strip to
+ * nothing.  The body is written chunk bytes at a time (default 4096, 0
+ * for all at once) with TCP_NODELAY, so that nginx reads it in pieces
+ * of about that size; "?chunk=n" overrides it for one request.  Pages are
+ * made once per size and kept.  With -g the page is written to stdout
+ * instead, for the static files.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#define STRIP_UPSTREAM_MAX_SIZE  (64 * 1024 * 1024)
+
+typedef struct strip_page_s  strip_page_t;
+
+struct strip_page_s {
+    strip_page_t   *next;
+    size_t          size;
+    unsigned        gzip;
+    unsigned        blank;
+    u_char         *data;
+    size_t          len;
+};
+
+static strip_page_t     *pages;
+static pthread_mutex_t   pages_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t            chunk = 4096;
+
+static const char *words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+    "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore"
+};
+
+static void
+strip_page_append(u_char **p, u_char *end, const char *s)
+{
+    size_t  len;
+
+    len = strlen(s);
+
+    if ((size_t) (end - *p) < len) {
+        len = end - *p;
+    }
+
+    memcpy(*p, s, len);
+    *p += len;
+}
+
+/*
+ * A page shaped like generated markup: indented nested blocks of links
+ * and text, with a comment, an inline script and a style now and then.
+ * The same size always gives the same page.
+ */
+
+static void
+strip_page_generate(u_char *buf, size_t size)
+{
+    u_char          *p, *end;
+    unsigned         i, n, depth;
+    unsigned long    seed;
+
+    static const char  head[] =
+        "<!DOCTYPE html>\n<html>\n  <head>\n"
+        "    <title>strip benchmark</title>\n  </head>\n  <body>\n";
+    static const char  foot[] = "  </body>\n</html>\n";
+
+    if (size < sizeof(head) + sizeof(foot)) {
+        memset(buf, ' ', size);
+        return;
+    }
+
+    p = buf;
+    end = buf + size - (sizeof(foot) - 1);
+
+    strip_page_append(&p, end, head);
+
+    seed = 1;
+
+    for (n = 0; end - p > 512; n++) {
+
+        if (n % 16 == 0) {
+            strip_page_append(&p, end,
+                "    <!-- block -->\n"
+                "    <style type=\"text/css\">\n"
+                "      .item  { margin : 0 auto ;  color: #333 }\n"
+                "    </style>\n"
+                "    <script type=\"text/javascript\">\n"
+                "      var  count = 0 ;\n"
+                "      function  tick ( )  {  count += 1 ;  }\n"
+                "    </script>\n");
+        }
+
+        strip_page_append(&p, end, "    <div  class=\"item\"  id=\"i\">\n");
+
+        for (depth = 0; depth < 3; depth++) {
+            for (i = 0; i < 6 + depth * 2; i++) {
+                strip_page_append(&p, end, " ");
+            }
+
+            strip_page_append(&p, end, "<p>\n");
+
+            for (i = 0; i < 8 + depth * 2; i++) {
+                strip_page_append(&p, end, " ");
+            }
+
+            strip_page_append(&p, end, "<a href=\"/x\" >");
+
+            for (i = 0; i < 12; i++) {
+                seed = seed * 1103515245 + 12345;
+                strip_page_append(&p, end, words[(seed >> 16) % 15]);
+                strip_page_append(&p, end, (i % 5 == 4) ? "\n\t" : " ");
+            }
+
+            strip_page_append(&p, end, "</a >\n");
+        }
+
+        strip_page_append(&p, end, "      </p>\n    </div>\n\n");
+    }
+
+    /* the rest of the size in plain text */
+
+    for (i = 0; p < end; i++) {
+        strip_page_append(&p, end, words[i % 15]);
+        strip_page_append(&p, end, " ");
+    }
+
+    memcpy(end, foot, sizeof(foot) - 1);
+}
+
+/* lines of tabs, whitespace that is dropped wherever it is in text */
+
+static void
+strip_page_blank(u_char *buf, size_t size)
+{
+    size_t  i;
+
+    for (i = 0; i < size; i++) {
+        buf[i] = (i % 8 == 7) ? '\n' : '\t';
+    }
+}
+
+static u_char *
+strip_page_gzip(u_char *data, size_t len, size_t *out)
+{
+    u_char    *buf;
+    z_stream   z;
+
+    memset(&z, 0, sizeof(z_stream));
+
+    if (deflateInit2(&z, 6, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+
+    *out = deflateBound(&z, len);
+
+    buf = malloc(*out);
+    if (buf == NULL) {
+        deflateEnd(&z);
+        return NULL;
+    }
+
+    z.next_in = data;
+    z.avail_in = len;
+    z.next_out = buf;
+    z.avail_out = *out;
+
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+        deflateEnd(&z);
+        free(buf);
+        return NULL;
+    }
+
+    *out = z.total_out;
+    deflateEnd(&z);
+
+    return buf;
+}
+
+static strip_page_t *
+strip_page_get(size_t size, unsigned gzip, unsigned blank)
+{
+    u_char        *data;
+    strip_page_t  *page;
+
+    pthread_mutex_lock(&pages_mutex);
+
+    for (page = pages; page; page = page->next) {
+        if (page->size == size && page->gzip == gzip
+            && page->blank == blank)
+        {
+            goto done;
+        }
+    }
+
+    page = calloc(1, sizeof(strip_page_t));
+    data = malloc(size ? size : 1);
+    if (page == NULL || data == NULL) {
+        free(page);
+        free(data);
+        page = NULL;
+        goto done;
+    }
+
+    if (blank) {
+        strip_page_blank(data, size);
+
+    } else {
+        strip_page_generate(data, size);
+    }
+
+    page->size = size;
+    page->gzip = gzip;
+    page->blank = blank;
+    page->data = data;
+    page->len = size;
+
+    if (gzip) {
+        page->data = strip_page_gzip(data, size, &page->len);
+        free(data);
+
+        if (page->data == NULL) {
+            free(page);
+            page = NULL;
+            goto done;
+        }
+    }
+
+    page->next = pages;
+    pages = page;
+
+done:
+
+    pthread_mutex_unlock(&pages_mutex);
+
+    return page;
+}
+
+/* 1k is 1024 bytes, 1m 1048576; 0 on a size that makes no sense */
+
+static size_t
+strip_parse_size(const char *s, char **end)
+{
+    size_t  size;
+
+    size = strtoul(s, end, 10);
+
+    switch (**end) {
+    case 'k':
+    case 'K':
+        size *= 1024;
+        (*end)++;
+        break;
+    case 'm':
+    case 'M':
+        size *= 1024 * 1024;
+        (*end)++;
+        break;
+    default:
+        break;
+    }
+
+    return (size > STRIP_UPSTREAM_MAX_SIZE) ? 0 : size;
+}
+
+static int
+strip_write(int fd, u_char *p, size_t len)
+{
+    ssize_t  n;
+
+    while (len) {
+        n = write(fd, p, len);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int
+strip_respond(int fd, char *request, int *keepalive)
+{
+    int            len;
+    char          *uri, *end, header[256], *c;
+    size_t         size, n, piece;
+    unsigned       gzip, blank;
+    strip_page_t  *page;
+
+    /* keep-alive is the default from HTTP/1.1 on */
+
+    *keepalive = (strstr(request, " HTTP/1.0\r\n") == NULL);
+
+    for (c = strchr(request, '\n'); c; c = strchr(c + 1, '\n')) {
+        if (strncasecmp(c + 1, "connection:", sizeof("connection:") - 1)
+            == 0)
+        {
+            *keepalive = (strncasecmp(c + 1 + sizeof("connection:") - 1,
+                                      " keep-alive", 11) == 0);
+        }
+    }
+
+    if (strncmp(request, "GET /", 5) != 0) {
+        goto not_found;
+    }
+
+    uri = request + 5;
+    gzip = 0;
+    blank = 0;
+
+    if (strncmp(uri, "gz/", 3) == 0) {
+        uri += 3;
+        gzip = 1;
+
+    } else if (strncmp(uri, "blank/", 6) == 0) {
+        uri += 6;
+        blank = 1;
+    }
+
+    size = strip_parse_size(uri, &end);
+    piece = chunk;
+
+    if (size == 0 || end == uri) {
+        goto not_found;
+    }
+
+    if (strncmp(end, "?chunk=", 7) == 0) {
+        piece = strtoul(end + 7, &end, 10);
+    }
+
+    if (*end != ' ') {
+        goto not_found;
+    }
+
+    page = strip_page_get(size, gzip, blank);
+    if (page == NULL) {
+        goto not_found;
+    }
+
+    len = snprintf(header, sizeof(header),
+                   "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: text/html\r\n"
+                   "Content-Length: %zu\r\n"
+                   "%s"
+                   "Connection: %s\r\n\r\n",
+                   page->len,
+                   gzip ? "Content-Encoding: gzip\r\n" : "",
+                   *keepalive ? "keep-alive" : "close");
+
+    if (strip_write(fd, (u_char *) header, len) == -1) {
+        return -1;
+    }
+
+    if (piece == 0) {
+        piece = page->len;
+    }
+
+    for (n = 0; n < page->len; n += piece) {
+        if (strip_write(fd, page->data + n,
+                        (page->len - n < piece) ? page->len - n : piece)
+            == -1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+
+not_found:
+
+    *keepalive = 0;
+
+    len = snprintf(header, sizeof(header),
+                   "HTTP/1.1 404 Not Found\r\n"
+                   "Content-Length: 0\r\n"
+                   "Connection: close\r\n\r\n");
+
+    return strip_write(fd, (u_char *) header, len);
+}
+
+static void *
+strip_connection(void *data)
+{
+    int       fd, keepalive;
+    char      buf[8192];
+    size_t    len;
+    ssize_t   n;
+
+    fd = (int) (intptr_t) data;
+
+    for (len = 0; /* void */ ; /* void */ ) {
+
+        n = read(fd, buf + len, sizeof(buf) - 1 - len);
+
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        len += n;
+        buf[len] = '\0';
+
+        if (strstr(buf, "\r\n\r\n") == NULL) {
+            if (len == sizeof(buf) - 1) {
+                break;
+            }
+            continue;
+        }
+
+        /* requests have no body, and the next one is not sent before */
+
+        if (strip_respond(fd, buf, &keepalive) == -1 || !keepalive) {
+            break;
+        }
+
+        len = 0;
+    }
+
+    close(fd);
+
+    return NULL;
+}
+
+static void
+strip_usage(void)
+{
+    fprintf(stderr, "usage: strip_upstream [-p port] [-c chunk]\n"
+                    "       strip_upstream -g size\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    int                 c, s, fd, one, port;
+    char               *end;
+    size_t              size;
+    u_char             *page;
+    pthread_t           tid;
+    pthread_attr_t      attr;
+    struct sockaddr_in  sin;
+
+    port = 8081;
+
+    while ((c = getopt(argc, argv, "c:g:p:")) != -1) {
+        switch (c) {
+        case 'c':
+            chunk = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            size = strip_parse_size(optarg, &end);
+            if (size == 0 || *end != '\0') {
+                strip_usage();
+            }
+
+            page = malloc(size);
+            if (page == NULL) {
+                return 1;
+            }
+
+            strip_page_generate(page, size);
+
+            return (fwrite(page, 1, size, stdout) == size) ? 0 : 1;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        default:
+            strip_usage();
+        }
+    }
+
+    if (optind != argc || port <= 0 || port > 65535) {
+        strip_usage();
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == -1) {
+        perror("strip_upstream: socket");
+        return 1;
+    }
+
+    one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(int));
+
+    memset(&sin, 0, sizeof(struct sockaddr_in));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(s, (struct sockaddr *) &sin, sizeof(struct sockaddr_in)) == -1
+        || listen(s, 1024) == -1)
+    {
+        perror("strip_upstream: bind");
+        return 1;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for ( ;; ) {
+        fd = accept(s, NULL, NULL);
+
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("strip_upstream: accept");
+            return 1;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(int));
+
+        if (pthread_create(&tid, &attr, strip_connection,
+                           (void *) (intptr_t) fd)
+            != 0)
+        {
+            close(fd);
+        }
+    }
+}
@@ -4,83 +4,337 @@
 
 /* mod_strip - Remove unnecessary whitespace in HTML */
 
-/* TODO - rewrite with Ragel */
+/* The parser itself lives in strip_core.c, this is the nginx glue */
 
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#include <zlib.h>
+
+#include "strip_core.h"
+
+/* strip_stats_zone: counters of one server and location, in shared memory */
+typedef struct {
+    ngx_queue_t         queue;
+    ngx_atomic_t        requests;
+    ngx_atomic_t        bytes_in;
+    ngx_atomic_t        bytes_out;
+    ngx_atomic_t        aborts;
+    ngx_atomic_t        skipped_status;
+    ngx_atomic_t        skipped_type;
+    ngx_atomic_t        skipped_encoding;
+    ngx_atomic_t        skipped_ratio;
+    ngx_atomic_t        cpu;            /* nanoseconds */
+
+    /* strip_min_ratio: bytes since the last decision, and the decision */
+    ngx_atomic_t        window_in;
+    ngx_atomic_t        window_out;
+    ngx_atomic_t        bypass;
+    ngx_atomic_t        sampled;
+    u_short             server_len;
+    u_short             location_len;
+    u_char              data[1];        /* server, then location */
+} ngx_http_strip_stats_node_t;
+
 typedef struct {
-    ngx_flag_t enable;
+    ngx_flag_t       enable;
+    ngx_int_t        level;
+    ngx_hash_t       types;
+    ngx_array_t     *types_keys;
+    ngx_hash_t       xml_types;
+    ngx_array_t     *xml_types_keys;
+    ngx_hash_t       json_types;
+    ngx_array_t     *json_types_keys;
+    ngx_shm_zone_t  *cache_zone;
+    size_t           cache_max_size;
+    ngx_flag_t       static_enable;
+    ngx_str_t        static_suffix;
+    ngx_flag_t       slices;
+    size_t           slice_min;
+#if (NGX_THREADS)
+    ngx_thread_pool_t  *thread_pool;
+    size_t              thread_threshold;
+#endif
+    ngx_flag_t       gzip;
+    ngx_int_t        gzip_comp_level;
+    ngx_uint_t       status_format;
+    ngx_uint_t       min_ratio;     /* in hundredths */
+    ngx_int_t        sample;
+    size_t           buffer_size;
+    size_t           coalesce;
+    ngx_flag_t       upstream_cache;
+    ngx_http_strip_stats_node_t  *stats;
 } ngx_http_strip_conf_t;
 
 typedef struct {
-    unsigned char state;
+    ngx_http_strip_conf_t  *conf;
+    ngx_str_t               server;
+    ngx_str_t               location;
+} ngx_http_strip_stats_loc_t;
+
+typedef struct {
+    ngx_shm_zone_t  *stats_zone;
+    ngx_array_t      stats_locations;   /* of ngx_http_strip_stats_loc_t */
+    ngx_array_t     *preserve_tags;     /* of char * */
+    ngx_array_t     *keep_comments;     /* of char * */
+    uint32_t         signature;         /* of both lists, for ETags */
+    strip_tables_t  *tables;            /* built for both lists, or NULL */
+    ngx_http_variable_t  *time_var;     /* $strip_time_us */
+} ngx_http_strip_main_conf_t;
+
+typedef struct {
+    strip_parser_t   parser;
+
+    ngx_http_strip_stats_node_t  *stats;
+
+    /* $strip_* variables */
+    off_t              bytes_in;
+    off_t              bytes_out;
+    ngx_atomic_uint_t  cpu;         /* nanoseconds */
+    unsigned           timed:1;     /* cpu is measured */
+
+    /* strip_cache: key of a static file and its stripped body */
+    ngx_str_t        cache_path;
+    ngx_file_uniq_t  cache_uniq;
+    time_t           cache_mtime;
+    off_t            cache_size;
+    ngx_buf_t       *cache_buf;
+
+    unsigned         cache_hit:1;
+    unsigned         cache_store:1;
+
+    /* strip_static: a pre-stripped file is being sent as is */
+    unsigned         static_file:1;
+
+    /* strip_upstream_cache: stripped as read, before the cache has it */
+    unsigned         upstream:1;
+    ngx_int_t      (*input_filter_init)(void *data);
+    ngx_event_pipe_input_filter_pt  pipe_input_filter;
+
+    /* strip_slices: bufs pointing into the input, not sent yet */
+    unsigned         slices:1;
+    ngx_chain_t     *free;
+    ngx_chain_t     *busy;
+
+    unsigned         aborted:1;
+
+    /* strip_coalesce: output copied into full bufs, from free and busy */
+    unsigned         coalesce:1;
+    ngx_chain_t     *coalesce_cl;   /* buf being filled */
+
+    /* strip_buffer_size: the whole body, the header waits for it */
+    unsigned         collect:1;
+    ngx_buf_t       *collected;
+
+    /* strip_gzip: inflate, strip, deflate */
+    unsigned         gzip:1;
+    unsigned         gzip_end:1;
+    z_stream         zin;
+    z_stream         zout;
+    u_char          *zbuf;
+    ngx_chain_t     *zout_cl;       /* buf being filled by deflate() */
+
+#if (NGX_THREADS)
+    /* strip_thread_pool: input waiting for a buffer being stripped */
+    ngx_chain_t        *in;
+    ngx_thread_task_t  *thread_task;
+    unsigned            thread_busy:1;
+    unsigned            thread_done:1;
+#endif
 } ngx_http_strip_ctx_t;
 
-typedef enum { 
-    strip_state_text = 0,
-    strip_state_text_whitespace,
-    strip_state_tag,
-    strip_state_tag_name,
-    strip_state_tag_whitespace,
-    strip_state_tag_attribute_name,
-    strip_state_tag_attribute_equals,
-    strip_state_tag_attribute_value,
-    strip_state_tag_attribute_value_double_quote,
-    strip_state_tag_attribute_value_single_quote,
-    strip_state_end_tag,
-    strip_state_end_tag_name,
-    strip_state_comment,
-    strip_state_comment_dash,
-    strip_state_comment_dash_dash,
-    strip_state_tag_bang,
-    strip_state_tag_bang_dash,
-    strip_state_tag_bang_stuff,
-    strip_state_tag_bang_bracket,
-    strip_state_tag_bang_bracket_c,
-    strip_state_tag_bang_bracket_cd,
-    strip_state_tag_bang_bracket_cda,
-    strip_state_tag_bang_bracket_cdat,
-    strip_state_tag_bang_bracket_cdata,
-    strip_state_cdata,
-    strip_state_cdata_bracket,
-    strip_state_cdata_bracket_bracket,
-    strip_state_tag_name_p,
-    strip_state_tag_name_pr,
-    strip_state_tag_name_pre,
-    strip_state_preformatted,
-    strip_state_preformatted_angle,
-    strip_state_preformatted_angle_slash,
-    strip_state_preformatted_angle_slash_p,
-    strip_state_preformatted_angle_slash_pr,
-    strip_state_preformatted_angle_slash_pre,
-    strip_state_tag_name_t,
-    strip_state_tag_name_te,
-    strip_state_tag_name_tex,
-    strip_state_tag_name_text,
-    strip_state_tag_name_texta,
-    strip_state_tag_name_textar,
-    strip_state_tag_name_textare,
-    strip_state_tag_name_textarea,
-    strip_state_textarea,
-    strip_state_textarea_angle,
-    strip_state_textarea_angle_slash,
-    strip_state_textarea_angle_slash_t,
-    strip_state_textarea_angle_slash_te,
-    strip_state_textarea_angle_slash_tex,
-    strip_state_textarea_angle_slash_text,
-    strip_state_textarea_angle_slash_texta,
-    strip_state_textarea_angle_slash_textar,
-    strip_state_textarea_angle_slash_textare,
-    strip_state_textarea_angle_slash_textarea,
-    strip_state_abort
-} ngx_http_strip_state_e;
+#if (NGX_THREADS)
+
+typedef struct {
+    strip_parser_t     *parser;
+    u_char             *pos;
+    u_char             *last;
+    ngx_atomic_uint_t   cpu;
+    ngx_uint_t          timed;
+} ngx_http_strip_thread_ctx_t;
+
+#endif
+
+/*
+ * r->buffered while input waits behind a thread, or for the rest of it;
+ * 0x80, as stock filters use the low bits (0x08 is image_filter's) and
+ * one clearing another's bit would end a response while data is held
+ */
+#define NGX_HTTP_STRIP_BUFFERED  0x80
+
+/* kept ranges looked at in one go by strip_slices */
+#define NGX_HTTP_STRIP_RANGES  64
+
+/* strip_gzip: size of the inflated chunks, and of the deflated bufs */
+#define NGX_HTTP_STRIP_GZIP_BUF  32768
+
+typedef struct {
+    ngx_rbtree_node_t   node;
+    ngx_queue_t         queue;
+    ngx_file_uniq_t     uniq;
+    time_t              mtime;
+    off_t               size;
+    size_t              len;
+    uint32_t            signature;   /* of the lists it was stripped with */
+    u_short             path_len;
+    u_char              level;
+    u_char              syntax;
+    u_char              data[1];     /* path, then the stripped body */
+} ngx_http_strip_cache_node_t;
+
+typedef struct {
+    ngx_rbtree_t        rbtree;
+    ngx_rbtree_node_t   sentinel;
+    ngx_queue_t         queue;
+} ngx_http_strip_cache_shctx_t;
+
+typedef struct {
+    ngx_http_strip_cache_shctx_t  *sh;
+    ngx_slab_pool_t               *shpool;
+} ngx_http_strip_cache_t;
+
+typedef struct {
+    ngx_queue_t                   queue;
+} ngx_http_strip_stats_shctx_t;
+
+typedef struct {
+    ngx_http_strip_stats_shctx_t  *sh;
+    ngx_slab_pool_t               *shpool;
+    ngx_http_strip_main_conf_t    *smcf;
+} ngx_http_strip_stats_t;
+
+#define NGX_HTTP_STRIP_STATUS_JSON        1
+#define NGX_HTTP_STRIP_STATUS_PROMETHEUS  2
+
+/* bytes stripped in a location between two strip_min_ratio decisions */
+#define NGX_HTTP_STRIP_WINDOW  (256 * 1024)
+
+typedef struct {
+    char                *name;
+    char                *help;
+    char                *reason;
+    size_t               offset;
+} ngx_http_strip_metric_t;
 
+static void *ngx_http_strip_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_strip_create_conf(ngx_conf_t *cf);
 static char *ngx_http_strip_merge_conf(ngx_conf_t *cf, void *parent, void *child);
 static ngx_int_t ngx_http_strip_filter_init(ngx_conf_t *cf);
-static void ngx_http_strip_process_buffer(ngx_buf_t *b, ngx_http_strip_ctx_t *ctx);
+#if (STRIP_PROFILE)
+static ngx_int_t ngx_http_strip_init_process(ngx_cycle_t *cycle);
+static void ngx_http_strip_exit_process(ngx_cycle_t *cycle);
+static void ngx_http_strip_profile_handler(ngx_event_t *ev);
+static void ngx_http_strip_profile_print(void *data, char *line);
+#endif
+static ngx_int_t ngx_http_strip_static_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_strip_body_slices(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, ngx_chain_t *in);
+static void ngx_http_strip_check_abort(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx);
+static ngx_chain_t *ngx_http_strip_link(ngx_http_request_t *r, ngx_buf_t *b);
+static ngx_int_t ngx_http_strip_body_collect(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_strip_body_coalesce(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_strip_coalesce(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, u_char *p, size_t len, ngx_buf_t *flags,
+    ngx_chain_t ***ll);
+static ngx_int_t ngx_http_strip_body_gzip(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_strip_gzip_init(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx);
+static ngx_int_t ngx_http_strip_deflate(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, u_char *p, size_t len, ngx_buf_t *flags,
+    ngx_chain_t ***ll);
+static void ngx_http_strip_gzip_cleanup(void *data);
+static char *ngx_http_strip_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+#if (NGX_THREADS)
+static ngx_uint_t ngx_http_strip_thread_wanted(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_strip_body_threads(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_strip_thread_post(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, ngx_buf_t *b);
+static void ngx_http_strip_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_strip_thread_event_handler(ngx_event_t *ev);
+#endif
+static char *ngx_http_strip_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_strip_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_strip_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_strip_cache_lookup(ngx_http_request_t *r,
+    ngx_http_strip_conf_t *conf, ngx_http_strip_ctx_t *ctx);
+static ngx_int_t ngx_http_strip_cache_send(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, ngx_chain_t *in);
+static ngx_uint_t ngx_http_strip_test_json(ngx_http_request_t *r,
+    ngx_hash_t *types);
+static ngx_int_t ngx_http_strip_etag(ngx_http_request_t *r,
+    ngx_http_strip_conf_t *conf);
+static ngx_uint_t ngx_http_strip_not_modified(ngx_http_request_t *r);
+static ngx_uint_t ngx_http_strip_etag_match(ngx_http_request_t *r,
+    ngx_str_t *list);
+#if (NGX_HTTP_CACHE)
+static ngx_int_t ngx_http_strip_upstream_init(void *data);
+static ngx_uint_t ngx_http_strip_upstream_stripped(ngx_http_request_t *r,
+    ngx_uint_t level, ngx_uint_t syntax);
+static ngx_int_t ngx_http_strip_upstream_mark(ngx_http_request_t *r,
+    ngx_uint_t level, ngx_uint_t syntax);
+static u_char *ngx_http_strip_upstream_value(ngx_http_request_t *r,
+    ngx_uint_t level, ngx_uint_t syntax, u_char *p);
+static ngx_int_t ngx_http_strip_upstream_filter(ngx_event_pipe_t *p,
+    ngx_buf_t *buf);
+#endif
+static ngx_int_t ngx_http_strip_body_upstream(ngx_http_request_t *r,
+    ngx_chain_t *in);
+static void ngx_http_strip_cache_add(ngx_http_request_t *r,
+    ngx_http_strip_ctx_t *ctx, ngx_chain_t *in, ngx_uint_t last);
+static void ngx_http_strip_cache_insert(ngx_http_request_t *r,
+    ngx_http_strip_conf_t *conf, ngx_http_strip_ctx_t *ctx);
+static ngx_http_strip_cache_node_t *ngx_http_strip_cache_find(
+    ngx_http_strip_cache_t *cache, uint32_t hash, ngx_http_strip_ctx_t *ctx,
+    uint32_t signature);
+static char *ngx_http_strip_stats_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_strip_stats_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void ngx_http_strip_count(ngx_http_strip_ctx_t *ctx, size_t in,
+    size_t out, ngx_atomic_uint_t cpu);
+static ngx_atomic_uint_t ngx_http_strip_cpu_time(ngx_uint_t timed);
+static char *ngx_http_strip_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_strip_status_handler(ngx_http_request_t *r);
+static ngx_uint_t ngx_http_strip_bypass(ngx_http_strip_conf_t *conf);
+static char *ngx_http_strip_min_ratio(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_strip_preserve_tags(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_strip_keep_comments(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_strip_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_http_strip_bytes_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_strip_ratio_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_strip_time_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_int_t ngx_http_strip_aborted_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+
+static ngx_conf_num_bounds_t  ngx_http_strip_comp_level_bounds = {
+    ngx_conf_check_num_bounds, 1, 9
+};
+
+static ngx_conf_num_bounds_t  ngx_http_strip_sample_bounds = {
+    ngx_conf_check_num_bounds, 1, -1
+};
+
+static ngx_conf_num_bounds_t  ngx_http_strip_level_bounds = {
+    ngx_conf_check_num_bounds, 1, 3
+};
 
 static ngx_command_t ngx_http_strip_filter_commands[] = {
     { ngx_string("strip"),
@@ -90,14 +344,175 @@ static ngx_command_t ngx_http_strip_filter_commands[] = {
       offsetof(ngx_http_strip_conf_t, enable),
       NULL },
 
+    { ngx_string("strip_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, level),
+      &ngx_http_strip_level_bounds },
+
+    { ngx_string("strip_types"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_types_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, types_keys),
+      &ngx_http_html_default_types[0] },
+
+    { ngx_string("strip_xml_types"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_types_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, xml_types_keys),
+      NULL },
+
+    { ngx_string("strip_json_types"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_types_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, json_types_keys),
+      NULL },
+
+    { ngx_string("strip_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_strip_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("strip_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_strip_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("strip_cache_max_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, cache_max_size),
+      NULL },
+
+    { ngx_string("strip_static"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, static_enable),
+      NULL },
+
+    { ngx_string("strip_static_suffix"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, static_suffix),
+      NULL },
+
+    { ngx_string("strip_slices"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, slices),
+      NULL },
+
+    { ngx_string("strip_slice_min"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, slice_min),
+      NULL },
+
+    { ngx_string("strip_gzip"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, gzip),
+      NULL },
+
+    { ngx_string("strip_gzip_comp_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, gzip_comp_level),
+      &ngx_http_strip_comp_level_bounds },
+
+    { ngx_string("strip_buffer_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, buffer_size),
+      NULL },
+
+    { ngx_string("strip_coalesce"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, coalesce),
+      NULL },
+
+    { ngx_string("strip_upstream_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, upstream_cache),
+      NULL },
+
+    { ngx_string("strip_thread_pool"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_strip_thread_pool,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("strip_min_ratio"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_strip_min_ratio,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("strip_sample"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_strip_conf_t, sample),
+      &ngx_http_strip_sample_bounds },
+
+    { ngx_string("strip_stats_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_strip_stats_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("strip_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_strip_status,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("strip_preserve_tags"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_strip_preserve_tags,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("strip_keep_comments"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_strip_keep_comments,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
     ngx_null_command
 };
 
 static ngx_http_module_t ngx_http_strip_filter_module_ctx = {
-    NULL,                         /* preconfiguration */
+    ngx_http_strip_add_variables, /* preconfiguration */
     ngx_http_strip_filter_init,   /* postconfiguration */
 
-    NULL,                         /* create main configuration */
+    ngx_http_strip_create_main_conf,  /* create main configuration */
     NULL,                         /* init main configuration */
 
     NULL,                         /* create server configuration */
@@ -114,38 +529,200 @@ ngx_module_t  ngx_http_strip_filter_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
+#if (STRIP_PROFILE)
+    ngx_http_strip_init_process,           /* init process */
+#else
     NULL,                                  /* init process */
+#endif
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
+#if (STRIP_PROFILE)
+    ngx_http_strip_exit_process,           /* exit process */
+#else
     NULL,                                  /* exit process */
+#endif
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
 
+#if (STRIP_PROFILE)
+
+/* STRIP_PROFILE: how often each worker logs the parser's counters */
+
+#ifndef NGX_HTTP_STRIP_PROFILE_INTERVAL
+#define NGX_HTTP_STRIP_PROFILE_INTERVAL  60000
+#endif
+
+static ngx_event_t  ngx_http_strip_profile_event;
+
+#endif
+
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 static ngx_http_output_body_filter_pt    ngx_http_next_body_filter;
 
+/* responses on which the parser gave up, per worker */
+static ngx_uint_t  ngx_http_strip_aborts;
+
+/* the elements strip_init() preserves, when only comments are configured */
+static char  *ngx_http_strip_default_tags[] = { "pre", "textarea" };
+
+static ngx_http_variable_t  ngx_http_strip_vars[] = {
+
+    { ngx_string("strip_bytes_in"), NULL, ngx_http_strip_bytes_variable,
+      offsetof(ngx_http_strip_ctx_t, bytes_in), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("strip_bytes_out"), NULL, ngx_http_strip_bytes_variable,
+      offsetof(ngx_http_strip_ctx_t, bytes_out), NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("strip_ratio"), NULL, ngx_http_strip_ratio_variable,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("strip_time_us"), NULL, ngx_http_strip_time_variable,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("strip_aborted"), NULL, ngx_http_strip_aborted_variable,
+      0, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    ngx_http_null_variable
+};
+
+static ngx_http_strip_metric_t  ngx_http_strip_metrics[] = {
+    { "requests_total", "Responses stripped.", NULL,
+      offsetof(ngx_http_strip_stats_node_t, requests) },
+    { "bytes_in_total", "Bytes read by the parser.", NULL,
+      offsetof(ngx_http_strip_stats_node_t, bytes_in) },
+    { "bytes_out_total", "Bytes left by the parser.", NULL,
+      offsetof(ngx_http_strip_stats_node_t, bytes_out) },
+    { "aborts_total", "Responses the parser gave up on.", NULL,
+      offsetof(ngx_http_strip_stats_node_t, aborts) },
+    { "skipped_total", "Responses not stripped, by reason.", "status",
+      offsetof(ngx_http_strip_stats_node_t, skipped_status) },
+    { "skipped_total", NULL, "content_type",
+      offsetof(ngx_http_strip_stats_node_t, skipped_type) },
+    { "skipped_total", NULL, "encoding",
+      offsetof(ngx_http_strip_stats_node_t, skipped_encoding) },
+    { "skipped_total", NULL, "ratio",
+      offsetof(ngx_http_strip_stats_node_t, skipped_ratio) },
+    { "cpu_seconds_total", "CPU time spent stripping.", NULL,
+      offsetof(ngx_http_strip_stats_node_t, cpu) }
+};
+
 static ngx_int_t
 ngx_http_strip_header_filter(ngx_http_request_t *r)
 {
-    ngx_http_strip_conf_t  *conf;
-    ngx_http_strip_ctx_t   *ctx;
+    ngx_str_t                   *encoding;
+    ngx_uint_t                   syntax;
+    ngx_http_strip_conf_t       *conf;
+    ngx_http_strip_ctx_t        *ctx;
+    ngx_http_strip_main_conf_t  *smcf;
 
     conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
 
     if (!conf->enable
-        || (r->headers_out.status != NGX_HTTP_OK
-            && r->headers_out.status != NGX_HTTP_FORBIDDEN
-            && r->headers_out.status != NGX_HTTP_NOT_FOUND)
-        || r->header_only
-        || r->headers_out.content_type.len == 0
-        || (r->headers_out.content_encoding
-            && r->headers_out.content_encoding->value.len))
+        || ngx_http_get_module_ctx(r, ngx_http_strip_filter_module)
+        || r->header_only)
+    {
+        return ngx_http_next_header_filter(r);
+    }
+
+    if (r->headers_out.status != NGX_HTTP_OK
+        && r->headers_out.status != NGX_HTTP_FORBIDDEN
+        && r->headers_out.status != NGX_HTTP_NOT_FOUND)
+    {
+        if (conf->stats) {
+            (void) ngx_atomic_fetch_add(&conf->stats->skipped_status, 1);
+        }
+
+        return ngx_http_next_header_filter(r);
+    }
+
+    /* a type in more than one list is read as HTML, then as XML */
+
+    if (ngx_http_test_content_type(r, &conf->types)) {
+        syntax = STRIP_SYNTAX_HTML;
+
+    } else if (ngx_http_test_content_type(r, &conf->xml_types)) {
+        syntax = STRIP_SYNTAX_XML;
+
+    } else if (ngx_http_strip_test_json(r, &conf->json_types)) {
+        syntax = STRIP_SYNTAX_JSON;
+
+    } else {
+        if (conf->stats) {
+            (void) ngx_atomic_fetch_add(&conf->stats->skipped_type, 1);
+        }
+
+        return ngx_http_next_header_filter(r);
+    }
+
+    encoding = NULL;
+
+    if (r->headers_out.content_encoding
+        && r->headers_out.content_encoding->value.len)
+    {
+        /* only gzip can be undone, and only when asked to */
+
+        encoding = &r->headers_out.content_encoding->value;
+
+        if (!conf->gzip
+            || encoding->len != sizeof("gzip") - 1
+            || ngx_strncasecmp(encoding->data, (u_char *) "gzip",
+                               sizeof("gzip") - 1) != 0)
+        {
+            if (conf->stats) {
+                (void) ngx_atomic_fetch_add(&conf->stats->skipped_encoding, 1);
+            }
+
+            return ngx_http_next_header_filter(r);
+        }
+    }
+
+#if (NGX_HTTP_CACHE)
+
+    /* the mark is taken out of every hit, also when it is not used */
+
+    if (r->cached
+        && ngx_http_strip_upstream_stripped(r, conf->level, syntax)
+        && conf->upstream_cache && encoding == NULL)
     {
+        /*
+         * a cache hit, stripped when it was stored: the cached header has
+         * the upstream's Content-Length, the file the length of the body;
+         * hits without the mark, stored before strip_upstream_cache was on
+         * or while the bypass held, go on to be checked and stripped below
+         */
+
+        if (ngx_http_strip_etag(r, conf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_http_strip_not_modified(r)) {
+            return ngx_http_next_header_filter(r);
+        }
+
+        ngx_http_clear_content_length(r);
+
+        r->headers_out.content_length_n = r->cache->length
+                                          - r->cache->body_start;
+
+        return ngx_http_next_header_filter(r);
+    }
+
+#endif
+
+    /* headers are still untouched, so Content-Length and ranges survive */
+
+    if (conf->min_ratio && conf->stats && ngx_http_strip_bypass(conf)) {
+        (void) ngx_atomic_fetch_add(&conf->stats->skipped_ratio, 1);
         return ngx_http_next_header_filter(r);
     }
 
-    if (ngx_strncasecmp(r->headers_out.content_type.data, (u_char *)"text/html", sizeof("text/html") - 1) != 0) {
+    if (ngx_http_strip_etag(r, conf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_strip_not_modified(r)) {
+        /* the client has this very output, the body is never read */
         return ngx_http_next_header_filter(r);
     }
 
@@ -156,545 +733,3436 @@ ngx_http_strip_header_filter(ngx_http_request_t *r)
 
     ngx_http_set_ctx(r, ctx, ngx_http_strip_filter_module);
 
-    ngx_http_clear_content_length(r);
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_strip_filter_module);
+
+    ctx->parser.level = conf->level;
+    ctx->parser.syntax = syntax;
+    ctx->parser.tables = smcf->tables;
+    ctx->stats = conf->stats;
+
+    /* indexed once the variable is found in the configuration */
+
+    ctx->timed = (ctx->stats
+                  || (smcf->time_var->flags & NGX_HTTP_VAR_INDEXED));
+
+    if (ctx->stats) {
+        (void) ngx_atomic_fetch_add(&ctx->stats->requests, 1);
+    }
+
+    if (encoding) {
+        ctx->gzip = 1;
+
+        ngx_http_clear_content_length(r);
+        ngx_http_clear_accept_ranges(r);
+
+        /* the compressed input is only read */
+        r->main_filter_need_in_memory = 1;
+
+        return ngx_http_next_header_filter(r);
+    }
+
+#if (NGX_HTTP_CACHE)
+
+    if (conf->upstream_cache && r->upstream && r->upstream->cacheable
+        && !r->cached)
+    {
+
+        /* the pipe's input filter is only final once the header is sent */
+
+        ctx->input_filter_init = r->upstream->input_filter_init;
+        r->upstream->input_filter_init = ngx_http_strip_upstream_init;
+
+        ngx_http_clear_content_length(r);
+        ngx_http_clear_accept_ranges(r);
+
+        /*
+         * for when the response turns out not to be cached after all, and
+         * is compacted in place by the body filter
+         */
+
+        r->main_filter_need_in_memory = 1;
+        r->filter_need_temporary = 1;
+
+        return ngx_http_next_header_filter(r);
+    }
+
+#endif
+
+    if (conf->cache_zone
+        && ngx_http_strip_cache_lookup(r, conf, ctx) == NGX_OK)
+    {
+        /* the body is served from the cache, the file is never read */
+
+        ngx_http_clear_content_length(r);
+        ngx_http_clear_accept_ranges(r);
+
+        r->headers_out.content_length_n = ctx->cache_buf->last
+                                          - ctx->cache_buf->pos;
+
+        ngx_http_strip_count(ctx, ctx->cache_size,
+                             r->headers_out.content_length_n, 0);
+
+        return ngx_http_next_header_filter(r);
+    }
+
     ngx_http_clear_accept_ranges(r);
 
     r->main_filter_need_in_memory = 1;
 
+    if (r == r->main
+        && r->headers_out.content_length_n > 0
+        && r->headers_out.content_length_n <= (off_t) conf->buffer_size)
+    {
+        /* the header goes out with the body, and with its new length */
+
+        ctx->collect = 1;
+        ctx->collected = ngx_create_temp_buf(r->pool,
+                                             r->headers_out.content_length_n);
+        if (ctx->collected == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_http_clear_content_length(r);
+
+        return NGX_OK;
+    }
+
+    ngx_http_clear_content_length(r);
+
+    if (conf->slices) {
+        /* the input is only read, it may live in read-only memory */
+        ctx->slices = 1;
+
+    } else if (conf->coalesce) {
+        /* so is it here, the output is copied out of it */
+        ctx->coalesce = 1;
+
+    } else {
+        /* compaction writes into the input */
+        r->filter_need_temporary = 1;
+    }
+
     return ngx_http_next_header_filter(r);
 }
 
-static ngx_int_t
-ngx_http_strip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+/*
+ * strip_json_types: "+json" in the list stands for every type with that
+ * structured syntax suffix, such as application/problem+json, which the
+ * types hash cannot match by itself.
+ */
+
+static ngx_uint_t
+ngx_http_strip_test_json(ngx_http_request_t *r, ngx_hash_t *types)
 {
-    ngx_http_strip_ctx_t *ctx;
-    ngx_chain_t          *chain_link, *prev_link = NULL;
+    size_t   len;
+    u_char  *lowcase;
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_strip_filter_module);
-    if (ctx == NULL) {
-        return ngx_http_next_body_filter(r, in);
+    if (ngx_http_test_content_type(r, types)) {
+        return 1;
     }
 
-    for (chain_link = in; chain_link; chain_link = chain_link->next) {
-        ngx_http_strip_process_buffer(chain_link->buf, ctx);
-        if (chain_link->buf->pos == chain_link->buf->last) {
-            if (prev_link) {
-                prev_link->next = chain_link->next;
-            } else {
-                in = chain_link->next;
-            }
-        } else {
-            prev_link = chain_link;
-        }
-    }
+    /* set by the test unless the type is empty */
 
-    if (in == NULL)
-        return NGX_OK;
+    lowcase = r->headers_out.content_type_lowcase;
+    len = r->headers_out.content_type_len;
+
+    if (lowcase == NULL
+        || len < sizeof("+json") - 1
+        || ngx_strncmp(lowcase + len - (sizeof("+json") - 1), "+json",
+                       sizeof("+json") - 1)
+           != 0)
+    {
+        return 0;
+    }
 
-    return ngx_http_next_body_filter(r, in);
+    return ngx_hash_find(types,
+                         ngx_hash_key((u_char *) "+json", sizeof("+json") - 1),
+                         (u_char *) "+json", sizeof("+json") - 1)
+           != NULL;
 }
 
-static void
-ngx_http_strip_process_buffer(ngx_buf_t *buffer, ngx_http_strip_ctx_t *ctx)
+/*
+ * The body changes, so a strong ETag of the original would be wrong.  It
+ * becomes a weak one naming the original and what strip_level,
+ * strip_preserve_tags and strip_keep_comments make of it, so that it
+ * changes with either.  Last-Modified still holds and is left alone.
+ */
+
+static ngx_int_t
+ngx_http_strip_etag(ngx_http_request_t *r, ngx_http_strip_conf_t *conf)
 {
-    u_char *reader;
-    u_char *writer;
+    u_char                      *p;
+    ngx_str_t                    opaque;
+    ngx_table_elt_t             *etag;
+    ngx_http_strip_main_conf_t  *smcf;
 
-    for (writer = buffer->pos, reader = buffer->pos; reader < buffer->last; reader++) {
-        switch(ctx->state) {
-            case strip_state_abort:
-                break;
-            case strip_state_text:
-                switch(*reader) {
-                    case '\r':
-                    case '\n':
-                    case '\t':
-                        continue;
-                    case '<':
-                        ctx->state = strip_state_tag;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_text_whitespace;
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case strip_state_tag:
-                switch(*reader) {
-                    case '!':
-                        ctx->state = strip_state_tag_bang;
-                        break;
-                    case '/':
-                        ctx->state = strip_state_end_tag;
-                        break;
-                    case 'p':
-                    case 'P':
-                        ctx->state = strip_state_tag_name_p;
-                        break;
-                    case 't':
-                    case 'T':
-                        ctx->state = strip_state_tag_name_t;
-                        break;
-                    case ' ':
-                        break;
-                    default:
-                        if ((*reader >= 'a' && *reader <= 'z') ||
-                                (*reader >= 'A' && *reader <= 'Z')) {
-                            ctx->state = strip_state_tag_name;
-                        } else {
-                            ctx->state = strip_state_abort;
-                        }
-                        break;
-                }
-                break;
-            case strip_state_tag_name:
-                switch(*reader) {
-                    case '>':
-                        ctx->state = strip_state_text;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case strip_state_tag_name_t:
-                switch (*reader) {
-                    case 'e':
-                    case 'E':
-                        ctx->state = strip_state_tag_name_te;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
-                break;
-            case strip_state_tag_name_te:
-                switch (*reader) {
-                    case 'x':
-                    case 'X':
-                        ctx->state = strip_state_tag_name_tex;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
-                break;
-            case strip_state_tag_name_tex:
-                switch (*reader) {
-                    case 't':
-                    case 'T':
-                        ctx->state = strip_state_tag_name_text;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
-                break;
-            case strip_state_tag_name_text:
-                switch (*reader) {
-                    case 'a':
-                    case 'A':
-                        ctx->state = strip_state_tag_name_texta;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
-                break;
-            case strip_state_tag_name_texta:
-                switch (*reader) {
-                    case 'r':
-                    case 'R':
-                        ctx->state = strip_state_tag_name_textar;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
-                break;
-            case strip_state_tag_name_textar:
-                switch (*reader) {
-                    case 'e':
-                    case 'E':
-                        ctx->state = strip_state_tag_name_textare;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
-                break;
-            case strip_state_tag_name_textare:
-                switch (*reader) {
-                    case 'a':
-                    case 'A':
-                        ctx->state = strip_state_tag_name_textarea;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
-                break;
-            case strip_state_tag_name_textarea:
-                switch(*reader) {
-                    case ' ':
-                    case '>':
-                        ctx->state = strip_state_textarea;
-                        break;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
-                break;
-            case strip_state_textarea:
-                if (*reader == '<') {
-                    ctx->state = strip_state_textarea_angle;
-                }
-                break;
-            case strip_state_textarea_angle:
-                ctx->state = (*reader == '/') ? strip_state_textarea_angle_slash : strip_state_textarea;
-                break;
-            case strip_state_textarea_angle_slash:
-                ctx->state = (*reader == 't' || *reader == 'T') ? strip_state_textarea_angle_slash_t : strip_state_textarea;
-                break;
-            case strip_state_textarea_angle_slash_t:
-                ctx->state = (*reader == 'e' || *reader == 'E') ? strip_state_textarea_angle_slash_te : strip_state_textarea;
-                break;
-            case strip_state_textarea_angle_slash_te:
-                ctx->state = (*reader == 'x' || *reader == 'X') ? strip_state_textarea_angle_slash_tex : strip_state_textarea;
-                break;
-            case strip_state_textarea_angle_slash_tex:
-                ctx->state = (*reader == 't' || *reader == 'T') ? strip_state_textarea_angle_slash_text : strip_state_textarea;
-                break;
-            case strip_state_textarea_angle_slash_text:
-                ctx->state = (*reader == 'a' || *reader == 'A') ? strip_state_textarea_angle_slash_texta : strip_state_textarea;
-                break;
-            case strip_state_textarea_angle_slash_texta:
-                ctx->state = (*reader == 'r' || *reader == 'R') ? strip_state_textarea_angle_slash_textar : strip_state_textarea;
-                break;
-            case strip_state_textarea_angle_slash_textar:
-                ctx->state = (*reader == 'e' || *reader == 'E') ? strip_state_textarea_angle_slash_textare : strip_state_textarea;
-                break;
-            case strip_state_textarea_angle_slash_textare:
-                ctx->state = (*reader == 'a' || *reader == 'A') ? strip_state_textarea_angle_slash_textarea : strip_state_textarea;
-                break;
-            case strip_state_textarea_angle_slash_textarea:
-                ctx->state = (*reader == '>') ? strip_state_text : strip_state_textarea;
-                break;
-            case strip_state_tag_name_p:
-                switch(*reader) {
-                    case 'r':
-                    case 'R':
-                        ctx->state = strip_state_tag_name_pr;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                        break;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
+    etag = r->headers_out.etag;
+
+    if (etag == NULL) {
+        return NGX_OK;
+    }
+
+    opaque = etag->value;
+
+    if (opaque.len > 2 && opaque.data[0] == 'W' && opaque.data[1] == '/') {
+        opaque.data += 2;
+        opaque.len -= 2;
+    }
+
+    if (opaque.len < 2
+        || opaque.data[0] != '"'
+        || opaque.data[opaque.len - 1] != '"')
+    {
+        ngx_http_clear_etag(r);
+        return NGX_OK;
+    }
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_strip_filter_module);
+
+    p = ngx_pnalloc(r->pool, sizeof("W/-s.") - 1 + opaque.len
+                             + NGX_INT_T_LEN + 8);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    etag->value.data = p;
+    etag->value.len = ngx_sprintf(p, "W/%*s-s%i.%08xD\"",
+                                  opaque.len - 1, opaque.data,
+                                  conf->level, smcf->signature)
+                      - p;
+
+    return NGX_OK;
+}
+
+/*
+ * If-None-Match with the new ETag.  The not modified filter runs before
+ * this one and only knows the original, so it lets these requests
+ * through; If-Modified-Since alone it has answered already.
+ */
+
+static ngx_uint_t
+ngx_http_strip_not_modified(ngx_http_request_t *r)
+{
+    if (r->headers_out.status != NGX_HTTP_OK
+        || r != r->main
+        || r->disable_not_modified
+        || r->headers_in.if_none_match == NULL
+        || !ngx_http_strip_etag_match(r, &r->headers_in.if_none_match->value))
+    {
+        return 0;
+    }
+
+    r->headers_out.status = NGX_HTTP_NOT_MODIFIED;
+    r->headers_out.status_line.len = 0;
+    r->headers_out.content_type.len = 0;
+    ngx_http_clear_content_length(r);
+    ngx_http_clear_accept_ranges(r);
+
+    if (r->headers_out.content_encoding) {
+        r->headers_out.content_encoding->hash = 0;
+        r->headers_out.content_encoding = NULL;
+    }
+
+    return 1;
+}
+
+/* a weak comparison, as for If-None-Match in the not modified filter */
+
+static ngx_uint_t
+ngx_http_strip_etag_match(ngx_http_request_t *r, ngx_str_t *list)
+{
+    u_char     *start, *end, ch;
+    ngx_str_t   etag;
+
+    if (list->len == 1 && list->data[0] == '*') {
+        return 1;
+    }
+
+    if (r->headers_out.etag == NULL) {
+        return 0;
+    }
+
+    /* always weak by now */
+
+    etag.data = r->headers_out.etag->value.data + 2;
+    etag.len = r->headers_out.etag->value.len - 2;
+
+    start = list->data;
+    end = list->data + list->len;
+
+    while (start < end) {
+
+        if (end - start > 2 && start[0] == 'W' && start[1] == '/') {
+            start += 2;
+        }
+
+        if (etag.len > (size_t) (end - start)) {
+            return 0;
+        }
+
+        if (ngx_strncmp(start, etag.data, etag.len) != 0) {
+            goto skip;
+        }
+
+        start += etag.len;
+
+        while (start < end) {
+            ch = *start;
+
+            if (ch != ' ' && ch != '\t') {
                 break;
-            case strip_state_tag_name_pr:
-                switch(*reader) {
-                    case 'e':
-                    case 'E':
-                        ctx->state = strip_state_tag_name_pre;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                        break;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
-                }
+            }
+
+            start++;
+        }
+
+        if (start == end || *start == ',') {
+            return 1;
+        }
+
+    skip:
+
+        while (start < end && *start != ',') {
+            start++;
+        }
+
+        while (start < end) {
+            ch = *start;
+
+            if (ch != ' ' && ch != '\t' && ch != ',') {
                 break;
-            case strip_state_tag_name_pre:
-                switch(*reader) {
-                    case ' ':
-                    case '>':
-                        ctx->state = strip_state_preformatted;
-                        break;
-                    default:
-                        ctx->state = strip_state_tag_name;
-                        break;
+            }
+
+            start++;
+        }
+    }
+
+    return 0;
+}
+
+static ngx_int_t
+ngx_http_strip_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    size_t                size_in, size_out;
+    ngx_chain_t          *chain_link, *out, **ll;
+    ngx_uint_t            last = 0;
+    ngx_atomic_uint_t     start;
+    ngx_http_strip_ctx_t *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_strip_filter_module);
+    if (ctx == NULL || ctx->static_file) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    if (ctx->cache_hit) {
+        return ngx_http_strip_cache_send(r, ctx, in);
+    }
+
+    if (ctx->upstream) {
+        return ngx_http_strip_body_upstream(r, in);
+    }
+
+    if (ctx->gzip) {
+        return ngx_http_strip_body_gzip(r, ctx, in);
+    }
+
+    if (ctx->collect) {
+        return ngx_http_strip_body_collect(r, ctx, in);
+    }
+
+    /* these two keep going after an abort, they may hold earlier input */
+
+    if (ctx->slices) {
+        return ngx_http_strip_body_slices(r, ctx, in);
+    }
+
+    if (ctx->coalesce) {
+        return ngx_http_strip_body_coalesce(r, ctx, in);
+    }
+
+#if (NGX_THREADS)
+    if (ctx->in || ctx->thread_busy
+        || ngx_http_strip_thread_wanted(r, ctx, in))
+    {
+        return ngx_http_strip_body_threads(r, ctx, in);
+    }
+#endif
+
+    if (strip_aborted(&ctx->parser)) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    /*
+     * the input chain belongs to the caller, the output goes into links
+     * of our own so that emptied buffers can be left out of it
+     */
+
+    out = NULL;
+    ll = &out;
+
+    size_in = 0;
+    size_out = 0;
+    start = ngx_http_strip_cpu_time(ctx->timed);
+
+    for (chain_link = in; chain_link; chain_link = chain_link->next) {
+        last |= chain_link->buf->last_buf;
+
+        if (!strip_aborted(&ctx->parser)) {
+            size_in += chain_link->buf->last - chain_link->buf->pos;
+
+            chain_link->buf->last = strip_compact(&ctx->parser,
+                                                  chain_link->buf->pos,
+                                                  chain_link->buf->last);
+
+            size_out += chain_link->buf->last - chain_link->buf->pos;
+
+            /* the rest of the response goes out untouched */
+            ngx_http_strip_check_abort(r, ctx);
+        }
+
+        *ll = ngx_http_strip_link(r, chain_link->buf);
+
+        if (*ll == NGX_CHAIN_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (*ll) {
+            ll = &(*ll)->next;
+        }
+    }
+
+    *ll = NULL;
+
+    ngx_http_strip_count(ctx, size_in, size_out,
+                         ngx_http_strip_cpu_time(ctx->timed) - start);
+
+    if (ctx->cache_store) {
+        ngx_http_strip_cache_add(r, ctx, out, last);
+    }
+
+    /*
+     * the next filter is called even when everything was whitespace,
+     * output held further down the chain must not wait for more input
+     */
+
+    return ngx_http_next_body_filter(r, out);
+}
+
+/*
+ * Links a stripped buffer into the output.  A buffer left empty, in
+ * memory or in the temp file of strip_upstream_cache, is dropped, unless
+ * it carries flush, sync or the end of the response: an empty buffer
+ * would be taken for data, so those flags move to a new special buffer,
+ * and the emptied one counts as sent.
+ */
+
+static ngx_chain_t *
+ngx_http_strip_link(ngx_http_request_t *r, ngx_buf_t *b)
+{
+    ngx_buf_t    *special;
+    ngx_chain_t  *cl;
+
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    if (ngx_buf_in_memory(b)) {
+        if (b->pos != b->last || b->in_file) {
+            return cl;
+        }
+
+    } else if (!b->in_file || b->file_pos != b->file_last) {
+        return cl;
+    }
+
+    if (!b->last_buf && !b->last_in_chain && !b->flush && !b->sync) {
+        ngx_free_chain(r->pool, cl);
+        return NULL;
+    }
+
+    special = ngx_calloc_buf(r->pool);
+    if (special == NULL) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    special->last_buf = b->last_buf;
+    special->last_in_chain = b->last_in_chain;
+    special->flush = b->flush;
+    special->sync = b->sync;
+
+    cl->buf = special;
+
+    return cl;
+}
+
+static ngx_int_t
+ngx_http_strip_body_collect(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    size_t              size;
+    ngx_int_t           rc;
+    ngx_buf_t          *b;
+    ngx_uint_t          last;
+    ngx_chain_t        *cl, *out;
+    ngx_atomic_uint_t   start;
+
+    b = ctx->collected;
+    last = 0;
+
+    for (cl = in; cl; cl = cl->next) {
+        size = cl->buf->last - cl->buf->pos;
+
+        if (size > (size_t) (b->end - b->last)) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "strip: response body is larger than "
+                          "its Content-Length");
+            return NGX_ERROR;
+        }
+
+        b->last = ngx_cpymem(b->last, cl->buf->pos, size);
+        cl->buf->pos = cl->buf->last;
+
+        last |= cl->buf->last_buf;
+    }
+
+    if (!last) {
+        r->buffered |= NGX_HTTP_STRIP_BUFFERED;
+        return NGX_OK;
+    }
+
+    r->buffered &= ~NGX_HTTP_STRIP_BUFFERED;
+
+    ctx->collect = 0;
+
+    size = b->last - b->pos;
+    start = ngx_http_strip_cpu_time(ctx->timed);
+
+    b->last = strip_compact(&ctx->parser, b->pos, b->last);
+
+    ngx_http_strip_count(ctx, size, b->last - b->pos,
+                         ngx_http_strip_cpu_time(ctx->timed) - start);
+
+    ngx_http_strip_check_abort(r, ctx);
+
+    b->last_buf = 1;
+
+    out = ngx_http_strip_link(r, b);
+
+    if (out == NGX_CHAIN_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (ctx->cache_store) {
+        ngx_http_strip_cache_add(r, ctx, out, 1);
+    }
+
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    rc = ngx_http_next_header_filter(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_next_body_filter(r, out);
+}
+
+static ngx_int_t
+ngx_http_strip_body_coalesce(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    u_char             *p, *w;
+    size_t              i, n, size_in, size_out;
+    ngx_int_t           rc;
+    ngx_buf_t          *buf;
+    ngx_uint_t          last;
+    ngx_chain_t        *cl, *out, **ll;
+    strip_range_t       ranges[NGX_HTTP_STRIP_RANGES];
+    ngx_atomic_uint_t   start;
+
+    out = NULL;
+    ll = &out;
+    last = 0;
+
+    size_in = 0;
+    size_out = 0;
+    start = ngx_http_strip_cpu_time(ctx->timed);
+
+    for (cl = in; cl; cl = cl->next) {
+        buf = cl->buf;
+
+        /* after an abort every byte is a kept one, and still copied */
+
+        for (p = buf->pos; p < buf->last; /* void */) {
+
+            w = p;
+            n = NGX_HTTP_STRIP_RANGES;
+
+            p = strip_ranges(&ctx->parser, p, buf->last, ranges, &n);
+
+            size_in += p - w;
+
+            for (i = 0; i < n; i++) {
+                size_out += ranges[i].last - ranges[i].pos;
+
+                if (ngx_http_strip_coalesce(r, ctx, ranges[i].pos,
+                                            ranges[i].last - ranges[i].pos,
+                                            NULL, &ll)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
                 }
-                break;
-            case strip_state_preformatted:
-                if (*reader == '<') {
-                    ctx->state = strip_state_preformatted_angle;
+            }
+        }
+
+        ngx_http_strip_check_abort(r, ctx);
+
+        buf->pos = buf->last;
+        last |= buf->last_buf;
+
+        if (buf->last_buf || buf->flush || buf->sync || buf->last_in_chain) {
+            if (ngx_http_strip_coalesce(r, ctx, NULL, 0, buf, &ll)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    *ll = NULL;
+
+    ngx_http_strip_count(ctx, size_in, size_out,
+                         ngx_http_strip_cpu_time(ctx->timed) - start);
+
+    /* a coalesced buf is linked here once, when it fills up or is flushed */
+
+    if (ctx->cache_store) {
+        ngx_http_strip_cache_add(r, ctx, out, last);
+    }
+
+    if (ctx->coalesce_cl) {
+        r->buffered |= NGX_HTTP_STRIP_BUFFERED;
+
+    } else {
+        r->buffered &= ~NGX_HTTP_STRIP_BUFFERED;
+    }
+
+    rc = ngx_http_next_body_filter(r, out);
+
+    ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &out,
+                            (ngx_buf_tag_t) &ngx_http_strip_filter_module);
+
+    return rc;
+}
+
+/*
+ * Copies len bytes at p into bufs of strip_coalesce bytes linked at *ll
+ * as they fill up.  With flags set, the buf being filled goes out as it
+ * is, carrying those flags.
+ */
+
+static ngx_int_t
+ngx_http_strip_coalesce(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    u_char *p, size_t len, ngx_buf_t *flags, ngx_chain_t ***ll)
+{
+    size_t                  size;
+    ngx_buf_t              *b;
+    ngx_chain_t            *cl;
+    ngx_http_strip_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
+
+    do {
+        if (ctx->coalesce_cl == NULL) {
+            cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = cl->buf;
+
+            if (b->start == NULL) {
+                b->start = ngx_palloc(r->pool, conf->coalesce);
+                if (b->start == NULL) {
+                    return NGX_ERROR;
                 }
-                break;
-            case strip_state_preformatted_angle:
-                ctx->state = (*reader == '/') ? strip_state_preformatted_angle_slash : strip_state_preformatted;
-                break;
-            case strip_state_preformatted_angle_slash:
-                ctx->state = (*reader == 'p' || *reader == 'P') ? strip_state_preformatted_angle_slash_p : strip_state_preformatted;
-                break;
-            case strip_state_preformatted_angle_slash_p:
-                ctx->state = (*reader == 'r' || *reader == 'R') ? strip_state_preformatted_angle_slash_pr : strip_state_preformatted;
-                break;
-            case strip_state_preformatted_angle_slash_pr:
-                ctx->state = (*reader == 'e' || *reader == 'E') ? strip_state_preformatted_angle_slash_pre : strip_state_preformatted;
-                break;
-            case strip_state_preformatted_angle_slash_pre:
-                ctx->state = (*reader == '>') ? strip_state_text : strip_state_preformatted;
-                break;
-            case strip_state_tag_bang:
-                switch(*reader) {
-                    case '-':
-                        ctx->state = strip_state_tag_bang_dash;
-                        break;
-                    case '[':
-                        ctx->state = strip_state_tag_bang_bracket;
-                    default:
-                        ctx->state = strip_state_tag_bang_stuff;
-                        break;
-                }
-                break;
-            case strip_state_tag_bang_bracket:
-                ctx->state = (*reader == 'C') ? strip_state_tag_bang_bracket_c : strip_state_tag_bang_stuff;
-                break;
-            case strip_state_tag_bang_bracket_c:
-                ctx->state = (*reader == 'D') ? strip_state_tag_bang_bracket_cd : strip_state_tag_bang_stuff;
-                break;
-            case strip_state_tag_bang_bracket_cd:
-                ctx->state = (*reader == 'A') ? strip_state_tag_bang_bracket_cda : strip_state_tag_bang_stuff;
-                break;
-            case strip_state_tag_bang_bracket_cda:
-                ctx->state = (*reader == 'T') ? strip_state_tag_bang_bracket_cdat : strip_state_tag_bang_stuff;
-                break;
-            case strip_state_tag_bang_bracket_cdat:
-                ctx->state = (*reader == 'A') ? strip_state_tag_bang_bracket_cdata : strip_state_tag_bang_stuff;
-                break;
-            case strip_state_tag_bang_bracket_cdata:
-                ctx->state = (*reader == '[') ? strip_state_cdata : strip_state_tag_bang_stuff;
-                break;
-            case strip_state_cdata:
-                ctx->state = (*reader == ']') ? strip_state_cdata_bracket : strip_state_cdata;
-                break;
-            case strip_state_cdata_bracket:
-                ctx->state = (*reader == ']') ? strip_state_cdata_bracket_bracket : strip_state_cdata;
-                break;
-            case strip_state_cdata_bracket_bracket:
-                ctx->state = (*reader = '>') ? strip_state_text : strip_state_cdata;
-                break;
-            case strip_state_tag_bang_dash:
-                switch(*reader) {
-                    case '-':
-                        ctx->state = strip_state_comment;
-                        break;
-                    default:
-                        ctx->state = strip_state_tag_bang_stuff;
-                        break;
-                }
-                break;
-            case strip_state_tag_bang_stuff:
-                switch(*reader) {
-                    case '>':
-                        ctx->state = strip_state_text;
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case strip_state_comment:
-                switch(*reader) {
-                    case '-':
-                        ctx->state = strip_state_comment_dash;
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case strip_state_comment_dash:
-                switch(*reader) {
-                    case '-':
-                        ctx->state = strip_state_comment_dash_dash;
-                        break;
-                    default:
-                        ctx->state = strip_state_comment;
-                        break;
-                }
-                break;
-            case strip_state_comment_dash_dash:
-                switch(*reader) {
-                    case '>':
-                        ctx->state = strip_state_text;
-                        break;
-                    case '-':
-                        ctx->state = strip_state_comment_dash_dash;
-                        break;
-                    default:
-                        ctx->state = strip_state_comment;
-                        break;
-                }
-                break;
-            case strip_state_end_tag:
-                switch(*reader) {
-                    case ' ':
-                        continue;
-                    default:
-                        ctx->state = strip_state_end_tag_name;
-                        break;
-                }
-                break;
-            case strip_state_end_tag_name:
-                switch(*reader) {
-                    case '>':
-                        ctx->state = strip_state_text;
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case strip_state_tag_whitespace:
-                switch(*reader) {
-                    case ' ':
-                        continue;
-                    case '>':
-                        ctx->state = strip_state_text;
-                        break;
-                    default:
-                        ctx->state = strip_state_tag_attribute_name;
-                        break;
-                }
-                break;
-            case strip_state_tag_attribute_name:
-                switch(*reader) {
-                    case '=':
-                        ctx->state = strip_state_tag_attribute_equals;
-                        break;
-                    case '>':
-                        ctx->state = strip_state_text;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    default:
-                        break;
-                }
-                break;
-            case strip_state_tag_attribute_equals:
-                switch(*reader) {
-                    case '"':
-                        ctx->state = strip_state_tag_attribute_value_double_quote;
-                        break;
-                    case '\'':
-                        ctx->state = strip_state_tag_attribute_value_single_quote;
-                        break;
-                    default:
-                        ctx->state = strip_state_tag_attribute_value;
-                        break;
-                }
-                break;
-            case strip_state_tag_attribute_value:
-                switch(*reader) {
-                    case '>':
-                        ctx->state = strip_state_text;
-                        break;
-                    case ' ':
-                        ctx->state = strip_state_tag_whitespace;
-                        break;
-                    default:
-                        break;
+
+                b->end = b->start + conf->coalesce;
+                b->tag = (ngx_buf_tag_t) &ngx_http_strip_filter_module;
+            }
+
+            b->temporary = 1;
+            b->pos = b->start;
+            b->last = b->start;
+            b->flush = 0;
+            b->last_buf = 0;
+            b->last_in_chain = 0;
+            b->sync = 0;
+
+            ctx->coalesce_cl = cl;
+        }
+
+        cl = ctx->coalesce_cl;
+        b = cl->buf;
+
+        size = ngx_min(len, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, p, size);
+
+        p += size;
+        len -= size;
+
+        if (b->last == b->end) {
+            **ll = cl;
+            *ll = &cl->next;
+
+            ctx->coalesce_cl = NULL;
+        }
+
+    } while (len);
+
+    if (flags == NULL) {
+        /* a partly filled buf waits for more */
+        return NGX_OK;
+    }
+
+    cl = ctx->coalesce_cl;
+    b = cl->buf;
+
+    **ll = cl;
+    *ll = &cl->next;
+
+    ctx->coalesce_cl = NULL;
+
+    if (b->pos == b->last) {
+        /* an empty buf in memory would be taken for data */
+
+        b->temporary = 0;
+        b->pos = NULL;
+        b->last = NULL;
+    }
+
+    b->last_buf = flags->last_buf;
+    b->last_in_chain = flags->last_in_chain;
+    b->flush = flags->flush;
+    b->sync = flags->sync;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_strip_body_gzip(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    int                 rc;
+    u_char             *p;
+    size_t              size_in, size_out;
+    ngx_int_t           rv;
+    ngx_buf_t          *b;
+    ngx_uint_t          full;
+    ngx_chain_t        *cl, *out, **ll;
+    ngx_atomic_uint_t   start;
+
+    if (ctx->zbuf == NULL && ngx_http_strip_gzip_init(r, ctx) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    out = NULL;
+    ll = &out;
+
+    /* inflating and deflating again is part of what stripping costs here */
+
+    size_in = 0;
+    size_out = 0;
+    start = ngx_http_strip_cpu_time(ctx->timed);
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        ctx->zin.next_in = b->pos;
+        ctx->zin.avail_in = b->last - b->pos;
+
+        /*
+         * inflate a chunk at a time, strip it and deflate it right away;
+         * with zbuf filled up inflate() may still hold output back after
+         * taking all the input, so it is called again until zbuf is not
+         * filled, before the flags of the buf are passed on
+         */
+
+        full = 0;
+
+        while ((ctx->zin.avail_in || full) && !ctx->gzip_end) {
+
+            ctx->zin.next_out = ctx->zbuf;
+            ctx->zin.avail_out = NGX_HTTP_STRIP_GZIP_BUF;
+
+            rc = inflate(&ctx->zin, Z_NO_FLUSH);
+
+            if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "strip: inflate() failed: %d", rc);
+                return NGX_ERROR;
+            }
+
+            full = (ctx->zin.avail_out == 0);
+
+            if (rc == Z_STREAM_END) {
+                if (ctx->zin.avail_in) {
+                    /* another gzip member follows */
+                    inflateReset(&ctx->zin);
+
+                } else {
+                    ctx->gzip_end = 1;
                 }
-                break;
-            case strip_state_tag_attribute_value_double_quote:
-                switch(*reader) {
-                    case '"':
-                        ctx->state = strip_state_tag_attribute_value;
-                        break;
-                    default:
-                        break;
+            }
+
+            p = strip_compact(&ctx->parser, ctx->zbuf, ctx->zin.next_out);
+
+            size_in += ctx->zin.next_out - ctx->zbuf;
+            size_out += p - ctx->zbuf;
+
+            ngx_http_strip_check_abort(r, ctx);
+
+            if (ngx_http_strip_deflate(r, ctx, ctx->zbuf, p - ctx->zbuf,
+                                       NULL, &ll)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        b->pos = b->last;
+
+        if (b->last_buf || b->flush || b->sync || b->last_in_chain) {
+            if (ngx_http_strip_deflate(r, ctx, NULL, 0, b, &ll) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    *ll = NULL;
+
+    ngx_http_strip_count(ctx, size_in, size_out,
+                         ngx_http_strip_cpu_time(ctx->timed) - start);
+
+    rv = ngx_http_next_body_filter(r, out);
+
+    ngx_chain_update_chains(r->pool, &ctx->free, &ctx->busy, &out,
+                            (ngx_buf_tag_t) &ngx_http_strip_filter_module);
+
+    return rv;
+}
+
+/*
+ * Deflates len bytes at p into bufs linked at *ll.  With flags set, the
+ * output is flushed, or finished at the last buf, and the last buf
+ * linked carries those flags on.
+ */
+
+static ngx_int_t
+ngx_http_strip_deflate(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    u_char *p, size_t len, ngx_buf_t *flags, ngx_chain_t ***ll)
+{
+    int           rc, flush;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    if (flags == NULL) {
+        flush = Z_NO_FLUSH;
+
+    } else if (flags->last_buf) {
+        flush = Z_FINISH;
+
+    } else if (flags->flush) {
+        flush = Z_SYNC_FLUSH;
+
+    } else {
+        /* nothing to push out for sync or the end of a subrequest */
+        flush = Z_NO_FLUSH;
+    }
+
+    ctx->zout.next_in = p;
+    ctx->zout.avail_in = len;
+
+    for ( ;; ) {
+
+        if (ctx->zout_cl == NULL) {
+            cl = ngx_chain_get_free_buf(r->pool, &ctx->free);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = cl->buf;
+
+            if (b->start == NULL) {
+                b->start = ngx_palloc(r->pool, NGX_HTTP_STRIP_GZIP_BUF);
+                if (b->start == NULL) {
+                    return NGX_ERROR;
                 }
-                break;
-            case strip_state_tag_attribute_value_single_quote:
-                switch(*reader) {
-                    case '\'':
-                        ctx->state = strip_state_tag_attribute_value;
-                        break;
-                    default:
-                        break;
+
+                b->end = b->start + NGX_HTTP_STRIP_GZIP_BUF;
+                b->tag = (ngx_buf_tag_t) &ngx_http_strip_filter_module;
+            }
+
+            b->temporary = 1;
+            b->pos = b->start;
+            b->last = b->start;
+            b->flush = 0;
+            b->last_buf = 0;
+            b->last_in_chain = 0;
+            b->sync = 0;
+
+            ctx->zout_cl = cl;
+        }
+
+        cl = ctx->zout_cl;
+        b = cl->buf;
+
+        ctx->zout.next_out = b->last;
+        ctx->zout.avail_out = b->end - b->last;
+
+        rc = deflate(&ctx->zout, flush);
+
+        if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "strip: deflate() failed: %d", rc);
+            return NGX_ERROR;
+        }
+
+        b->last = ctx->zout.next_out;
+
+        if (ctx->zout.avail_out == 0) {
+            /* the buf is full, there may be more */
+
+            **ll = cl;
+            *ll = &cl->next;
+
+            ctx->zout_cl = NULL;
+            continue;
+        }
+
+        break;
+    }
+
+    if (flags == NULL) {
+        /* a partly filled buf waits for more */
+        return NGX_OK;
+    }
+
+    **ll = cl;
+    *ll = &cl->next;
+
+    ctx->zout_cl = NULL;
+
+    if (b->pos == b->last) {
+        /* an empty buf in memory would be taken for data */
+
+        b->temporary = 0;
+        b->pos = NULL;
+        b->last = NULL;
+    }
+
+    b->last_buf = flags->last_buf;
+    b->last_in_chain = flags->last_in_chain;
+    b->flush = flags->flush;
+    b->sync = flags->sync;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_strip_gzip_init(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx)
+{
+    int                     rc;
+    ngx_pool_cleanup_t     *cln;
+    ngx_http_strip_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
+
+    ctx->zbuf = ngx_palloc(r->pool, NGX_HTTP_STRIP_GZIP_BUF);
+    if (ctx->zbuf == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* 16 + MAX_WBITS: read and write a gzip wrapper, not a zlib one */
+
+    rc = inflateInit2(&ctx->zin, 16 + MAX_WBITS);
+
+    if (rc != Z_OK) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "strip: inflateInit2() failed: %d", rc);
+        return NGX_ERROR;
+    }
+
+    rc = deflateInit2(&ctx->zout, (int) conf->gzip_comp_level, Z_DEFLATED,
+                      16 + MAX_WBITS, MAX_MEM_LEVEL - 1, Z_DEFAULT_STRATEGY);
+
+    if (rc != Z_OK) {
+        inflateEnd(&ctx->zin);
+
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "strip: deflateInit2() failed: %d", rc);
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_strip_gzip_cleanup;
+    cln->data = ctx;
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_strip_gzip_cleanup(void *data)
+{
+    ngx_http_strip_ctx_t *ctx = data;
+
+    inflateEnd(&ctx->zin);
+    deflateEnd(&ctx->zout);
+}
+
+static ngx_int_t
+ngx_http_strip_body_slices(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    u_char                 *p, *w;
+    size_t                  i, n, kept, size_in, size_out;
+    ngx_int_t               rc;
+    ngx_buf_t              *buf, *b;
+    ngx_uint_t              last;
+    ngx_chain_t            *cl, *tl, *out, **ll;
+    strip_range_t           ranges[NGX_HTTP_STRIP_RANGES];
+    ngx_atomic_uint_t       start;
+    ngx_http_strip_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
+
+    out = NULL;
+    ll = &out;
+    last = 0;
+
+    size_in = 0;
+    size_out = 0;
+    start = ngx_http_strip_cpu_time(ctx->timed);
+
+    for (cl = in; cl; cl = cl->next) {
+        buf = cl->buf;
+        b = NULL;
+
+        last |= buf->last_buf;
+
+        if (strip_aborted(&ctx->parser)) {
+            /* the rest of the response goes out untouched */
+
+            tl = ngx_alloc_chain_link(r->pool);
+            if (tl == NULL) {
+                return NGX_ERROR;
+            }
+
+            tl->buf = buf;
+            *ll = tl;
+            ll = &tl->next;
+
+            continue;
+        }
+
+        for (p = buf->pos; p < buf->last; /* void */) {
+
+            w = p;
+            n = NGX_HTTP_STRIP_RANGES;
+
+            p = strip_ranges(&ctx->parser, p, buf->last, ranges, &n);
+
+            size_in += p - w;
+
+            if (n == 0) {
+                continue;
+            }
+
+            for (kept = 0, i = 0; i < n; i++) {
+                kept += ranges[i].last - ranges[i].pos;
+            }
+
+            size_out += kept;
+
+            if (kept / n < conf->slice_min && buf->temporary) {
+                /*
+                 * short slices cost more in writev() than the copy saves,
+                 * gather them at the start of what was just parsed
+                 */
+
+                for (i = 0; i < n; i++) {
+                    if (w != ranges[i].pos) {
+                        ngx_memmove(w, ranges[i].pos,
+                                    ranges[i].last - ranges[i].pos);
+                    }
+
+                    w += ranges[i].last - ranges[i].pos;
                 }
-                break;
-            case strip_state_text_whitespace:
-                switch(*reader) {
-                    case '\r':
-                    case '\n':
-                    case '\t':
-                    case ' ':
-                        continue; // <-- here it is, mod_strip's raison d'etre
-                    case '<':
-                        ctx->state = strip_state_tag;
-                        break;
-                    default:
-                        ctx->state = strip_state_text;
-                        break;
+
+                ranges[0].pos = w - kept;
+                ranges[0].last = w;
+                n = 1;
+            }
+
+            for (i = 0; i < n; i++) {
+                tl = ngx_chain_get_free_buf(r->pool, &ctx->free);
+                if (tl == NULL) {
+                    return NGX_ERROR;
                 }
-            default:
-                break;
+
+                b = tl->buf;
+                ngx_memzero(b, sizeof(ngx_buf_t));
+
+                b->tag = (ngx_buf_tag_t) &ngx_http_strip_filter_module;
+                b->memory = 1;
+                b->pos = ranges[i].pos;
+                b->last = ranges[i].last;
+
+                *ll = tl;
+                ll = &tl->next;
+            }
+
+            ngx_http_strip_check_abort(r, ctx);
+        }
+
+        if (b == NULL) {
+            /* all of it was dropped */
+
+            buf->pos = buf->last;
+
+            if (!buf->last_buf && !buf->last_in_chain && !buf->flush
+                && !buf->sync)
+            {
+                continue;
+            }
+
+            tl = ngx_chain_get_free_buf(r->pool, &ctx->free);
+            if (tl == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = tl->buf;
+            ngx_memzero(b, sizeof(ngx_buf_t));
+
+            b->tag = (ngx_buf_tag_t) &ngx_http_strip_filter_module;
+
+            *ll = tl;
+            ll = &tl->next;
+
+        } else {
+            /* the input is released once its last slice has been sent */
+            b->shadow = buf;
+            b->recycled = buf->recycled;
+        }
+
+        b->last_buf = buf->last_buf;
+        b->last_in_chain = buf->last_in_chain;
+        b->flush = buf->flush;
+        b->sync = buf->sync;
+    }
+
+    *ll = NULL;
+
+    ngx_http_strip_count(ctx, size_in, size_out,
+                         ngx_http_strip_cpu_time(ctx->timed) - start);
+
+    if (ctx->cache_store) {
+        ngx_http_strip_cache_add(r, ctx, out, last);
+    }
+
+    rc = ngx_http_next_body_filter(r, out);
+
+    if (ctx->busy == NULL) {
+        ctx->busy = out;
+
+    } else {
+        for (cl = ctx->busy; cl->next; cl = cl->next) { /* void */ }
+        cl->next = out;
+    }
+
+    while (ctx->busy) {
+
+        cl = ctx->busy;
+        b = cl->buf;
+
+        if (ngx_buf_size(b) != 0) {
+            break;
+        }
+
+        if (b->tag != (ngx_buf_tag_t) &ngx_http_strip_filter_module) {
+            ctx->busy = cl->next;
+            ngx_free_chain(r->pool, cl);
+            continue;
+        }
+
+        if (b->shadow) {
+            b->shadow->pos = b->shadow->last;
+        }
+
+        ctx->busy = cl->next;
+
+        if (ngx_buf_in_memory(b)) {
+            /* add data bufs only to the free buf chain */
+
+            cl->next = ctx->free;
+            ctx->free = cl;
+        }
+    }
+
+    return rc;
+}
+
+static void
+ngx_http_strip_check_abort(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx)
+{
+    if (ctx->aborted || !strip_aborted(&ctx->parser)) {
+        return;
+    }
+
+    ctx->aborted = 1;
+    ctx->cache_store = 0;
+
+    ngx_http_strip_aborts++;
+
+    if (ctx->stats) {
+        (void) ngx_atomic_fetch_add(&ctx->stats->aborts, 1);
+    }
+
+    ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                  "strip: gave up parsing \"%V\", "
+                  "%ui responses aborted by this worker",
+                  &r->uri, ngx_http_strip_aborts);
+}
+
+static void
+ngx_http_strip_count(ngx_http_strip_ctx_t *ctx, size_t in, size_t out,
+    ngx_atomic_uint_t cpu)
+{
+    /* once per buffer, never per byte */
+
+    ctx->bytes_in += in;
+    ctx->bytes_out += out;
+    ctx->cpu += cpu;
+
+    if (ctx->stats == NULL) {
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&ctx->stats->bytes_in, in);
+    (void) ngx_atomic_fetch_add(&ctx->stats->bytes_out, out);
+    (void) ngx_atomic_fetch_add(&ctx->stats->cpu, cpu);
+
+    (void) ngx_atomic_fetch_add(&ctx->stats->window_in, in);
+    (void) ngx_atomic_fetch_add(&ctx->stats->window_out, out);
+}
+
+static ngx_uint_t
+ngx_http_strip_bypass(ngx_http_strip_conf_t *conf)
+{
+    ngx_atomic_uint_t             in, out;
+    ngx_http_strip_stats_node_t  *node;
+
+    node = conf->stats;
+
+    in = node->window_in;
+    out = node->window_out;
+
+    /* whichever worker empties a full window decides for all of them */
+
+    if (in >= NGX_HTTP_STRIP_WINDOW
+        && ngx_atomic_cmp_set(&node->window_in, in, 0))
+    {
+        (void) ngx_atomic_fetch_add(&node->window_out,
+                                    - (ngx_atomic_int_t) out);
+
+        node->bypass = (in * 100 < out * conf->min_ratio);
+    }
+
+    if (!node->bypass) {
+        return 0;
+    }
+
+    /* one in strip_sample responses is stripped still, to notice a change */
+
+    return ngx_atomic_fetch_add(&node->sampled, 1)
+           % (ngx_atomic_uint_t) conf->sample != 0;
+}
+
+/*
+ * Only read for a location with a stats zone or when $strip_time_us is
+ * used in the configuration: two system calls a buffer are not free.
+ */
+
+static ngx_atomic_uint_t
+ngx_http_strip_cpu_time(ngx_uint_t timed)
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec  ts;
+
+    if (!timed) {
+        return 0;
+    }
+
+    /* the calling thread only, so that other requests are not counted */
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1) {
+        return 0;
+    }
+
+    return (ngx_atomic_uint_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+#else
+
+    return 0;
+
+#endif
+}
+
+static ngx_int_t
+ngx_http_strip_bytes_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                *p;
+    ngx_http_strip_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_strip_filter_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%O", *(off_t *) ((char *) ctx + data)) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_strip_ratio_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_uint_t             zint, zfrac;
+    ngx_http_strip_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_strip_filter_module);
+
+    if (ctx == NULL || ctx->bytes_out == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = ngx_pnalloc(r->pool, NGX_INT32_LEN + 3);
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* bytes in per byte out, as $gzip_ratio */
+
+    zint = (ngx_uint_t) (ctx->bytes_in / ctx->bytes_out);
+    zfrac = (ngx_uint_t) ((ctx->bytes_in * 100 / ctx->bytes_out) % 100);
+
+    if ((ctx->bytes_in * 1000 / ctx->bytes_out) % 10 > 4) {
+        zfrac++;
+
+        if (zfrac > 99) {
+            zint++;
+            zfrac = 0;
+        }
+    }
+
+    v->len = ngx_sprintf(v->data, "%ui.%02ui", zint, zfrac) - v->data;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_strip_time_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                *p;
+    ngx_http_strip_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_strip_filter_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%uA", ctx->cpu / 1000) - p;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_strip_aborted_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_strip_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_strip_filter_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = 1;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = (u_char *) (ctx->aborted ? "1" : "0");
+
+    return NGX_OK;
+}
+
+#if (NGX_THREADS)
+
+static ngx_uint_t
+ngx_http_strip_thread_wanted(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    ngx_chain_t            *cl;
+    ngx_http_strip_conf_t  *conf;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
+
+    if (conf->thread_pool == NULL || strip_aborted(&ctx->parser)) {
+        return 0;
+    }
+
+    for (cl = in; cl; cl = cl->next) {
+        if ((size_t) (cl->buf->last - cl->buf->pos) >= conf->thread_threshold) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static ngx_int_t
+ngx_http_strip_body_threads(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    size_t                        size_in, size_out;
+    ngx_int_t                     rc;
+    ngx_buf_t                    *b;
+    ngx_uint_t                    last;
+    ngx_chain_t                  *cl, *out, **ll;
+    ngx_atomic_uint_t             start, cpu;
+    ngx_http_strip_conf_t        *conf;
+    ngx_http_strip_thread_ctx_t  *tctx;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
+
+    if (in && ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    out = NULL;
+    ll = &out;
+    last = 0;
+
+    size_in = 0;
+    size_out = 0;
+    cpu = 0;
+    start = ngx_http_strip_cpu_time(ctx->timed);
+
+    /* bufs leave the queue in order, none overtakes one in a thread */
+
+    while (ctx->in && !ctx->thread_busy) {
+
+        cl = ctx->in;
+        b = cl->buf;
+
+        if (ctx->thread_done) {
+            ctx->thread_done = 0;
+
+            tctx = ctx->thread_task->ctx;
+
+            size_in += b->last - b->pos;
+            size_out += tctx->last - b->pos;
+            cpu += tctx->cpu;
+
+            b->last = tctx->last;
+
+        } else if ((size_t) (b->last - b->pos) >= conf->thread_threshold
+                   && !strip_aborted(&ctx->parser))
+        {
+            if (ngx_http_strip_thread_post(r, ctx, b) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            break;
+
+        } else {
+            size_in += b->last - b->pos;
+            b->last = strip_compact(&ctx->parser, b->pos, b->last);
+            size_out += b->last - b->pos;
+        }
+
+        ngx_http_strip_check_abort(r, ctx);
+
+        ctx->in = cl->next;
+        last |= b->last_buf;
+
+        *ll = ngx_http_strip_link(r, b);
+
+        if (*ll == NGX_CHAIN_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (*ll) {
+            ll = &(*ll)->next;
+        }
+    }
+
+    *ll = NULL;
+
+    ngx_http_strip_count(ctx, size_in, size_out,
+                         cpu + ngx_http_strip_cpu_time(ctx->timed) - start);
+
+    if (ctx->in) {
+        r->buffered |= NGX_HTTP_STRIP_BUFFERED;
+
+    } else {
+        r->buffered &= ~NGX_HTTP_STRIP_BUFFERED;
+    }
+
+    if (ctx->cache_store) {
+        ngx_http_strip_cache_add(r, ctx, out, last);
+    }
+
+    rc = ngx_http_next_body_filter(r, out);
+
+    if (rc == NGX_OK && ctx->in) {
+        return NGX_AGAIN;
+    }
+
+    return rc;
+}
+
+static ngx_int_t
+ngx_http_strip_thread_post(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    ngx_buf_t *b)
+{
+    ngx_thread_task_t            *task;
+    ngx_http_strip_conf_t        *conf;
+    ngx_http_strip_thread_ctx_t  *tctx;
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
+
+    task = ctx->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(r->pool,
+                                     sizeof(ngx_http_strip_thread_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_http_strip_thread_handler;
+
+        ctx->thread_task = task;
+    }
+
+    /* the parser is left to the thread until the event handler runs */
+
+    tctx = task->ctx;
+
+    tctx->parser = &ctx->parser;
+    tctx->pos = b->pos;
+    tctx->last = b->last;
+    tctx->timed = ctx->timed;
+
+    task->event.data = r;
+    task->event.handler = ngx_http_strip_thread_event_handler;
+
+    if (ngx_thread_task_post(conf->thread_pool, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ctx->thread_busy = 1;
+
+    r->main->blocked++;
+    r->aio = 1;
+
+    return NGX_OK;
+}
+
+static void
+ngx_http_strip_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_strip_thread_ctx_t *ctx = data;
+    ngx_atomic_uint_t            start;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "strip thread handler");
+
+    start = ngx_http_strip_cpu_time(ctx->timed);
+
+    ctx->last = strip_compact(ctx->parser, ctx->pos, ctx->last);
+
+    /* the thread's own CPU clock */
+    ctx->cpu = ngx_http_strip_cpu_time(ctx->timed) - start;
+}
+
+static void
+ngx_http_strip_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t      *c;
+    ngx_http_request_t    *r;
+    ngx_http_strip_ctx_t  *ctx;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http strip thread: \"%V?%V\"", &r->uri, &r->args);
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_strip_filter_module);
+
+    ctx->thread_busy = 0;
+    ctx->thread_done = 1;
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    if (r->done) {
+        /*
+         * trigger connection event handler if the subrequest was
+         * already finalized
+         */
+
+        c->write->handler(c->write);
+
+    } else {
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+#endif
+
+static ngx_int_t
+ngx_http_strip_static_handler(ngx_http_request_t *r)
+{
+    u_char                    *p;
+    size_t                     root;
+    time_t                     mtime;
+    ngx_str_t                  path;
+    ngx_int_t                  rc;
+    ngx_uint_t                 level;
+    ngx_log_t                 *log;
+    ngx_buf_t                 *b;
+    ngx_chain_t                out;
+    ngx_open_file_info_t       of;
+    ngx_http_strip_ctx_t      *ctx;
+    ngx_http_strip_conf_t     *conf;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_DECLINED;
+    }
+
+    if (r->uri.data[r->uri.len - 1] == '/') {
+        return NGX_DECLINED;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
+
+    if (!conf->static_enable) {
+        return NGX_DECLINED;
+    }
+
+    log = r->connection->log;
+
+    p = ngx_http_map_uri_to_path(r, &path, &root,
+                                 conf->static_suffix.len);
+    if (p == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    *p = '\0';
+    path.len = p - path.data;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    /* the original must exist, its mtime decides if the copy is current */
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+    of.test_only = 1;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, &path, &of) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
+        != NGX_OK || !of.is_file)
+    {
+        /* leave the error to the static module */
+        return NGX_DECLINED;
+    }
+
+    mtime = of.mtime;
+
+    p = ngx_cpymem(p, conf->static_suffix.data, conf->static_suffix.len);
+    *p = '\0';
+    path.len = p - path.data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http strip static filename: \"%s\"", path.data);
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = clcf->directio;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, &path, &of) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
+        != NGX_OK)
+    {
+        switch (of.err) {
+
+        case 0:
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+        case NGX_ENOENT:
+        case NGX_ENOTDIR:
+        case NGX_ENAMETOOLONG:
+
+            return NGX_DECLINED;
+
+        case NGX_EACCES:
+#if (NGX_HAVE_OPENAT)
+        case NGX_EMLINK:
+        case NGX_ELOOP:
+#endif
+
+            level = NGX_LOG_ERR;
+            break;
+
+        default:
+
+            level = NGX_LOG_CRIT;
+            break;
+        }
+
+        ngx_log_error(level, log, of.err,
+                      "%s \"%s\" failed", of.failed, path.data);
+
+        return NGX_DECLINED;
+    }
+
+    if (!of.is_file || of.mtime < mtime) {
+        /* a stale copy is ignored, the original is stripped on the fly */
+        return NGX_DECLINED;
+    }
+
+    r->root_tested = !r->error_page;
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_strip_ctx_t));
+    if (ctx == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ctx->static_file = 1;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_strip_filter_module);
+
+    log->action = "sending response to client";
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = of.size;
+    r->headers_out.last_modified_time = of.mtime;
+
+    if (ngx_http_set_etag(r) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /* the type comes from the requested name, not from the suffix */
+
+    if (ngx_http_set_content_type(r) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->allow_ranges = 1;
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+    if (b->file == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->file_pos = 0;
+    b->file_last = of.size;
+
+    b->in_file = b->file_last ? 1 : 0;
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+    b->sync = (b->last_buf || b->in_file) ? 0 : 1;
+
+    b->file->fd = of.fd;
+    b->file->name = path;
+    b->file->log = log;
+    b->file->directio = of.is_directio;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+static ngx_int_t
+ngx_http_strip_cache_lookup(ngx_http_request_t *r,
+    ngx_http_strip_conf_t *conf, ngx_http_strip_ctx_t *ctx)
+{
+    size_t                         root;
+    u_char                        *last;
+    uint32_t                       hash;
+    ngx_open_file_info_t           of;
+    ngx_http_core_loc_conf_t      *clcf;
+    ngx_http_strip_cache_t        *cache;
+    ngx_http_strip_cache_node_t   *cn;
+    ngx_http_strip_main_conf_t    *smcf;
+
+    /*
+     * only plain static files qualify: the file that the URI maps to
+     * must be the one whose size and mtime the response advertises
+     */
+
+    if (r->upstream
+        || r->headers_out.status != NGX_HTTP_OK
+        || r->headers_out.content_length_n < 0
+        || r->headers_out.last_modified_time == -1)
+    {
+        return NGX_DECLINED;
+    }
+
+    last = ngx_http_map_uri_to_path(r, &ctx->cache_path, &root, 0);
+    if (last == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ctx->cache_path.len = last - ctx->cache_path.data;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+
+    of.read_ahead = clcf->read_ahead;
+    of.directio = clcf->directio;
+    of.valid = clcf->open_file_cache_valid;
+    of.min_uses = clcf->open_file_cache_min_uses;
+    of.errors = clcf->open_file_cache_errors;
+    of.events = clcf->open_file_cache_events;
+    of.test_only = 1;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, &ctx->cache_path, &of)
+        != NGX_OK)
+    {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_open_cached_file(clcf->open_file_cache, &ctx->cache_path, &of,
+                             r->pool)
+        != NGX_OK)
+    {
+        return NGX_DECLINED;
+    }
+
+    if (!of.is_file
+        || of.size != r->headers_out.content_length_n
+        || of.mtime != r->headers_out.last_modified_time
+        || ctx->cache_path.len > 0xffff)
+    {
+        return NGX_DECLINED;
+    }
+
+    ctx->cache_uniq = of.uniq;
+    ctx->cache_mtime = of.mtime;
+    ctx->cache_size = of.size;
+    ctx->cache_store = ((size_t) of.size <= conf->cache_max_size);
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_strip_filter_module);
+
+    cache = conf->cache_zone->data;
+    hash = ngx_crc32_short(ctx->cache_path.data, ctx->cache_path.len);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_http_strip_cache_find(cache, hash, ctx, smcf->signature);
+
+    if (cn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    if (cn->uniq != ctx->cache_uniq
+        || cn->mtime != ctx->cache_mtime
+        || cn->size != ctx->cache_size)
+    {
+        /* the file has changed since it was stored */
+
+        ngx_queue_remove(&cn->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+        ngx_slab_free_locked(cache->shpool, cn);
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    /* copy out, the entry may be evicted while the response is sent */
+
+    ctx->cache_buf = ngx_create_temp_buf(r->pool, cn->len ? cn->len : 1);
+    if (ctx->cache_buf == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    ctx->cache_buf->last = ngx_cpymem(ctx->cache_buf->pos,
+                                      cn->data + cn->path_len, cn->len);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ctx->cache_hit = 1;
+    ctx->cache_store = 0;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_strip_cache_send(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    ngx_chain_t *in)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl, *out;
+
+    /* the original body is discarded unread */
+
+    b = ctx->cache_buf;
+
+    for (cl = in; cl; cl = cl->next) {
+
+        if (cl->buf->last_buf) {
+            b->last_buf = 1;
+        }
+
+        if (cl->buf->last_in_chain) {
+            b->last_in_chain = 1;
+        }
+
+        cl->buf->pos = cl->buf->last;
+        cl->buf->file_pos = cl->buf->file_last;
+    }
+
+    if (b->last_buf || b->last_in_chain) {
+        out = ngx_alloc_chain_link(r->pool);
+        if (out == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (b->pos == b->last) {
+            /* the stripped body was sent already, or is empty */
+            b->temporary = 0;
+        }
+
+        out->buf = b;
+        out->next = NULL;
+
+        return ngx_http_next_body_filter(r, out);
+    }
+
+    return ngx_http_next_body_filter(r, NULL);
+}
+
+static void
+ngx_http_strip_cache_add(ngx_http_request_t *r, ngx_http_strip_ctx_t *ctx,
+    ngx_chain_t *in, ngx_uint_t last)
+{
+    size_t                  size;
+    ngx_chain_t            *cl;
+    ngx_http_strip_conf_t  *conf;
+
+    if (ctx->cache_buf == NULL) {
+        ctx->cache_buf = ngx_create_temp_buf(r->pool,
+                                             ctx->cache_size ? ctx->cache_size
+                                                             : 1);
+        if (ctx->cache_buf == NULL) {
+            ctx->cache_store = 0;
+            return;
+        }
+    }
+
+    for (cl = in; cl; cl = cl->next) {
+        size = cl->buf->last - cl->buf->pos;
+
+        if (size > (size_t) (ctx->cache_buf->end - ctx->cache_buf->last)) {
+            /* the file grew under us */
+            ctx->cache_store = 0;
+            return;
+        }
+
+        ctx->cache_buf->last = ngx_cpymem(ctx->cache_buf->last,
+                                          cl->buf->pos, size);
+    }
+
+    /* the last buf may have been stripped to nothing and unlinked */
+
+    if (last) {
+        conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
+
+        ngx_http_strip_cache_insert(r, conf, ctx);
+
+        ctx->cache_store = 0;
+    }
+}
+
+static void
+ngx_http_strip_cache_insert(ngx_http_request_t *r, ngx_http_strip_conf_t *conf,
+    ngx_http_strip_ctx_t *ctx)
+{
+    size_t                         n, len;
+    uint32_t                       hash;
+    ngx_queue_t                   *q;
+    ngx_http_strip_cache_t        *cache;
+    ngx_http_strip_cache_node_t   *cn, *old;
+    ngx_http_strip_main_conf_t    *smcf;
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_strip_filter_module);
+
+    cache = conf->cache_zone->data;
+    len = ctx->cache_buf->last - ctx->cache_buf->pos;
+    hash = ngx_crc32_short(ctx->cache_path.data, ctx->cache_path.len);
+
+    n = offsetof(ngx_http_strip_cache_node_t, data)
+        + ctx->cache_path.len + len;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /*
+     * another worker may have stored the same file meanwhile, or an older
+     * copy of it may still be there: the new one takes its place
+     */
+
+    old = ngx_http_strip_cache_find(cache, hash, ctx, smcf->signature);
+
+    if (old) {
+        ngx_queue_remove(&old->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &old->node);
+        ngx_slab_free_locked(cache->shpool, old);
+    }
+
+    for ( ;; ) {
+        cn = ngx_slab_alloc_locked(cache->shpool, n);
+        if (cn) {
+            break;
+        }
+
+        /* evict the least recently used entry and retry */
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                          "strip: \"%V\" does not fit into strip_cache "
+                          "zone \"%V\"",
+                          &ctx->cache_path, &conf->cache_zone->shm.name);
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+        old = ngx_queue_data(q, ngx_http_strip_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->sh->rbtree, &old->node);
+        ngx_slab_free_locked(cache->shpool, old);
+    }
+
+    cn->node.key = hash;
+    cn->uniq = ctx->cache_uniq;
+    cn->mtime = ctx->cache_mtime;
+    cn->size = ctx->cache_size;
+    cn->len = len;
+    cn->path_len = (u_short) ctx->cache_path.len;
+    cn->level = (u_char) ctx->parser.level;
+    cn->syntax = (u_char) ctx->parser.syntax;
+    cn->signature = smcf->signature;
+
+    ngx_memcpy(cn->data, ctx->cache_path.data, ctx->cache_path.len);
+    ngx_memcpy(cn->data + cn->path_len, ctx->cache_buf->pos, len);
+
+    ngx_rbtree_insert(&cache->sh->rbtree, &cn->node);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+/*
+ * A file is stored once per strip level and syntax it is served at, and
+ * per strip_preserve_tags and strip_keep_comments lists: the zone outlives
+ * a reload that changes them.  Called with the zone locked.
+ */
+
+static ngx_http_strip_cache_node_t *
+ngx_http_strip_cache_find(ngx_http_strip_cache_t *cache, uint32_t hash,
+    ngx_http_strip_ctx_t *ctx, uint32_t signature)
+{
+    ngx_int_t                     rc;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_http_strip_cache_node_t  *cn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        cn = (ngx_http_strip_cache_node_t *) node;
+
+        rc = (ngx_int_t) ctx->parser.level - cn->level;
+
+        if (rc == 0) {
+            rc = (ngx_int_t) ctx->parser.syntax - cn->syntax;
+        }
+
+        if (rc == 0 && signature != cn->signature) {
+            rc = (signature < cn->signature) ? -1 : 1;
+        }
+
+        if (rc == 0) {
+            rc = ngx_memn2cmp(ctx->cache_path.data, cn->data,
+                              ctx->cache_path.len, (size_t) cn->path_len);
+        }
+
+        if (rc == 0) {
+            return cn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+static void
+ngx_http_strip_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t            **p;
+    ngx_http_strip_cache_node_t   *cn, *cnt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_http_strip_cache_node_t *) node;
+            cnt = (ngx_http_strip_cache_node_t *) temp;
+
+            if (cn->level != cnt->level) {
+                p = (cn->level < cnt->level) ? &temp->left : &temp->right;
+
+            } else if (cn->syntax != cnt->syntax) {
+                p = (cn->syntax < cnt->syntax) ? &temp->left : &temp->right;
+
+            } else if (cn->signature != cnt->signature) {
+                p = (cn->signature < cnt->signature)
+                    ? &temp->left : &temp->right;
+
+            } else {
+                p = (ngx_memn2cmp(cn->data, cnt->data, cn->path_len,
+                                  cnt->path_len) < 0)
+                    ? &temp->left : &temp->right;
+            }
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+#if (NGX_HTTP_CACHE)
+
+/*
+ * strip_upstream_cache: called by the upstream once the response header
+ * is sent and the cache has decided whether to keep the body.  The body
+ * is then stripped as the pipe reads it, so that it is stripped before it
+ * goes to the temp file that becomes the cache file.
+ */
+
+static ngx_int_t
+ngx_http_strip_upstream_init(void *data)
+{
+    ngx_http_request_t *r = data;
+
+    ngx_int_t              rc;
+    ngx_http_upstream_t   *u;
+    ngx_http_strip_ctx_t  *ctx;
+
+    u = r->upstream;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_strip_filter_module);
+
+    if (ctx->input_filter_init) {
+        rc = ctx->input_filter_init(data);
+
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
+
+    /* not kept after all: the body filter strips the response as usual */
+
+    if (!u->buffering || !u->cacheable || r->cache->vary.len) {
+        return NGX_OK;
+    }
+
+    /* nor when the header cannot take the mark */
+
+    rc = ngx_http_strip_upstream_mark(r, ctx->parser.level,
+                                      ctx->parser.syntax);
+
+    if (rc != NGX_OK) {
+        return (rc == NGX_DECLINED) ? NGX_OK : rc;
+    }
+
+    ctx->pipe_input_filter = u->pipe->input_filter;
+    u->pipe->input_filter = ngx_http_strip_upstream_filter;
+
+    ctx->upstream = 1;
+
+    return NGX_OK;
+}
+
+/*
+ * The mark of a cache file stored stripped is a header line added to the
+ * upstream's response header as the file keeps it, and taken out of the
+ * response again on a hit.  It names the level, syntax and element and
+ * comment lists the body was stripped with, so a hit stripped any other
+ * way is stripped again instead of trusted.
+ */
+
+#define NGX_HTTP_STRIP_MARK  "X-Strip-Cache"
+
+/* "X-Strip-Cache: " level "-" syntax "-" signature CRLF */
+#define NGX_HTTP_STRIP_MARK_LEN                                               \
+    (sizeof(NGX_HTTP_STRIP_MARK ": ") - 1 + NGX_INT_T_LEN * 2 + 2 + 8 + 2)
+
+static ngx_uint_t
+ngx_http_strip_upstream_stripped(ngx_http_request_t *r, ngx_uint_t level,
+    ngx_uint_t syntax)
+{
+    u_char           *p, value[NGX_HTTP_STRIP_MARK_LEN];
+    ngx_uint_t        i, stripped;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *header;
+
+    p = ngx_http_strip_upstream_value(r, level, syntax, value);
+
+    stripped = 0;
+
+    part = &r->headers_out.headers.part;
+    header = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0
+            || header[i].key.len != sizeof(NGX_HTTP_STRIP_MARK) - 1
+            || ngx_strncasecmp(header[i].key.data,
+                               (u_char *) NGX_HTTP_STRIP_MARK,
+                               sizeof(NGX_HTTP_STRIP_MARK) - 1)
+               != 0)
+        {
+            continue;
+        }
+
+        /* never sent, whether it matches or not */
+
+        header[i].hash = 0;
+
+        if (header[i].value.len == (size_t) (p - value)
+            && ngx_memcmp(header[i].value.data, value, p - value) == 0)
+        {
+            stripped = 1;
+        }
+    }
+
+    return stripped;
+}
+
+/*
+ * The header is in the buffer the pipe writes to the cache file first,
+ * after the cache header, as it was read up to the empty line that ends
+ * it, and the line goes before that.  The header of a protocol that is
+ * not made of text lines, such as the records of FastCGI, cannot take it,
+ * nor can one that would no longer fit in the buffer a hit is read into;
+ * those responses are then cached as they are and stripped on the way out.
+ */
+
+static ngx_int_t
+ngx_http_strip_upstream_mark(ngx_http_request_t *r, ngx_uint_t level,
+    ngx_uint_t syntax)
+{
+    u_char                        *start, *end, *p;
+    size_t                         len;
+    ngx_buf_t                     *file, *b;
+    ngx_http_cache_t              *c;
+    ngx_http_upstream_t           *u;
+    ngx_http_file_cache_header_t  *h;
+
+    u = r->upstream;
+    c = r->cache;
+    file = u->pipe->buf_to_file;
+
+    if (file == NULL) {
+        return NGX_DECLINED;
+    }
+
+    start = file->pos + c->header_start;
+    end = file->last;
+
+    if (end - start < 2 || *start < 0x20 || *start == 0x7f
+        || end[-1] != LF)
+    {
+        return NGX_DECLINED;
+    }
+
+    end -= (end[-2] == CR) ? 2 : 1;
+
+    if (end == start || end[-1] != LF) {
+        return NGX_DECLINED;
+    }
+
+    len = NGX_HTTP_STRIP_MARK_LEN;
+
+    if (c->body_start + len > u->conf->buffer_size) {
+        return NGX_DECLINED;
+    }
+
+    b = ngx_create_temp_buf(r->pool, file->last - file->pos + len);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(b->last, file->pos, end - file->pos);
+    p = ngx_cpymem(p, NGX_HTTP_STRIP_MARK ": ",
+                   sizeof(NGX_HTTP_STRIP_MARK ": ") - 1);
+    p = ngx_http_strip_upstream_value(r, level, syntax, p);
+    *p++ = CR; *p++ = LF;
+    p = ngx_cpymem(p, end, file->last - end);
+
+    /* the cache header, written from c before, takes the new length */
+
+    c->body_start += p - b->last - (file->last - file->pos);
+
+    h = (ngx_http_file_cache_header_t *) b->pos;
+    h->body_start = (u_short) c->body_start;
+
+    b->last = p;
+    u->pipe->buf_to_file = b;
+
+    return NGX_OK;
+}
+
+static u_char *
+ngx_http_strip_upstream_value(ngx_http_request_t *r, ngx_uint_t level,
+    ngx_uint_t syntax, u_char *p)
+{
+    ngx_http_strip_main_conf_t  *smcf;
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_strip_filter_module);
+
+    return ngx_sprintf(p, "%ui-%ui-%08xD", level, syntax, smcf->signature);
+}
+
+static ngx_int_t
+ngx_http_strip_upstream_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
+{
+    size_t                 size_in, size_out;
+    ngx_int_t              rc;
+    ngx_buf_t             *b;
+    ngx_chain_t           *cl, **ll;
+    ngx_atomic_uint_t      start;
+    ngx_http_request_t    *r;
+    ngx_http_strip_ctx_t  *ctx;
+
+    r = p->input_ctx;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_strip_filter_module);
+
+    /*
+     * the upstream's filter links bufs pointing into buf at the end of
+     * p->in, after counting them against the response length
+     */
+
+    ll = p->last_in;
+
+    rc = ctx->pipe_input_filter(p, buf);
+
+    if (rc != NGX_OK || strip_aborted(&ctx->parser)) {
+        return rc;
+    }
+
+    size_in = 0;
+    size_out = 0;
+    start = ngx_http_strip_cpu_time(ctx->timed);
+
+    for (cl = *ll; cl && !strip_aborted(&ctx->parser); cl = cl->next) {
+        b = cl->buf;
+
+        size_in += b->last - b->pos;
+        b->last = strip_compact(&ctx->parser, b->pos, b->last);
+        size_out += b->last - b->pos;
+
+        ngx_http_strip_check_abort(r, ctx);
+    }
+
+    ngx_http_strip_count(ctx, size_in, size_out,
+                         ngx_http_strip_cpu_time(ctx->timed) - start);
+
+    return NGX_OK;
+}
+
+#endif
+
+/* the body was stripped as it was read, only emptied bufs are left out */
+
+static ngx_int_t
+ngx_http_strip_body_upstream(ngx_http_request_t *r, ngx_chain_t *in)
+{
+    ngx_chain_t  *cl, *out, **ll;
+
+    out = NULL;
+    ll = &out;
+
+    for (cl = in; cl; cl = cl->next) {
+        *ll = ngx_http_strip_link(r, cl->buf);
+
+        if (*ll == NGX_CHAIN_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (*ll) {
+            ll = &(*ll)->next;
+        }
+    }
+
+    *ll = NULL;
+
+    return ngx_http_next_body_filter(r, out);
+}
+
+static ngx_int_t
+ngx_http_strip_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_strip_cache_t  *ocache = data;
+
+    size_t                   len;
+    ngx_http_strip_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_strip_cache_shctx_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_strip_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in strip_cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in strip_cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_strip_status_handler(ngx_http_request_t *r)
+{
+    u_char                       *p;
+    size_t                        len;
+    ngx_int_t                     rc;
+    ngx_buf_t                    *b;
+    ngx_uint_t                    i, first;
+    ngx_chain_t                   out;
+    ngx_queue_t                  *q;
+    ngx_http_strip_conf_t        *conf;
+    ngx_http_strip_stats_t       *stats;
+    ngx_http_strip_metric_t      *m;
+    ngx_http_strip_main_conf_t   *smcf;
+    ngx_http_strip_stats_node_t  *node;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    conf = ngx_http_get_module_loc_conf(r, ngx_http_strip_filter_module);
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_strip_filter_module);
+
+    if (conf->status_format == NGX_HTTP_STRIP_STATUS_PROMETHEUS) {
+        ngx_str_set(&r->headers_out.content_type,
+                    "text/plain; version=0.0.4");
+    } else {
+        ngx_str_set(&r->headers_out.content_type, "application/json");
+    }
+
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    stats = smcf->stats_zone ? smcf->stats_zone->data : NULL;
+
+    if (stats) {
+        ngx_shmtx_lock(&stats->shpool->mutex);
+    }
+
+    /* the counters keep moving, the list of locations does not */
+
+    len = sizeof("{\"locations\":[]}" CRLF) - 1;
+
+    if (stats) {
+        for (q = ngx_queue_head(&stats->sh->queue);
+             q != ngx_queue_sentinel(&stats->sh->queue);
+             q = ngx_queue_next(q))
+        {
+            node = ngx_queue_data(q, ngx_http_strip_stats_node_t, queue);
+
+            if (conf->status_format == NGX_HTTP_STRIP_STATUS_PROMETHEUS) {
+                len += (sizeof("nginx_strip_{server=\"\",location=\"\","
+                               "reason=\"\"} \n") - 1
+                        + sizeof("cpu_seconds_total") - 1
+                        + sizeof("content_type") - 1
+                        + node->server_len + node->location_len
+                        + ngx_escape_json(NULL, node->data, node->server_len)
+                        + ngx_escape_json(NULL, node->data + node->server_len,
+                                          node->location_len)
+                        + NGX_ATOMIC_T_LEN + sizeof(".000000") - 1)
+                       * (sizeof(ngx_http_strip_metrics)
+                          / sizeof(ngx_http_strip_metric_t));
+
+            } else {
+                len += sizeof("{\"server\":\"\",\"location\":\"\","
+                              "\"requests\":,\"bytes_in\":,\"bytes_out\":,"
+                              "\"aborts\":,\"skipped\":{\"status\":,"
+                              "\"content_type\":,\"encoding\":,"
+                              "\"ratio\":},\"bypassed\":false,"
+                              "\"cpu_seconds\":.000000},") - 1
+                       + node->server_len + node->location_len
+                       + ngx_escape_json(NULL, node->data, node->server_len)
+                       + ngx_escape_json(NULL, node->data + node->server_len,
+                                         node->location_len)
+                       + 9 * NGX_ATOMIC_T_LEN;
+            }
+        }
+    }
+
+    if (conf->status_format == NGX_HTTP_STRIP_STATUS_PROMETHEUS) {
+        for (i = 0; i < sizeof(ngx_http_strip_metrics)
+                        / sizeof(ngx_http_strip_metric_t); i++)
+        {
+            m = &ngx_http_strip_metrics[i];
+
+            if (m->help) {
+                len += sizeof("# HELP nginx_strip_ \n"
+                              "# TYPE nginx_strip_ counter\n") - 1
+                       + 2 * ngx_strlen(m->name) + ngx_strlen(m->help);
+            }
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, len);
+    if (b == NULL) {
+        if (stats) {
+            ngx_shmtx_unlock(&stats->shpool->mutex);
+        }
+
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    p = b->last;
+
+    if (conf->status_format == NGX_HTTP_STRIP_STATUS_PROMETHEUS) {
+
+        /* one family after the other, each with its HELP and TYPE once */
+
+        for (i = 0; stats && i < sizeof(ngx_http_strip_metrics)
+                                 / sizeof(ngx_http_strip_metric_t); i++)
+        {
+            m = &ngx_http_strip_metrics[i];
+
+            if (m->help) {
+                p = ngx_sprintf(p, "# HELP nginx_strip_%s %s\n"
+                                   "# TYPE nginx_strip_%s counter\n",
+                                m->name, m->help, m->name);
+            }
+
+            for (q = ngx_queue_head(&stats->sh->queue);
+                 q != ngx_queue_sentinel(&stats->sh->queue);
+                 q = ngx_queue_next(q))
+            {
+                node = ngx_queue_data(q, ngx_http_strip_stats_node_t, queue);
+
+                p = ngx_sprintf(p, "nginx_strip_%s{server=\"", m->name);
+                p = (u_char *) ngx_escape_json(p, node->data,
+                                               node->server_len);
+                p = ngx_cpymem(p, "\",location=\"",
+                               sizeof("\",location=\"") - 1);
+                p = (u_char *) ngx_escape_json(p,
+                                               node->data + node->server_len,
+                                               node->location_len);
+                *p++ = '"';
+
+                if (m->reason) {
+                    p = ngx_sprintf(p, ",reason=\"%s\"", m->reason);
+                }
+
+                if (m->offset == offsetof(ngx_http_strip_stats_node_t, cpu)) {
+                    p = ngx_sprintf(p, "} %.6f\n",
+                                    (double) node->cpu / 1000000000);
+
+                } else {
+                    p = ngx_sprintf(p, "} %uA\n",
+                                    *(ngx_atomic_t *) ((u_char *) node
+                                                       + m->offset));
+                }
+            }
+        }
+
+    } else {
+        p = ngx_cpymem(p, "{\"locations\":[", sizeof("{\"locations\":[") - 1);
+
+        first = 1;
+
+        for (q = stats ? ngx_queue_head(&stats->sh->queue) : NULL;
+             q && q != ngx_queue_sentinel(&stats->sh->queue);
+             q = ngx_queue_next(q))
+        {
+            node = ngx_queue_data(q, ngx_http_strip_stats_node_t, queue);
+
+            if (!first) {
+                *p++ = ',';
+            }
+
+            first = 0;
+
+            p = ngx_cpymem(p, "{\"server\":\"", sizeof("{\"server\":\"") - 1);
+            p = (u_char *) ngx_escape_json(p, node->data, node->server_len);
+            p = ngx_cpymem(p, "\",\"location\":\"",
+                           sizeof("\",\"location\":\"") - 1);
+            p = (u_char *) ngx_escape_json(p, node->data + node->server_len,
+                                           node->location_len);
+
+            p = ngx_sprintf(p, "\",\"requests\":%uA,\"bytes_in\":%uA,"
+                               "\"bytes_out\":%uA,\"aborts\":%uA,"
+                               "\"skipped\":{\"status\":%uA,"
+                               "\"content_type\":%uA,\"encoding\":%uA,"
+                               "\"ratio\":%uA},\"bypassed\":%s,"
+                               "\"cpu_seconds\":%.6f}",
+                            node->requests, node->bytes_in, node->bytes_out,
+                            node->aborts, node->skipped_status,
+                            node->skipped_type, node->skipped_encoding,
+                            node->skipped_ratio,
+                            node->bypass ? "true" : "false",
+                            (double) node->cpu / 1000000000);
+        }
+
+        p = ngx_cpymem(p, "]}" CRLF, sizeof("]}" CRLF) - 1);
+    }
+
+    if (stats) {
+        ngx_shmtx_unlock(&stats->shpool->mutex);
+    }
+
+    b->last = p;
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+static ngx_int_t
+ngx_http_strip_stats_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_strip_stats_t  *ostats = data;
+
+    size_t                        len;
+    ngx_uint_t                    i;
+    ngx_queue_t                  *q;
+    ngx_http_strip_stats_t       *stats;
+    ngx_http_strip_stats_loc_t   *loc;
+    ngx_http_strip_stats_node_t  *node;
+
+    stats = shm_zone->data;
+
+    if (ostats) {
+        stats->sh = ostats->sh;
+        stats->shpool = ostats->shpool;
+        goto locations;
+    }
+
+    stats->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        stats->sh = stats->shpool->data;
+        goto locations;
+    }
+
+    stats->sh = ngx_slab_alloc(stats->shpool,
+                               sizeof(ngx_http_strip_stats_shctx_t));
+    if (stats->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    stats->shpool->data = stats->sh;
+
+    ngx_queue_init(&stats->sh->queue);
+
+    len = sizeof(" in strip_stats zone \"\"") + shm_zone->shm.name.len;
+
+    stats->shpool->log_ctx = ngx_slab_alloc(stats->shpool, len);
+    if (stats->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(stats->shpool->log_ctx, " in strip_stats zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+locations:
+
+    /*
+     * counters are kept by server and location name, so that they
+     * survive a reload; nodes of locations since removed stay listed
+     */
+
+    loc = stats->smcf->stats_locations.elts;
+
+    ngx_shmtx_lock(&stats->shpool->mutex);
+
+    for (i = 0; i < stats->smcf->stats_locations.nelts; i++) {
+
+        for (q = ngx_queue_head(&stats->sh->queue);
+             q != ngx_queue_sentinel(&stats->sh->queue);
+             q = ngx_queue_next(q))
+        {
+            node = ngx_queue_data(q, ngx_http_strip_stats_node_t, queue);
+
+            if (node->server_len == loc[i].server.len
+                && node->location_len == loc[i].location.len
+                && ngx_memcmp(node->data, loc[i].server.data,
+                              loc[i].server.len) == 0
+                && ngx_memcmp(node->data + node->server_len,
+                              loc[i].location.data, loc[i].location.len) == 0)
+            {
+                goto found;
+            }
+        }
+
+        node = ngx_slab_calloc_locked(stats->shpool,
+                                      offsetof(ngx_http_strip_stats_node_t,
+                                               data)
+                                      + loc[i].server.len
+                                      + loc[i].location.len);
+        if (node == NULL) {
+            ngx_shmtx_unlock(&stats->shpool->mutex);
+            return NGX_ERROR;
+        }
+
+        node->server_len = (u_short) loc[i].server.len;
+        node->location_len = (u_short) loc[i].location.len;
+
+        ngx_memcpy(node->data, loc[i].server.data, loc[i].server.len);
+        ngx_memcpy(node->data + node->server_len, loc[i].location.data,
+                   loc[i].location.len);
+
+        ngx_queue_insert_tail(&stats->sh->queue, &node->queue);
+
+    found:
+
+        loc[i].conf->stats = node;
+    }
+
+    ngx_shmtx_unlock(&stats->shpool->mutex);
+
+    return NGX_OK;
+}
+
+static char *
+ngx_http_strip_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    u_char                  *p;
+    ssize_t                  size;
+    ngx_str_t               *value, name, s;
+    ngx_shm_zone_t          *shm_zone;
+    ngx_http_strip_cache_t  *cache;
+
+    value = cf->args->elts;
+
+    p = (u_char *) ngx_strchr(value[1].data, ':');
+
+    if (p == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid strip_cache_zone \"%V\", "
+                           "must be \"name:size\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[1].data;
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (name.len == 0 || size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid strip_cache_zone \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "strip_cache_zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_strip_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_strip_filter_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate strip_cache_zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_strip_cache_init_zone;
+    shm_zone->data = cache;
+
+    return NGX_CONF_OK;
+}
+
+static char *
+ngx_http_strip_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_THREADS)
+    ngx_http_strip_conf_t *scf = conf;
+
+    ssize_t     size;
+    ngx_str_t  *value;
+
+    if (scf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        scf->thread_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+    scf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (scf->thread_pool == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 3) {
+        size = ngx_parse_size(&value[2]);
+        if (size == NGX_ERROR || size == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid threshold \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        scf->thread_threshold = size;
+    }
+
+    return NGX_CONF_OK;
+
+#else
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"strip_thread_pool\" is unsupported "
+                       "on this platform");
+
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+static char *
+ngx_http_strip_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_strip_conf_t *scf = conf;
+
+    ngx_str_t  *value;
+
+    if (scf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        scf->cache_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    scf->cache_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                            &ngx_http_strip_filter_module);
+    if (scf->cache_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+static char *
+ngx_http_strip_min_ratio(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_strip_conf_t *scf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (scf->min_ratio != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        scf->min_ratio = 0;
+        return NGX_CONF_OK;
+    }
+
+    /* as $strip_ratio: bytes in per byte out, with two decimals */
+
+    n = ngx_atofp(value[1].data, value[1].len, 2);
+
+    if (n == NGX_ERROR || n < 100) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid strip_min_ratio \"%V\", "
+                           "must be \"off\" or at least 1.00", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    scf->min_ratio = n;
+
+    return NGX_CONF_OK;
+}
+
+static char *
+ngx_http_strip_stats_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_strip_main_conf_t *smcf = conf;
+
+    u_char                  *p;
+    ssize_t                  size;
+    ngx_str_t               *value, name, s;
+    ngx_http_strip_stats_t  *stats;
+
+    if (smcf->stats_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    p = (u_char *) ngx_strchr(value[1].data, ':');
+
+    if (p == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid strip_stats_zone \"%V\", "
+                           "must be \"name:size\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.data = value[1].data;
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (name.len == 0 || size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid strip_stats_zone \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "strip_stats_zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    stats = ngx_pcalloc(cf->pool, sizeof(ngx_http_strip_stats_t));
+    if (stats == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    stats->smcf = smcf;
+
+    smcf->stats_zone = ngx_shared_memory_add(cf, &name, size,
+                                             &ngx_http_strip_filter_module);
+    if (smcf->stats_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (smcf->stats_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate strip_stats_zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    smcf->stats_zone->init = ngx_http_strip_stats_init_zone;
+    smcf->stats_zone->data = stats;
+
+    return NGX_CONF_OK;
+}
+
+static char *
+ngx_http_strip_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_strip_conf_t *scf = conf;
+
+    ngx_str_t                 *value;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (scf->status_format) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 1 || ngx_strcmp(value[1].data, "json") == 0) {
+        scf->status_format = NGX_HTTP_STRIP_STATUS_JSON;
+
+    } else if (ngx_strcmp(value[1].data, "prometheus") == 0) {
+        scf->status_format = NGX_HTTP_STRIP_STATUS_PROMETHEUS;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid strip_status format \"%V\", "
+                           "must be \"json\" or \"prometheus\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_strip_status_handler;
+
+    return NGX_CONF_OK;
+}
+
+static char *
+ngx_http_strip_preserve_tags(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_strip_main_conf_t *smcf = conf;
+
+    char        **tag;
+    u_char       *c, ch;
+    ngx_str_t    *value;
+    ngx_uint_t    i, j;
+
+    if (smcf->preserve_tags) {
+        return "is duplicate";
+    }
+
+    smcf->preserve_tags = ngx_array_create(cf->pool, cf->args->nelts - 1,
+                                           sizeof(char *));
+    if (smcf->preserve_tags == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        /* what strip_init_tables() takes, checked here to name the culprit */
+
+        ch = ngx_tolower(value[i].data[0]);
+
+        if (ch < 'a' || ch > 'z') {
+            goto invalid;
+        }
+
+        for (c = value[i].data + 1; *c; c++) {
+            ch = ngx_tolower(*c);
+
+            if ((ch < 'a' || ch > 'z') && (ch < '0' || ch > '9') && ch != '-') {
+                goto invalid;
+            }
+        }
+
+        for (j = 1; j < i; j++) {
+            if (value[j].len == value[i].len
+                && ngx_strncasecmp(value[j].data, value[i].data,
+                                   value[i].len) == 0)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate element \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        tag = ngx_array_push(smcf->preserve_tags);
+        if (tag == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *tag = (char *) value[i].data;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid element name \"%V\"", &value[i]);
+    return NGX_CONF_ERROR;
+}
+
+static char *
+ngx_http_strip_keep_comments(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_strip_main_conf_t *smcf = conf;
+
+    char        **prefix;
+    u_char       *c;
+    ngx_str_t    *value;
+    ngx_uint_t    i;
+
+    if (smcf->keep_comments) {
+        return "is duplicate";
+    }
+
+    smcf->keep_comments = ngx_array_create(cf->pool, cf->args->nelts - 1,
+                                           sizeof(char *));
+    if (smcf->keep_comments == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (value[i].len == 0) {
+            goto invalid;
+        }
+
+        /* what strip_init_tables() takes, checked here to name the culprit */
+
+        for (c = value[i].data; *c; c++) {
+            if (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n'
+                || *c == '-' || *c == '>')
+            {
+                goto invalid;
+            }
+        }
+
+        prefix = ngx_array_push(smcf->keep_comments);
+        if (prefix == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *prefix = (char *) value[i].data;
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid comment prefix \"%V\"", &value[i]);
+    return NGX_CONF_ERROR;
+}
+
+static ngx_int_t
+ngx_http_strip_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t         *var, *v;
+    ngx_http_strip_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_strip_filter_module);
+
+    for (v = ngx_http_strip_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+
+        if (v->get_handler == ngx_http_strip_time_variable) {
+            smcf->time_var = var;
         }
-        *writer++ = *reader;
     }
-    buffer->last = writer;
+
+    return NGX_OK;
 }
 
 static ngx_int_t
 ngx_http_strip_filter_init(ngx_conf_t *cf)
 {
+    char                       **tags, **comments;
+    size_t                       i, ntags, ncomments;
+    ngx_http_handler_pt         *h;
+    ngx_http_core_main_conf_t   *cmcf;
+    ngx_http_strip_main_conf_t  *smcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_CONTENT_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_strip_static_handler;
+
     ngx_http_next_header_filter = ngx_http_top_header_filter;
     ngx_http_top_header_filter = ngx_http_strip_header_filter;
 
     ngx_http_next_body_filter = ngx_http_top_body_filter;
     ngx_http_top_body_filter = ngx_http_strip_body_filter;
 
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_strip_filter_module);
+
+    smcf->signature = 0;
+
+    /*
+     * the shared tables are always built the same, the others belong to
+     * the cycle, so a reload that fails leaves the running one as it was
+     */
+
+    if (smcf->preserve_tags == NULL && smcf->keep_comments == NULL) {
+        strip_init();
+        return NGX_OK;
+    }
+
+    if (smcf->preserve_tags) {
+        tags = smcf->preserve_tags->elts;
+        ntags = smcf->preserve_tags->nelts;
+
+    } else {
+        tags = ngx_http_strip_default_tags;
+        ntags = sizeof(ngx_http_strip_default_tags) / sizeof(char *);
+    }
+
+    if (smcf->keep_comments) {
+        comments = smcf->keep_comments->elts;
+        ncomments = smcf->keep_comments->nelts;
+
+    } else {
+        comments = NULL;
+        ncomments = 0;
+    }
+
+    ngx_crc32_init(smcf->signature);
+
+    for (i = 0; i < ntags; i++) {
+        ngx_crc32_update(&smcf->signature, (u_char *) tags[i],
+                         ngx_strlen(tags[i]) + 1);
+    }
+
+    /* so that a tag moved to the other list counts as a change */
+    ngx_crc32_update(&smcf->signature, (u_char *) "", 1);
+
+    for (i = 0; i < ncomments; i++) {
+        ngx_crc32_update(&smcf->signature, (u_char *) comments[i],
+                         ngx_strlen(comments[i]) + 1);
+    }
+
+    ngx_crc32_final(smcf->signature);
+
+    smcf->tables = ngx_palloc(cf->pool, strip_tables_size());
+    if (smcf->tables == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (strip_init_tables(smcf->tables, tags, ntags, comments, ncomments)
+        == -1)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"strip_preserve_tags\" and "
+                           "\"strip_keep_comments\" take too many states");
+        return NGX_ERROR;
+    }
+
     return NGX_OK;
 }
 
+static void *
+ngx_http_strip_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_strip_main_conf_t  *smcf;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_strip_main_conf_t));
+    if (smcf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&smcf->stats_locations, cf->pool, 4,
+                       sizeof(ngx_http_strip_stats_loc_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return smcf;
+}
+
 static void *
 ngx_http_strip_create_conf(ngx_conf_t *cf) {
     ngx_http_strip_conf_t *conf;
@@ -705,6 +4173,23 @@ ngx_http_strip_create_conf(ngx_conf_t *cf) {
     }
 
     conf->enable = NGX_CONF_UNSET;
+    conf->level = NGX_CONF_UNSET;
+    conf->cache_zone = NGX_CONF_UNSET_PTR;
+    conf->cache_max_size = NGX_CONF_UNSET_SIZE;
+    conf->static_enable = NGX_CONF_UNSET;
+    conf->slices = NGX_CONF_UNSET;
+    conf->slice_min = NGX_CONF_UNSET_SIZE;
+#if (NGX_THREADS)
+    conf->thread_pool = NGX_CONF_UNSET_PTR;
+    conf->thread_threshold = NGX_CONF_UNSET_SIZE;
+#endif
+    conf->gzip = NGX_CONF_UNSET;
+    conf->gzip_comp_level = NGX_CONF_UNSET;
+    conf->min_ratio = NGX_CONF_UNSET_UINT;
+    conf->sample = NGX_CONF_UNSET;
+    conf->buffer_size = NGX_CONF_UNSET_SIZE;
+    conf->coalesce = NGX_CONF_UNSET_SIZE;
+    conf->upstream_cache = NGX_CONF_UNSET;
 
     return conf;
 }
@@ -714,7 +4199,137 @@ ngx_http_strip_merge_conf(ngx_conf_t *cf, void *parent, void *child) {
     ngx_http_strip_conf_t *prev = parent;
     ngx_http_strip_conf_t *conf = child;
 
+    ngx_http_strip_stats_loc_t  *loc;
+    ngx_http_core_srv_conf_t    *cscf;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_strip_main_conf_t  *smcf;
+
     ngx_conf_merge_value(conf->enable, prev->enable, 0);
+    ngx_conf_merge_value(conf->level, prev->level, 1);
+
+    if (ngx_http_merge_types(cf, &conf->types_keys, &conf->types,
+                             &prev->types_keys, &prev->types,
+                             ngx_http_html_default_types)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_merge_types(cf, &conf->xml_types_keys, &conf->xml_types,
+                             &prev->xml_types_keys, &prev->xml_types,
+                             NULL)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_merge_types(cf, &conf->json_types_keys, &conf->json_types,
+                             &prev->json_types_keys, &prev->json_types,
+                             NULL)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+    ngx_conf_merge_ptr_value(conf->cache_zone, prev->cache_zone, NULL);
+    ngx_conf_merge_size_value(conf->cache_max_size, prev->cache_max_size,
+                              1024 * 1024);
+    ngx_conf_merge_value(conf->static_enable, prev->static_enable, 0);
+    ngx_conf_merge_str_value(conf->static_suffix, prev->static_suffix,
+                             ".stripped");
+    ngx_conf_merge_value(conf->slices, prev->slices, 0);
+    ngx_conf_merge_size_value(conf->slice_min, prev->slice_min, 64);
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+    ngx_conf_merge_size_value(conf->thread_threshold, prev->thread_threshold,
+                              32 * 1024);
+#endif
+    ngx_conf_merge_value(conf->gzip, prev->gzip, 0);
+    ngx_conf_merge_value(conf->gzip_comp_level, prev->gzip_comp_level, 1);
+    ngx_conf_merge_uint_value(conf->min_ratio, prev->min_ratio, 0);
+    ngx_conf_merge_value(conf->sample, prev->sample, 20);
+    ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size, 0);
+    ngx_conf_merge_size_value(conf->coalesce, prev->coalesce, 0);
+    ngx_conf_merge_value(conf->upstream_cache, prev->upstream_cache, 0);
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_strip_filter_module);
+
+    if (conf->enable && conf->min_ratio && smcf->stats_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"strip_min_ratio\" requires "
+                           "\"strip_stats_zone\"");
+        return NGX_CONF_ERROR;
+    }
+
+    if (smcf->stats_zone && conf->enable) {
+
+        /* the zone's init hands out the counters once all are known */
+
+        loc = ngx_array_push(&smcf->stats_locations);
+        if (loc == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_core_module);
+        clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+        loc->conf = conf;
+        loc->server = cscf->server_name;
+        loc->location = clcf->name;
+    }
 
     return NGX_CONF_OK;
 }
+
+
+#if (STRIP_PROFILE)
+
+static ngx_int_t
+ngx_http_strip_init_process(ngx_cycle_t *cycle)
+{
+    ngx_event_t  *ev;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    ev = &ngx_http_strip_profile_event;
+
+    ev->handler = ngx_http_strip_profile_handler;
+    ev->log = cycle->log;
+    ev->data = cycle;
+    ev->cancelable = 1;
+
+    ngx_add_timer(ev, NGX_HTTP_STRIP_PROFILE_INTERVAL);
+
+    return NGX_OK;
+}
+
+/* a worker that exits, on reload or shutdown, logs what it counted last */
+
+static void
+ngx_http_strip_exit_process(ngx_cycle_t *cycle)
+{
+    strip_profile_dump(ngx_http_strip_profile_print, cycle->log);
+}
+
+static void
+ngx_http_strip_profile_handler(ngx_event_t *ev)
+{
+    strip_profile_dump(ngx_http_strip_profile_print, ev->log);
+
+    if (!ngx_exiting) {
+        ngx_add_timer(ev, NGX_HTTP_STRIP_PROFILE_INTERVAL);
+    }
+}
+
+static void
+ngx_http_strip_profile_print(void *data, char *line)
+{
+    ngx_log_t  *log = data;
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0, "strip profile: %s", line);
+}
+
+#endif
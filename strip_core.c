@@ -0,0 +1,2882 @@
+/*
+ * Copyright 2008 Evan Miller
+ */
+
+/*
+ * The strip parser, independent of nginx: bytes and a strip_parser_t in,
+ * stripped bytes out.
+ *
+ * The parser is a DFA compiled by strip_init() from the rules in
+ * strip_rules[] into a 256-column transition table.  The names of the
+ * elements whose bodies are kept or minified, script, style and those
+ * given to strip_init_tags(), are matched by a trie of extra states added
+ * to the table at the same time.  There is a table for each strip level
+ * and syntax, HTML, XML or JSON; those of HTML and XML at levels 2 and 3
+ * also edit output already written, see STRIP_MARK.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#if (STRIP_PROFILE)
+#include <stdio.h>
+#endif
+
+#include "strip_core.h"
+
+#if (defined __SSE2__)
+#include <emmintrin.h>
+#define STRIP_SSE2  1
+#endif
+
+/*
+ * AVX2 is not baseline anywhere, so its scans are built for it alone and
+ * picked at run time, see strip_init_tables(); -DSTRIP_AVX2=0 leaves
+ * them out
+ */
+
+#if (!defined STRIP_AVX2 && defined __GNUC__                                  \
+     && (defined __x86_64__ || defined __i386__))
+#include <immintrin.h>
+#define STRIP_AVX2  1
+#endif
+
+typedef enum {
+    strip_state_text = 0,
+    strip_state_text_whitespace,
+    strip_state_tag,
+    strip_state_tag_name,
+    strip_state_tag_whitespace,
+    strip_state_tag_attribute_name,
+    strip_state_tag_attribute_equals,
+    strip_state_tag_attribute_value,
+    strip_state_tag_attribute_value_double_quote,
+    strip_state_tag_attribute_value_single_quote,
+    strip_state_tag_attribute_value_double_quote_start,
+    strip_state_tag_attribute_value_double_quote_bare,
+    strip_state_tag_attribute_value_single_quote_start,
+    strip_state_tag_attribute_value_single_quote_bare,
+    strip_state_tag_attribute_value_bare,
+    strip_state_tag_attribute_name_whitespace,
+    strip_state_end_tag,
+    strip_state_end_tag_name,
+    strip_state_comment,
+    strip_state_comment_dash,
+    strip_state_comment_dash_dash,
+    strip_state_tag_bang,
+    strip_state_tag_bang_dash,
+    strip_state_tag_bang_stuff,
+    strip_state_tag_bang_bracket,
+    strip_state_tag_bang_bracket_c,
+    strip_state_tag_bang_bracket_cd,
+    strip_state_tag_bang_bracket_cda,
+    strip_state_tag_bang_bracket_cdat,
+    strip_state_tag_bang_bracket_cdata,
+    strip_state_cdata,
+    strip_state_cdata_bracket,
+    strip_state_cdata_bracket_bracket,
+    strip_state_pi,
+    strip_state_pi_question,
+    strip_state_script_attribute,
+    strip_state_script_attribute_double_quote,
+    strip_state_script_attribute_single_quote,
+    strip_state_script_attribute_t,
+    strip_state_script_attribute_ty,
+    strip_state_script_attribute_typ,
+    strip_state_script_type,
+    strip_state_script_type_j,
+    strip_state_script_type_ja,
+    strip_state_script_type_jav,
+    strip_state_script_type_javascript,
+    strip_state_js,
+    strip_state_js_operator,
+    strip_state_js_operator_space,
+    strip_state_js_operator_newline,
+    strip_state_js_operand,
+    strip_state_js_operand_space,
+    strip_state_js_operand_newline,
+    strip_state_js_keyword_r,
+    strip_state_js_keyword_re,
+    strip_state_js_keyword_ret,
+    strip_state_js_keyword_retu,
+    strip_state_js_keyword_retur,
+    strip_state_js_keyword_return,
+    strip_state_js_keyword_space,
+    strip_state_js_operand_slash,
+    strip_state_js_angle,
+    strip_state_js_angle_bang,
+    strip_state_js_angle_bang_dash,
+    strip_state_js_double_quote,
+    strip_state_js_double_quote_escape,
+    strip_state_js_double_quote_angle,
+    strip_state_js_single_quote,
+    strip_state_js_single_quote_escape,
+    strip_state_js_single_quote_angle,
+    strip_state_js_template,
+    strip_state_js_template_escape,
+    strip_state_js_template_dollar,
+    strip_state_js_template_angle,
+    strip_state_js_regex_slash,
+    strip_state_js_regex,
+    strip_state_js_regex_escape,
+    strip_state_js_regex_angle,
+    strip_state_js_regex_class,
+    strip_state_js_regex_class_escape,
+    strip_state_js_regex_class_angle,
+    strip_state_js_line_comment,
+    strip_state_js_line_comment_kept,
+    strip_state_js_line_comment_kept_angle,
+    strip_state_js_block_comment,
+    strip_state_js_block_comment_newline,
+    strip_state_js_block_comment_star,
+    strip_state_js_block_comment_kept,
+    strip_state_js_block_comment_kept_star,
+    strip_state_js_block_comment_kept_angle,
+    strip_state_js_raw,
+    strip_state_js_raw_angle,
+    strip_state_script_angle_slash,
+    strip_state_script_angle_slash_s,
+    strip_state_script_angle_slash_sc,
+    strip_state_script_angle_slash_scr,
+    strip_state_script_angle_slash_scri,
+    strip_state_script_angle_slash_scrip,
+    strip_state_script_angle_slash_script,
+    strip_state_style_attribute,
+    strip_state_style_attribute_double_quote,
+    strip_state_style_attribute_single_quote,
+    strip_state_css,
+    strip_state_css_token,
+    strip_state_css_space,
+    strip_state_css_slash,
+    strip_state_css_angle,
+    strip_state_css_comment,
+    strip_state_css_comment_star,
+    strip_state_css_double_quote,
+    strip_state_css_double_quote_escape,
+    strip_state_css_double_quote_angle,
+    strip_state_css_single_quote,
+    strip_state_css_single_quote_escape,
+    strip_state_css_single_quote_angle,
+    strip_state_css_raw,
+    strip_state_css_raw_angle,
+    strip_state_style_angle_slash,
+    strip_state_style_angle_slash_s,
+    strip_state_style_angle_slash_st,
+    strip_state_style_angle_slash_sty,
+    strip_state_style_angle_slash_styl,
+    strip_state_style_angle_slash_style,
+    strip_state_json_string,
+    strip_state_json_escape,
+    strip_state_abort
+} strip_state_e;
+
+#define STRIP_STATES  (strip_state_abort + 1)
+#define STRIP_LEVELS  3
+#define STRIP_SYNTAXES  3
+
+/*
+ * A table entry is the next state and what to do with the byte.  Besides
+ * keeping or dropping it, an entry can edit the output written since the
+ * last STRIP_MARK: STRIP_RETRACT takes all of it back, its own byte
+ * included; STRIP_CUT removes as many bytes from the start of it as the
+ * cuts of the table give for the state left, and moves the mark past
+ * them; STRIP_UNQUOTE removes its first and last bytes, the quotes of an
+ * attribute value.  Edits only reach back within one call, one whose mark
+ * was set in an earlier call is skipped, so the bytes kept on the way to
+ * it must make sense on their own.
+ */
+#define STRIP_DROP     0x8000
+#define STRIP_MARK     0x4000
+#define STRIP_RETRACT  0x2000
+#define STRIP_CUT      0x1000
+#define STRIP_UNQUOTE  0x0800
+#define STRIP_EDIT     (STRIP_MARK|STRIP_RETRACT|STRIP_CUT|STRIP_UNQUOTE)
+#define STRIP_STATE    0x07ff
+
+/*
+ * room for the states strip_init_tags() adds past the fixed ones: a node
+ * per distinct prefix of the tag names, and for each preserved element
+ * its body, "<", "</" and a state per letter of its end tag; those of
+ * JS and CSS comments; then at levels 2 and 3 the comment states and the
+ * optional end tags, or in XML those of xml:space
+ */
+#define STRIP_STATES_MAX  (STRIP_STATES + 1024)
+
+
+#define STRIP_ALPHA  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+#define STRIP_SPACE  " \t\r\n"
+
+/* bytes that an attribute value needs quotes for */
+#define STRIP_QUOTED  STRIP_SPACE "\"'=<>`"
+
+#define STRIP_JS_IDENT  STRIP_ALPHA "0123456789_$"
+
+/* whitespace after these cannot be needed to keep two tokens apart */
+#define STRIP_JS_PUNCT   "{(,;=:[!?&|*%^~>"
+#define STRIP_CSS_PUNCT  "{};:,>("
+
+typedef struct {
+    u_char   state;
+    char    *chars;     /* NULL matches every byte without its own rule */
+    u_char   next;
+    u_char   drop;
+} strip_rule_t;
+
+typedef struct {
+    u_char         level;   /* the lowest strip level using the rule */
+    strip_rule_t   rule;
+    uint16_t       edit;
+} strip_level_rule_t;
+
+typedef struct {
+    u_char   state;
+    u_char   like;
+} strip_like_t;
+
+typedef enum {
+    strip_skip_none = 0,
+    strip_skip_text,
+    strip_skip_char,
+    strip_skip_pair,
+    strip_skip_all,
+    strip_skip_drop
+} strip_skip_e;
+
+typedef struct {
+    u_char   type;
+    u_char   c;
+    u_char   c2;     /* strip_skip_pair */
+} strip_skip_t;
+
+static strip_rule_t  strip_rules[] = {
+
+    { strip_state_text, "\r\n\t", strip_state_text, 1 },
+    { strip_state_text, "<", strip_state_tag, 0 },
+    { strip_state_text, " ", strip_state_text_whitespace, 0 },
+
+    { strip_state_text_whitespace, NULL, strip_state_text, 0 },
+    { strip_state_text_whitespace, "\r\n\t ", strip_state_text_whitespace, 1 },
+    { strip_state_text_whitespace, "<", strip_state_tag, 0 },
+
+    { strip_state_tag, NULL, strip_state_abort, 0 },
+    { strip_state_tag, STRIP_ALPHA, strip_state_tag_name, 0 },
+    { strip_state_tag, "!", strip_state_tag_bang, 0 },
+    { strip_state_tag, "/", strip_state_end_tag, 0 },
+    { strip_state_tag, " ", strip_state_tag, 0 },
+
+    { strip_state_tag_name, ">", strip_state_text, 0 },
+    { strip_state_tag_name, " ", strip_state_tag_whitespace, 0 },
+
+    { strip_state_tag_whitespace, NULL, strip_state_tag_attribute_name, 0 },
+    { strip_state_tag_whitespace, " ", strip_state_tag_whitespace, 1 },
+    { strip_state_tag_whitespace, ">", strip_state_text, 0 },
+
+    { strip_state_tag_attribute_name, "=", strip_state_tag_attribute_equals, 0 },
+    { strip_state_tag_attribute_name, ">", strip_state_text, 0 },
+    { strip_state_tag_attribute_name, " ", strip_state_tag_whitespace, 0 },
+
+    { strip_state_tag_attribute_equals, NULL, strip_state_tag_attribute_value, 0 },
+    { strip_state_tag_attribute_equals, "\"",
+      strip_state_tag_attribute_value_double_quote, 0 },
+    { strip_state_tag_attribute_equals, "'",
+      strip_state_tag_attribute_value_single_quote, 0 },
+
+    { strip_state_tag_attribute_value, ">", strip_state_text, 0 },
+    { strip_state_tag_attribute_value, " ", strip_state_tag_whitespace, 0 },
+
+    { strip_state_tag_attribute_value_double_quote, "\"",
+      strip_state_tag_attribute_value, 0 },
+    { strip_state_tag_attribute_value_single_quote, "'",
+      strip_state_tag_attribute_value, 0 },
+
+    { strip_state_end_tag, NULL, strip_state_end_tag_name, 0 },
+    { strip_state_end_tag, " ", strip_state_end_tag, 1 },
+
+    { strip_state_end_tag_name, ">", strip_state_text, 0 },
+
+    { strip_state_tag_bang, NULL, strip_state_tag_bang_stuff, 0 },
+    { strip_state_tag_bang, "-", strip_state_tag_bang_dash, 0 },
+    { strip_state_tag_bang, "[", strip_state_tag_bang_bracket, 0 },
+
+    { strip_state_tag_bang_stuff, ">", strip_state_text, 0 },
+
+    { strip_state_tag_bang_dash, NULL, strip_state_tag_bang_stuff, 0 },
+    { strip_state_tag_bang_dash, "-", strip_state_comment, 0 },
+
+    { strip_state_comment, "-", strip_state_comment_dash, 0 },
+    { strip_state_comment_dash, NULL, strip_state_comment, 0 },
+    { strip_state_comment_dash, "-", strip_state_comment_dash_dash, 0 },
+    { strip_state_comment_dash_dash, NULL, strip_state_comment, 0 },
+    { strip_state_comment_dash_dash, "-", strip_state_comment_dash_dash, 0 },
+    { strip_state_comment_dash_dash, ">", strip_state_text, 0 },
+
+    { strip_state_tag_bang_bracket, NULL, strip_state_tag_bang_stuff, 0 },
+    { strip_state_tag_bang_bracket, "C", strip_state_tag_bang_bracket_c, 0 },
+    { strip_state_tag_bang_bracket_c, NULL, strip_state_tag_bang_stuff, 0 },
+    { strip_state_tag_bang_bracket_c, "D", strip_state_tag_bang_bracket_cd, 0 },
+    { strip_state_tag_bang_bracket_cd, NULL, strip_state_tag_bang_stuff, 0 },
+    { strip_state_tag_bang_bracket_cd, "A", strip_state_tag_bang_bracket_cda, 0 },
+    { strip_state_tag_bang_bracket_cda, NULL, strip_state_tag_bang_stuff, 0 },
+    { strip_state_tag_bang_bracket_cda, "T",
+      strip_state_tag_bang_bracket_cdat, 0 },
+    { strip_state_tag_bang_bracket_cdat, NULL, strip_state_tag_bang_stuff, 0 },
+    { strip_state_tag_bang_bracket_cdat, "A",
+      strip_state_tag_bang_bracket_cdata, 0 },
+    { strip_state_tag_bang_bracket_cdata, NULL, strip_state_tag_bang_stuff, 0 },
+    { strip_state_tag_bang_bracket_cdata, "[", strip_state_cdata, 0 },
+
+    { strip_state_cdata, "]", strip_state_cdata_bracket, 0 },
+    { strip_state_cdata_bracket, NULL, strip_state_cdata, 0 },
+    { strip_state_cdata_bracket, "]", strip_state_cdata_bracket_bracket, 0 },
+    { strip_state_cdata_bracket_bracket, NULL, strip_state_cdata, 0 },
+    { strip_state_cdata_bracket_bracket, ">", strip_state_text, 0 },
+
+    /* processing instructions, only reached from "<?" in XML */
+
+    { strip_state_pi, "?", strip_state_pi_question, 0 },
+    { strip_state_pi_question, NULL, strip_state_pi, 0 },
+    { strip_state_pi_question, "?", strip_state_pi_question, 0 },
+    { strip_state_pi_question, ">", strip_state_text, 0 },
+
+    /*
+     * <script> and <style>: the body is minified as JS or CSS rather than
+     * stripped as text.  Scripts with a type attribute that does not
+     * mention javascript (templates, JSON) are copied unchanged.
+     */
+
+    { strip_state_script_attribute, ">", strip_state_js, 0 },
+    { strip_state_script_attribute, "\"",
+      strip_state_script_attribute_double_quote, 0 },
+    { strip_state_script_attribute, "'",
+      strip_state_script_attribute_single_quote, 0 },
+    { strip_state_script_attribute, "tT", strip_state_script_attribute_t, 0 },
+    { strip_state_script_attribute_double_quote, "\"",
+      strip_state_script_attribute, 0 },
+    { strip_state_script_attribute_single_quote, "'",
+      strip_state_script_attribute, 0 },
+    { strip_state_script_attribute_t, "yY", strip_state_script_attribute_ty, 0 },
+    { strip_state_script_attribute_ty, "pP",
+      strip_state_script_attribute_typ, 0 },
+    { strip_state_script_attribute_typ, "eE", strip_state_script_type, 0 },
+
+    { strip_state_script_type, ">", strip_state_js_raw, 0 },
+    { strip_state_script_type, "jJ", strip_state_script_type_j, 0 },
+    { strip_state_script_type_j, "aA", strip_state_script_type_ja, 0 },
+    { strip_state_script_type_ja, "vV", strip_state_script_type_jav, 0 },
+    { strip_state_script_type_jav, "aA", strip_state_script_type_javascript, 0 },
+    { strip_state_script_type_javascript, ">", strip_state_js, 0 },
+
+    /*
+     * JS.  Strings, templates and regular expressions are kept as they
+     * are, comments are emptied down to their delimiters, or dropped by
+     * strip_add_script_comments(), and a run of whitespace is cut to its
+     * first byte, keeping a newline if the run has one, so that automatic
+     * semicolon insertion is not affected.  After punctuation that cannot
+     * run into the next token whitespace goes entirely, and a space before
+     * it is cut by strip_level_rules[].  A slash starts a regular
+     * expression unless it follows an operand; "return" counts as an
+     * operator.
+     *
+     * The HTML parser ends a script at the first "</script" even inside
+     * a string or comment, so every state watches for it; after a "</"
+     * that does not end the script the rest of it is copied unchanged.
+     */
+
+    { strip_state_js_operator, NULL, strip_state_js_operand, 0 },
+    { strip_state_js_operator, " \t", strip_state_js_operator_space, 0 },
+    { strip_state_js_operator, "\r\n", strip_state_js_operator_newline, 0 },
+    { strip_state_js_operator, STRIP_JS_PUNCT, strip_state_js, 0 },
+    { strip_state_js_operator, "}+-.", strip_state_js_operator, 0 },
+    { strip_state_js_operator, "r", strip_state_js_keyword_r, 0 },
+    { strip_state_js_operator, "/", strip_state_js_regex_slash, 0 },
+    { strip_state_js_operator, "<", strip_state_js_angle, 0 },
+    { strip_state_js_operator, "\"", strip_state_js_double_quote, 0 },
+    { strip_state_js_operator, "'", strip_state_js_single_quote, 0 },
+    { strip_state_js_operator, "`", strip_state_js_template, 0 },
+
+    { strip_state_js_operator_space, " \t", strip_state_js_operator_space, 1 },
+    { strip_state_js_operator_newline, " \t\r\n",
+      strip_state_js_operator_newline, 1 },
+    { strip_state_js, " \t\r\n", strip_state_js, 1 },
+
+    { strip_state_js_operand, " \t", strip_state_js_operand_space, 0 },
+    { strip_state_js_operand, "\r\n", strip_state_js_operand_newline, 0 },
+    { strip_state_js_operand, "r", strip_state_js_operand, 0 },
+    { strip_state_js_operand, "/", strip_state_js_operand_slash, 0 },
+
+    { strip_state_js_operand_space, " \t", strip_state_js_operand_space, 1 },
+    { strip_state_js_operand_space, "r", strip_state_js_keyword_r, 0 },
+    { strip_state_js_operand_newline, " \t\r\n",
+      strip_state_js_operand_newline, 1 },
+    { strip_state_js_operand_newline, "r", strip_state_js_keyword_r, 0 },
+
+    { strip_state_js_keyword_r, "e", strip_state_js_keyword_re, 0 },
+    { strip_state_js_keyword_re, "t", strip_state_js_keyword_ret, 0 },
+    { strip_state_js_keyword_ret, "u", strip_state_js_keyword_retu, 0 },
+    { strip_state_js_keyword_retu, "r", strip_state_js_keyword_retur, 0 },
+    { strip_state_js_keyword_retur, "n", strip_state_js_keyword_return, 0 },
+    { strip_state_js_keyword_return, STRIP_JS_IDENT, strip_state_js_operand, 0 },
+    { strip_state_js_keyword_return, " \t", strip_state_js_keyword_space, 0 },
+    { strip_state_js_keyword_space, " \t", strip_state_js_keyword_space, 1 },
+    { strip_state_js_keyword_space, "\r\n",
+      strip_state_js_operator_newline, 0 },
+    { strip_state_js_keyword_space, "/", strip_state_js_regex_slash, 0 },
+
+    { strip_state_js_operand_slash, "/", strip_state_js_line_comment, 0 },
+    { strip_state_js_operand_slash, "*", strip_state_js_block_comment, 0 },
+
+    { strip_state_js_angle, "/", strip_state_script_angle_slash, 0 },
+    { strip_state_js_angle, "!", strip_state_js_angle_bang, 0 },
+    { strip_state_js_angle_bang, "-", strip_state_js_angle_bang_dash, 0 },
+    { strip_state_js_angle_bang_dash, "-", strip_state_js_line_comment, 0 },
+
+    { strip_state_js_double_quote, "\"", strip_state_js_operand, 0 },
+    { strip_state_js_double_quote, "\\",
+      strip_state_js_double_quote_escape, 0 },
+    { strip_state_js_double_quote, "<", strip_state_js_double_quote_angle, 0 },
+    { strip_state_js_double_quote_escape, NULL, strip_state_js_double_quote, 0 },
+    { strip_state_js_double_quote_escape, "<",
+      strip_state_js_double_quote_angle, 0 },
+    { strip_state_js_double_quote_angle, "/",
+      strip_state_script_angle_slash, 0 },
+
+    { strip_state_js_single_quote, "'", strip_state_js_operand, 0 },
+    { strip_state_js_single_quote, "\\",
+      strip_state_js_single_quote_escape, 0 },
+    { strip_state_js_single_quote, "<", strip_state_js_single_quote_angle, 0 },
+    { strip_state_js_single_quote_escape, NULL, strip_state_js_single_quote, 0 },
+    { strip_state_js_single_quote_escape, "<",
+      strip_state_js_single_quote_angle, 0 },
+    { strip_state_js_single_quote_angle, "/",
+      strip_state_script_angle_slash, 0 },
+
+    /* substitutions can nest templates, the rest is copied unchanged */
+
+    { strip_state_js_template, "`", strip_state_js_operand, 0 },
+    { strip_state_js_template, "\\", strip_state_js_template_escape, 0 },
+    { strip_state_js_template, "$", strip_state_js_template_dollar, 0 },
+    { strip_state_js_template, "<", strip_state_js_template_angle, 0 },
+    { strip_state_js_template_escape, NULL, strip_state_js_template, 0 },
+    { strip_state_js_template_escape, "<", strip_state_js_template_angle, 0 },
+    { strip_state_js_template_dollar, "{", strip_state_js_raw, 0 },
+    { strip_state_js_template_angle, "/", strip_state_script_angle_slash, 0 },
+
+    { strip_state_js_regex_slash, "/", strip_state_js_line_comment, 0 },
+    { strip_state_js_regex_slash, "*", strip_state_js_block_comment, 0 },
+
+    { strip_state_js_regex, "/", strip_state_js_operand, 0 },
+    { strip_state_js_regex, "\\", strip_state_js_regex_escape, 0 },
+    { strip_state_js_regex, "[", strip_state_js_regex_class, 0 },
+    { strip_state_js_regex, "<", strip_state_js_regex_angle, 0 },
+    { strip_state_js_regex, "\r\n", strip_state_js_operator_newline, 0 },
+    { strip_state_js_regex_escape, NULL, strip_state_js_regex, 0 },
+    { strip_state_js_regex_escape, "<", strip_state_js_regex_angle, 0 },
+    { strip_state_js_regex_angle, "/", strip_state_script_angle_slash, 0 },
+
+    { strip_state_js_regex_class, "]", strip_state_js_regex, 0 },
+    { strip_state_js_regex_class, "\\", strip_state_js_regex_class_escape, 0 },
+    { strip_state_js_regex_class, "<", strip_state_js_regex_class_angle, 0 },
+    { strip_state_js_regex_class, "\r\n", strip_state_js_operator_newline, 0 },
+    { strip_state_js_regex_class_escape, NULL, strip_state_js_regex_class, 0 },
+    { strip_state_js_regex_class_escape, "<",
+      strip_state_js_regex_class_angle, 0 },
+    { strip_state_js_regex_class_angle, "/",
+      strip_state_script_angle_slash, 0 },
+
+    /* a comment with a '<' in it is kept from there on */
+
+    { strip_state_js_line_comment, NULL, strip_state_js_line_comment, 1 },
+    { strip_state_js_line_comment, "\r\n", strip_state_js_operator_newline, 0 },
+    { strip_state_js_line_comment, "<",
+      strip_state_js_line_comment_kept_angle, 0 },
+    { strip_state_js_line_comment_kept, "\r\n",
+      strip_state_js_operator_newline, 0 },
+    { strip_state_js_line_comment_kept, "<",
+      strip_state_js_line_comment_kept_angle, 0 },
+    { strip_state_js_line_comment_kept_angle, "/",
+      strip_state_script_angle_slash, 0 },
+
+    /* a newline in a comment ends a line as far as ASI is concerned */
+
+    { strip_state_js_block_comment, NULL, strip_state_js_block_comment, 1 },
+    { strip_state_js_block_comment, "*", strip_state_js_block_comment_star, 0 },
+    { strip_state_js_block_comment, "\r\n",
+      strip_state_js_block_comment_newline, 0 },
+    { strip_state_js_block_comment, "<",
+      strip_state_js_block_comment_kept_angle, 0 },
+    { strip_state_js_block_comment_newline, "\r\n",
+      strip_state_js_block_comment_newline, 1 },
+    { strip_state_js_block_comment_star, "*",
+      strip_state_js_block_comment_star, 0 },
+    { strip_state_js_block_comment_star, "/", strip_state_js_operator, 0 },
+    { strip_state_js_block_comment_kept, "*",
+      strip_state_js_block_comment_kept_star, 0 },
+    { strip_state_js_block_comment_kept, "<",
+      strip_state_js_block_comment_kept_angle, 0 },
+    { strip_state_js_block_comment_kept_star, "*",
+      strip_state_js_block_comment_kept_star, 0 },
+    { strip_state_js_block_comment_kept_star, "/", strip_state_js_operator, 0 },
+    { strip_state_js_block_comment_kept_angle, "/",
+      strip_state_script_angle_slash, 0 },
+
+    { strip_state_js_raw, "<", strip_state_js_raw_angle, 0 },
+    { strip_state_js_raw_angle, "/", strip_state_script_angle_slash, 0 },
+
+    { strip_state_script_angle_slash, "sS",
+      strip_state_script_angle_slash_s, 0 },
+    { strip_state_script_angle_slash_s, "cC",
+      strip_state_script_angle_slash_sc, 0 },
+    { strip_state_script_angle_slash_sc, "rR",
+      strip_state_script_angle_slash_scr, 0 },
+    { strip_state_script_angle_slash_scr, "iI",
+      strip_state_script_angle_slash_scri, 0 },
+    { strip_state_script_angle_slash_scri, "pP",
+      strip_state_script_angle_slash_scrip, 0 },
+    { strip_state_script_angle_slash_scrip, "tT",
+      strip_state_script_angle_slash_script, 0 },
+    { strip_state_script_angle_slash_script, " \t\r\n/",
+      strip_state_end_tag_name, 0 },
+    { strip_state_script_angle_slash_script, ">", strip_state_text, 0 },
+
+    { strip_state_style_attribute, ">", strip_state_css, 0 },
+    { strip_state_style_attribute, "\"",
+      strip_state_style_attribute_double_quote, 0 },
+    { strip_state_style_attribute, "'",
+      strip_state_style_attribute_single_quote, 0 },
+    { strip_state_style_attribute_double_quote, "\"",
+      strip_state_style_attribute, 0 },
+    { strip_state_style_attribute_single_quote, "'",
+      strip_state_style_attribute, 0 },
+
+    /*
+     * CSS.  Strings are kept, comments are emptied or dropped, whitespace
+     * is cut to one byte, or dropped around punctuation that ends a token;
+     * not before ':' and '(', where a space tells a descendant from a
+     * pseudo-class or a media feature from a function.  A '<'
+     * outside of a comment is rare enough that after one the rest of the
+     * style sheet is copied unchanged.
+     */
+
+    { strip_state_css_token, " \t\r\n", strip_state_css_space, 0 },
+    { strip_state_css_token, STRIP_CSS_PUNCT, strip_state_css, 0 },
+    { strip_state_css_token, "/", strip_state_css_slash, 0 },
+    { strip_state_css_token, "<", strip_state_css_angle, 0 },
+    { strip_state_css_token, "\"", strip_state_css_double_quote, 0 },
+    { strip_state_css_token, "'", strip_state_css_single_quote, 0 },
+
+    { strip_state_css, " \t\r\n", strip_state_css, 1 },
+    { strip_state_css_space, " \t\r\n", strip_state_css_space, 1 },
+    { strip_state_css_slash, "*", strip_state_css_comment, 0 },
+    { strip_state_css_angle, "/", strip_state_style_angle_slash, 0 },
+
+    { strip_state_css_comment, NULL, strip_state_css_comment, 1 },
+    { strip_state_css_comment, "*", strip_state_css_comment_star, 0 },
+    { strip_state_css_comment, "<", strip_state_css_raw_angle, 0 },
+    { strip_state_css_comment_star, "*", strip_state_css_comment_star, 0 },
+    { strip_state_css_comment_star, "/", strip_state_css_token, 0 },
+
+    { strip_state_css_double_quote, "\"", strip_state_css_token, 0 },
+    { strip_state_css_double_quote, "\\",
+      strip_state_css_double_quote_escape, 0 },
+    { strip_state_css_double_quote, "<",
+      strip_state_css_double_quote_angle, 0 },
+    { strip_state_css_double_quote_escape, NULL,
+      strip_state_css_double_quote, 0 },
+    { strip_state_css_double_quote_escape, "<",
+      strip_state_css_double_quote_angle, 0 },
+    { strip_state_css_double_quote_angle, NULL, strip_state_css_raw, 0 },
+    { strip_state_css_double_quote_angle, "<", strip_state_css_raw_angle, 0 },
+    { strip_state_css_double_quote_angle, "/",
+      strip_state_style_angle_slash, 0 },
+
+    { strip_state_css_single_quote, "'", strip_state_css_token, 0 },
+    { strip_state_css_single_quote, "\\",
+      strip_state_css_single_quote_escape, 0 },
+    { strip_state_css_single_quote, "<",
+      strip_state_css_single_quote_angle, 0 },
+    { strip_state_css_single_quote_escape, NULL,
+      strip_state_css_single_quote, 0 },
+    { strip_state_css_single_quote_escape, "<",
+      strip_state_css_single_quote_angle, 0 },
+    { strip_state_css_single_quote_angle, NULL, strip_state_css_raw, 0 },
+    { strip_state_css_single_quote_angle, "<", strip_state_css_raw_angle, 0 },
+    { strip_state_css_single_quote_angle, "/",
+      strip_state_style_angle_slash, 0 },
+
+    { strip_state_css_raw, "<", strip_state_css_raw_angle, 0 },
+    { strip_state_css_raw_angle, "/", strip_state_style_angle_slash, 0 },
+
+    { strip_state_style_angle_slash, "sS", strip_state_style_angle_slash_s, 0 },
+    { strip_state_style_angle_slash_s, "tT",
+      strip_state_style_angle_slash_st, 0 },
+    { strip_state_style_angle_slash_st, "yY",
+      strip_state_style_angle_slash_sty, 0 },
+    { strip_state_style_angle_slash_sty, "lL",
+      strip_state_style_angle_slash_styl, 0 },
+    { strip_state_style_angle_slash_styl, "eE",
+      strip_state_style_angle_slash_style, 0 },
+    { strip_state_style_angle_slash_style, " \t\r\n/",
+      strip_state_end_tag_name, 0 },
+    { strip_state_style_angle_slash_style, ">", strip_state_text, 0 }
+};
+
+/*
+ * rules that only apply from a strip level on, after those of
+ * strip_rules[] for the same state; catch-all rules come first
+ */
+
+static strip_level_rule_t  strip_level_rules[] = {
+
+    /*
+     * JS and CSS, at every level: the space kept after a token is marked,
+     * and cut again when the next byte is punctuation that could not run
+     * into that token, so that "a = b" loses both spaces.  After an
+     * operator the space stays before '+', '-' and '/', which could make
+     * one token with it, "a - -b" or "a / /re/", and after an operand
+     * before a word, a string, '.' or '/'.
+     */
+
+    { 1, { strip_state_js_operand, " \t", strip_state_js_operand_space, 0 },
+           STRIP_MARK },
+    { 1, { strip_state_js_operand_space, STRIP_JS_PUNCT, strip_state_js, 0 },
+           STRIP_CUT },
+    { 1, { strip_state_js_operand_space, ")]", strip_state_js_operand, 0 },
+           STRIP_CUT },
+    { 1, { strip_state_js_operand_space, "}+-", strip_state_js_operator, 0 },
+           STRIP_CUT },
+    { 1, { strip_state_js_operand_space, "<", strip_state_js_angle, 0 },
+           STRIP_CUT },
+
+    { 1, { strip_state_js_operator, " \t", strip_state_js_operator_space, 0 },
+           STRIP_MARK },
+    { 1, { strip_state_js_operator_space, STRIP_JS_IDENT ")]",
+           strip_state_js_operand, 0 }, STRIP_CUT },
+    { 1, { strip_state_js_operator_space, "r", strip_state_js_keyword_r, 0 },
+           STRIP_CUT },
+    { 1, { strip_state_js_operator_space, STRIP_JS_PUNCT, strip_state_js, 0 },
+           STRIP_CUT },
+    { 1, { strip_state_js_operator_space, "}.", strip_state_js_operator, 0 },
+           STRIP_CUT },
+    { 1, { strip_state_js_operator_space, "<", strip_state_js_angle, 0 },
+           STRIP_CUT },
+    { 1, { strip_state_js_operator_space, "\"",
+           strip_state_js_double_quote, 0 }, STRIP_CUT },
+    { 1, { strip_state_js_operator_space, "'",
+           strip_state_js_single_quote, 0 }, STRIP_CUT },
+    { 1, { strip_state_js_operator_space, "`", strip_state_js_template, 0 },
+           STRIP_CUT },
+
+    { 1, { strip_state_js_keyword_return, " \t",
+           strip_state_js_keyword_space, 0 }, STRIP_MARK },
+
+    { 1, { strip_state_css_token, " \t\r\n", strip_state_css_space, 0 },
+           STRIP_MARK },
+    { 1, { strip_state_css_space, "{};,>", strip_state_css, 0 }, STRIP_CUT },
+
+    /*
+     * strip_level 2 marks every tag, so that a comment can be taken back
+     * as a whole once its end is seen; the comment states are added by
+     * strip_add_comments()
+     */
+
+    { 2, { strip_state_text, "<", strip_state_tag, 0 }, STRIP_MARK },
+
+    /*
+     * strip_level 3: whitespace in a tag is any of the four and is cut to
+     * one byte, or to none before '>' and around the '=' of an attribute.
+     * A quoted value that needs no quotes loses them once the byte after
+     * it shows that the value ends there.
+     */
+
+    { 3, { strip_state_tag_name, STRIP_SPACE,
+           strip_state_tag_whitespace, 0 }, STRIP_MARK },
+    { 3, { strip_state_tag_attribute_value, STRIP_SPACE,
+           strip_state_tag_whitespace, 0 }, STRIP_MARK },
+    { 3, { strip_state_tag_whitespace, STRIP_SPACE,
+           strip_state_tag_whitespace, 1 }, 0 },
+    { 3, { strip_state_tag_whitespace, ">", strip_state_text, 0 }, STRIP_CUT },
+
+    { 3, { strip_state_tag_attribute_name, STRIP_SPACE,
+           strip_state_tag_attribute_name_whitespace, 0 }, STRIP_MARK },
+    { 3, { strip_state_tag_attribute_name_whitespace, STRIP_SPACE,
+           strip_state_tag_attribute_name_whitespace, 1 }, 0 },
+    { 3, { strip_state_tag_attribute_name_whitespace, "=",
+           strip_state_tag_attribute_equals, 0 }, STRIP_CUT },
+
+    { 3, { strip_state_tag_attribute_equals, STRIP_SPACE,
+           strip_state_tag_attribute_equals, 1 }, 0 },
+    { 3, { strip_state_tag_attribute_equals, "\"",
+           strip_state_tag_attribute_value_double_quote_start, 0 },
+           STRIP_MARK },
+    { 3, { strip_state_tag_attribute_equals, "'",
+           strip_state_tag_attribute_value_single_quote_start, 0 },
+           STRIP_MARK },
+
+    { 3, { strip_state_tag_attribute_value_double_quote_start, NULL,
+           strip_state_tag_attribute_value_double_quote_bare, 0 }, 0 },
+    { 3, { strip_state_tag_attribute_value_double_quote_start, STRIP_QUOTED,
+           strip_state_tag_attribute_value_double_quote, 0 }, 0 },
+    { 3, { strip_state_tag_attribute_value_double_quote_start, "\"",
+           strip_state_tag_attribute_value, 0 }, 0 },
+    { 3, { strip_state_tag_attribute_value_double_quote_bare, STRIP_QUOTED,
+           strip_state_tag_attribute_value_double_quote, 0 }, 0 },
+    { 3, { strip_state_tag_attribute_value_double_quote_bare, "\"",
+           strip_state_tag_attribute_value_bare, 0 }, 0 },
+
+    { 3, { strip_state_tag_attribute_value_single_quote_start, NULL,
+           strip_state_tag_attribute_value_single_quote_bare, 0 }, 0 },
+    { 3, { strip_state_tag_attribute_value_single_quote_start, STRIP_QUOTED,
+           strip_state_tag_attribute_value_single_quote, 0 }, 0 },
+    { 3, { strip_state_tag_attribute_value_single_quote_start, "'",
+           strip_state_tag_attribute_value, 0 }, 0 },
+    { 3, { strip_state_tag_attribute_value_single_quote_bare, STRIP_QUOTED,
+           strip_state_tag_attribute_value_single_quote, 0 }, 0 },
+    { 3, { strip_state_tag_attribute_value_single_quote_bare, "'",
+           strip_state_tag_attribute_value_bare, 0 }, 0 },
+
+    { 3, { strip_state_tag_attribute_value_bare, NULL,
+           strip_state_tag_attribute_value, 0 }, 0 },
+    { 3, { strip_state_tag_attribute_value_bare, ">", strip_state_text, 0 },
+           STRIP_UNQUOTE },
+    { 3, { strip_state_tag_attribute_value_bare, STRIP_SPACE,
+           strip_state_tag_whitespace, 0 }, STRIP_UNQUOTE|STRIP_MARK }
+};
+
+/*
+ * states whose row starts as a copy of another state's, before their own
+ * rules apply; a state is listed after the one it copies
+ */
+
+static strip_like_t  strip_likes[] = {
+
+    { strip_state_tag_attribute_name_whitespace, strip_state_tag_whitespace },
+
+    { strip_state_script_attribute_t, strip_state_script_attribute },
+    { strip_state_script_attribute_ty, strip_state_script_attribute },
+    { strip_state_script_attribute_typ, strip_state_script_attribute },
+    { strip_state_script_type_j, strip_state_script_type },
+    { strip_state_script_type_ja, strip_state_script_type },
+    { strip_state_script_type_jav, strip_state_script_type },
+
+    { strip_state_js, strip_state_js_operator },
+    { strip_state_js_operator_space, strip_state_js_operator },
+    { strip_state_js_operator_newline, strip_state_js_operator },
+    { strip_state_js_operand, strip_state_js_operator },
+    { strip_state_js_operand_space, strip_state_js_operand },
+    { strip_state_js_keyword_space, strip_state_js_operand_space },
+    { strip_state_js_operand_newline, strip_state_js_operand },
+    { strip_state_js_keyword_r, strip_state_js_operand },
+    { strip_state_js_keyword_re, strip_state_js_operand },
+    { strip_state_js_keyword_ret, strip_state_js_operand },
+    { strip_state_js_keyword_retu, strip_state_js_operand },
+    { strip_state_js_keyword_retur, strip_state_js_operand },
+    { strip_state_js_keyword_return, strip_state_js_operator },
+    { strip_state_js_operand_slash, strip_state_js_operator },
+    { strip_state_js_angle, strip_state_js_operator },
+    { strip_state_js_angle_bang, strip_state_js },
+    { strip_state_js_angle_bang_dash, strip_state_js_operator },
+    { strip_state_js_double_quote_angle, strip_state_js_double_quote },
+    { strip_state_js_single_quote_angle, strip_state_js_single_quote },
+    { strip_state_js_template_dollar, strip_state_js_template },
+    { strip_state_js_template_angle, strip_state_js_template },
+    { strip_state_js_regex_slash, strip_state_js_regex },
+    { strip_state_js_regex_angle, strip_state_js_regex },
+    { strip_state_js_regex_class_angle, strip_state_js_regex_class },
+    { strip_state_js_line_comment_kept_angle, strip_state_js_line_comment_kept },
+    { strip_state_js_block_comment_newline, strip_state_js_block_comment },
+    { strip_state_js_block_comment_star, strip_state_js_block_comment },
+    { strip_state_js_block_comment_kept_star, strip_state_js_block_comment_kept },
+    { strip_state_js_block_comment_kept_angle,
+      strip_state_js_block_comment_kept },
+    { strip_state_js_raw_angle, strip_state_js_raw },
+    { strip_state_script_angle_slash, strip_state_js_raw },
+    { strip_state_script_angle_slash_s, strip_state_js_raw },
+    { strip_state_script_angle_slash_sc, strip_state_js_raw },
+    { strip_state_script_angle_slash_scr, strip_state_js_raw },
+    { strip_state_script_angle_slash_scri, strip_state_js_raw },
+    { strip_state_script_angle_slash_scrip, strip_state_js_raw },
+    { strip_state_script_angle_slash_script, strip_state_js_raw },
+
+    { strip_state_css, strip_state_css_token },
+    { strip_state_css_space, strip_state_css_token },
+    { strip_state_css_slash, strip_state_css_token },
+    { strip_state_css_angle, strip_state_css_token },
+    { strip_state_css_comment_star, strip_state_css_comment },
+    { strip_state_css_raw_angle, strip_state_css_raw },
+    { strip_state_style_angle_slash, strip_state_css_raw },
+    { strip_state_style_angle_slash_s, strip_state_css_raw },
+    { strip_state_style_angle_slash_st, strip_state_css_raw },
+    { strip_state_style_angle_slash_sty, strip_state_css_raw },
+    { strip_state_style_angle_slash_styl, strip_state_css_raw },
+    { strip_state_style_angle_slash_style, strip_state_css_raw }
+};
+
+/*
+ * JSON, with strip_state_text standing for the space between tokens:
+ * whitespace there goes, strings are copied as they are.  There are no
+ * edits, so the table is the same at every strip level.
+ */
+
+static strip_rule_t  strip_json_rules[] = {
+
+    { strip_state_text, STRIP_SPACE, strip_state_text, 1 },
+    { strip_state_text, "\"", strip_state_json_string, 0 },
+
+    { strip_state_json_string, "\"", strip_state_text, 0 },
+    { strip_state_json_string, "\\", strip_state_json_escape, 0 },
+    { strip_state_json_escape, NULL, strip_state_json_string, 0 }
+};
+
+static char  *strip_default_tags[] = { "pre", "textarea" };
+
+/*
+ * strip_level 3 leaves out the end tags of these elements when the next
+ * tag is one of those listed, which would close the element anyway;
+ * those of body and html are always left out.  Whitespace between the
+ * parts of a table is not rendered, so after the end tag of one it goes
+ * and the next tag is looked at all the same.  A list item or a term can
+ * be inline, where a space after its end tag is rendered and would move
+ * into the element if the end tag went, so a space there keeps it.
+ */
+
+typedef struct {
+    char      *name;
+    char      *followers;
+    unsigned   table;
+} strip_optional_t;
+
+static strip_optional_t  strip_optional_tags[] = {
+    { "li", "li /ul /ol /menu", 0 },
+    { "dt", "dt dd", 0 },
+    { "dd", "dd dt /dl", 0 },
+    { "option", "option optgroup hr /select /datalist /optgroup", 0 },
+    { "optgroup", "optgroup hr /select", 0 },
+    { "tr", "tr /tbody /thead /tfoot /table", 1 },
+    { "td", "td th /tr", 1 },
+    { "th", "td th /tr", 1 },
+    { "thead", "tbody tfoot", 1 },
+    { "tbody", "tbody tfoot /table", 1 },
+    { "tfoot", "/table", 1 },
+    { "body", NULL, 0 },
+    { "html", NULL, 0 }
+};
+
+#define STRIP_OPTIONAL_TAGS                                                   \
+    (sizeof(strip_optional_tags) / sizeof(strip_optional_tags[0]))
+
+/* the states strip_add_comment_states() needs besides those of the trie */
+#define STRIP_COMMENT_STATES  9
+
+/* the JS and CSS states that a comment after them is dropped from */
+static u_char  strip_script_comment_states[] = {
+    strip_state_js,
+    strip_state_js_operator_newline,
+    strip_state_js_operand_newline,
+    strip_state_js_operator_space,
+    strip_state_js_operand_space,
+    strip_state_js_keyword_space,
+    strip_state_css,
+    strip_state_css_space
+};
+
+/* the '/', body, '*' and line comment of strip_add_script_comments() */
+#define STRIP_SCRIPT_COMMENT_STATES                                           \
+    (4 * sizeof(strip_script_comment_states))
+
+/*
+ * the elements nested in an xml:space="preserve" element that are
+ * counted to find its end tag; deeper ones are copied all the same
+ */
+#define STRIP_XML_DEPTH  8
+
+/* the tag states that an xml:space attribute has a copy of */
+static u_char  strip_xml_tag_states[] = {
+    strip_state_tag_whitespace,
+    strip_state_tag_attribute_name,
+    strip_state_tag_attribute_name_whitespace,
+    strip_state_tag_attribute_equals,
+    strip_state_tag_attribute_value,
+    strip_state_tag_attribute_value_double_quote,
+    strip_state_tag_attribute_value_single_quote
+};
+
+#define STRIP_XML_TAG_STATES                                                  \
+    (sizeof(strip_xml_tag_states) / sizeof(strip_xml_tag_states[0]))
+
+/* a state in the body of an xml:space="preserve" element, per depth */
+typedef enum {
+    strip_xml_body = 0,
+    strip_xml_angle,
+    strip_xml_tag,
+    strip_xml_tag_slash,
+    strip_xml_tag_double_quote,
+    strip_xml_tag_single_quote,
+    strip_xml_end_tag,
+    strip_xml_bang,
+    strip_xml_bang_stuff,
+    strip_xml_cdata,
+    strip_xml_cdata_bracket,
+    strip_xml_cdata_bracket_bracket,
+    strip_xml_comment,
+    strip_xml_comment_dash,
+    strip_xml_comment_dash_dash,
+    strip_xml_states
+} strip_xml_state_e;
+
+/*
+ * those of strip_add_xml_space(): "xml:space", '=', two quoted
+ * "preserve", the copies of the tag states and "/", and the body
+ */
+#define STRIP_XML_SPACE_STATES                                                \
+    (sizeof("xml:space") - 1 + 1 + 2 * sizeof("\"preserve") - 2              \
+     + STRIP_XML_TAG_STATES + 1 + strip_xml_states * STRIP_XML_DEPTH)
+
+/* the tables, by syntax and strip level */
+
+struct strip_tables_s {
+    uint16_t      machines[STRIP_SYNTAXES][STRIP_LEVELS][STRIP_STATES_MAX][256];
+    strip_skip_t  skips[STRIP_SYNTAXES][STRIP_LEVELS][STRIP_STATES_MAX];
+    u_char        cuts[STRIP_SYNTAXES][STRIP_LEVELS][STRIP_STATES_MAX];
+#if (STRIP_PROFILE)
+    u_char        reasons[STRIP_SYNTAXES][STRIP_LEVELS][STRIP_STATES_MAX];
+#endif
+};
+
+/* those of strip_init() and strip_init_tags() */
+static strip_tables_t  strip_default_tables;
+
+#define strip_parser_tables(parser)                                           \
+    ((parser)->tables ? (parser)->tables : &strip_default_tables)
+
+#if (STRIP_AVX2)
+/* the CPU runs AVX2, set by strip_init_tables() */
+static unsigned  strip_avx2;
+#endif
+
+/* the table being built */
+static strip_tables_t  *strip_tables;
+static uint16_t       (*strip_machine)[256];
+static u_char          *strip_cut;
+static unsigned         strip_level;
+static unsigned         strip_nstates;
+
+#if (STRIP_PROFILE)
+
+/*
+ * STRIP_PROFILE: what the parser does with real input.  Every state has a
+ * reason for the bytes it drops, the fixed ones by where they are in the
+ * enum, or JSON whitespace in JSON, and those past them by the strip_add_
+ * function that made them; the states of one such reason are counted as
+ * one, after strip_state_abort.  Edits are counted by kind, as the bytes
+ * they take back are not known to strip_ranges().
+ */
+
+typedef enum {
+    strip_reason_text = 0,
+    strip_reason_tag,
+    strip_reason_end_tag,
+    strip_reason_markup,
+    strip_reason_script,
+    strip_reason_style,
+    strip_reason_json,
+
+    /* the reasons that states past the fixed ones can have */
+    strip_reason_comment,
+    strip_reason_name,
+    strip_reason_preserved,
+    strip_reason_optional,
+    strip_reason_xml_space,
+    strip_reason_script_comment,
+
+    STRIP_REASONS
+} strip_reason_t;
+
+#define STRIP_PROFILE_STATES                                                  \
+    (STRIP_STATES + STRIP_REASONS - strip_reason_comment)
+
+/* buffers of 0 bytes, of 1, of 2 to 3, ... of 2^22 to 2^23 - 1, and more */
+#define STRIP_PROFILE_SIZES   25
+
+typedef struct {
+    uint64_t   bytes[STRIP_PROFILE_STATES];
+    uint64_t   dropped[STRIP_PROFILE_STATES];
+    uint64_t   transitions[STRIP_PROFILE_STATES][STRIP_PROFILE_STATES];
+    uint64_t   reasons[STRIP_REASONS];
+    uint64_t   retracts;
+    uint64_t   cuts;
+    uint64_t   unquotes;
+    uint64_t   buffers[STRIP_PROFILE_SIZES];
+} strip_profile_t;
+
+static strip_profile_t  strip_profile;
+
+
+/* the row being built, and the reason of the states added next */
+static u_char    *strip_reason;
+static unsigned   strip_reason_next;
+
+static char  *strip_profile_states[STRIP_PROFILE_STATES] = {
+    "text",
+    "text_whitespace",
+    "tag",
+    "tag_name",
+    "tag_whitespace",
+    "tag_attribute_name",
+    "tag_attribute_equals",
+    "tag_attribute_value",
+    "tag_attribute_value_double_quote",
+    "tag_attribute_value_single_quote",
+    "tag_attribute_value_double_quote_start",
+    "tag_attribute_value_double_quote_bare",
+    "tag_attribute_value_single_quote_start",
+    "tag_attribute_value_single_quote_bare",
+    "tag_attribute_value_bare",
+    "tag_attribute_name_whitespace",
+    "end_tag",
+    "end_tag_name",
+    "comment",
+    "comment_dash",
+    "comment_dash_dash",
+    "tag_bang",
+    "tag_bang_dash",
+    "tag_bang_stuff",
+    "tag_bang_bracket",
+    "tag_bang_bracket_c",
+    "tag_bang_bracket_cd",
+    "tag_bang_bracket_cda",
+    "tag_bang_bracket_cdat",
+    "tag_bang_bracket_cdata",
+    "cdata",
+    "cdata_bracket",
+    "cdata_bracket_bracket",
+    "pi",
+    "pi_question",
+    "script_attribute",
+    "script_attribute_double_quote",
+    "script_attribute_single_quote",
+    "script_attribute_t",
+    "script_attribute_ty",
+    "script_attribute_typ",
+    "script_type",
+    "script_type_j",
+    "script_type_ja",
+    "script_type_jav",
+    "script_type_javascript",
+    "js",
+    "js_operator",
+    "js_operator_space",
+    "js_operator_newline",
+    "js_operand",
+    "js_operand_space",
+    "js_operand_newline",
+    "js_keyword_r",
+    "js_keyword_re",
+    "js_keyword_ret",
+    "js_keyword_retu",
+    "js_keyword_retur",
+    "js_keyword_return",
+    "js_keyword_space",
+    "js_operand_slash",
+    "js_angle",
+    "js_angle_bang",
+    "js_angle_bang_dash",
+    "js_double_quote",
+    "js_double_quote_escape",
+    "js_double_quote_angle",
+    "js_single_quote",
+    "js_single_quote_escape",
+    "js_single_quote_angle",
+    "js_template",
+    "js_template_escape",
+    "js_template_dollar",
+    "js_template_angle",
+    "js_regex_slash",
+    "js_regex",
+    "js_regex_escape",
+    "js_regex_angle",
+    "js_regex_class",
+    "js_regex_class_escape",
+    "js_regex_class_angle",
+    "js_line_comment",
+    "js_line_comment_kept",
+    "js_line_comment_kept_angle",
+    "js_block_comment",
+    "js_block_comment_newline",
+    "js_block_comment_star",
+    "js_block_comment_kept",
+    "js_block_comment_kept_star",
+    "js_block_comment_kept_angle",
+    "js_raw",
+    "js_raw_angle",
+    "script_angle_slash",
+    "script_angle_slash_s",
+    "script_angle_slash_sc",
+    "script_angle_slash_scr",
+    "script_angle_slash_scri",
+    "script_angle_slash_scrip",
+    "script_angle_slash_script",
+    "style_attribute",
+    "style_attribute_double_quote",
+    "style_attribute_single_quote",
+    "css",
+    "css_token",
+    "css_space",
+    "css_slash",
+    "css_angle",
+    "css_comment",
+    "css_comment_star",
+    "css_double_quote",
+    "css_double_quote_escape",
+    "css_double_quote_angle",
+    "css_single_quote",
+    "css_single_quote_escape",
+    "css_single_quote_angle",
+    "css_raw",
+    "css_raw_angle",
+    "style_angle_slash",
+    "style_angle_slash_s",
+    "style_angle_slash_st",
+    "style_angle_slash_sty",
+    "style_angle_slash_styl",
+    "style_angle_slash_style",
+    "json_string",
+    "json_escape",
+    "abort",
+    "comment_trie",
+    "name_trie",
+    "preserved_trie",
+    "optional_trie",
+    "xml_space_trie",
+    "script_comment_trie"
+};
+
+static char  *strip_profile_reasons[STRIP_REASONS] = {
+    "text whitespace",
+    "tag whitespace",
+    "end tag whitespace",
+    "declarations, CDATA and processing instructions",
+    "scripts",
+    "styles",
+    "JSON whitespace",
+    "comments",
+    "element names",
+    "preserved elements",
+    "optional end tags",
+    "xml:space",
+    "comments in scripts and styles"
+};
+
+/* the reasons of the fixed states, by the last state of each */
+
+static struct {
+    unsigned         last;
+    strip_reason_t   reason;
+} strip_profile_fixed[] = {
+    { strip_state_text_whitespace, strip_reason_text },
+    { strip_state_tag_attribute_name_whitespace, strip_reason_tag },
+    { strip_state_end_tag_name, strip_reason_end_tag },
+    { strip_state_comment_dash_dash, strip_reason_comment },
+    { strip_state_pi_question, strip_reason_markup },
+    { strip_state_script_angle_slash_script, strip_reason_script },
+    { strip_state_style_angle_slash_style, strip_reason_style },
+    { strip_state_abort, strip_reason_json }
+};
+
+static void strip_profile_level(unsigned syntax, unsigned level);
+static void strip_profile_buffer(size_t size);
+static void strip_profile_bytes(strip_parser_t *parser, unsigned state,
+    size_t n, unsigned drop);
+static void strip_profile_entry(strip_parser_t *parser, unsigned state,
+    uint16_t entry);
+
+#define strip_profile_reason(reason)  strip_reason_next = (reason)
+#define strip_profile_state(state)                                            \
+    strip_reason[state] = (u_char) strip_reason_next
+#define strip_profile_edit(kind)  strip_profile.kind++
+
+#else
+
+#define strip_profile_level(syntax, level)
+#define strip_profile_buffer(size)
+#define strip_profile_bytes(parser, state, n, drop)
+#define strip_profile_entry(parser, state, entry)
+#define strip_profile_reason(reason)
+#define strip_profile_state(state)
+#define strip_profile_edit(kind)
+
+#endif
+
+static void strip_init_level(unsigned syntax, unsigned level, char **tags,
+    size_t ntags, char **comments, size_t ncomments);
+static void strip_init_skips(strip_skip_t *skips, unsigned syntax);
+static void strip_init_xml(void);
+static void strip_init_json(void);
+static void strip_init_row(unsigned state);
+static void strip_set_rule(strip_rule_t *rule, uint16_t edit);
+static void strip_copy_row(unsigned state, unsigned like);
+static unsigned strip_new_state(unsigned like);
+static unsigned strip_add_path(unsigned state, u_char *p, u_char *last,
+    unsigned first);
+static void strip_add_tag(char *name, unsigned open, unsigned close);
+static void strip_add_preserved(char *name);
+static void strip_add_optional(void);
+static void strip_add_xml_space(void);
+static unsigned strip_new_loop(void);
+static void strip_add_comments(char **keep, size_t n);
+static void strip_add_comment_states(unsigned tag, unsigned end, char **keep,
+    size_t n);
+static void strip_add_script_comments(void);
+static u_char *strip_ranges_cut(strip_range_t *ranges, size_t *n, size_t max,
+    u_char **start, u_char *a, u_char *b, size_t *at);
+static u_char *strip_scan(strip_skip_t *skip, u_char *p, u_char *last);
+static u_char *strip_scan_char(u_char *p, u_char *last, u_char c);
+static u_char *strip_scan_pair(u_char *p, u_char *last, u_char c,
+    u_char c2);
+static u_char *strip_scan_text(u_char *p, u_char *last);
+#if (STRIP_AVX2)
+static u_char *strip_scan_pair_avx2(u_char *p, u_char *last, u_char c,
+    u_char c2);
+static u_char *strip_scan_text_avx2(u_char *p, u_char *last);
+#endif
+
+u_char *
+strip_compact(strip_parser_t *parser, u_char *pos, u_char *last)
+{
+    u_char          *reader, *writer, *next, *mark, *cuts;
+    size_t           n;
+    uint16_t         entry;
+    unsigned         state, level;
+    strip_skip_t    *skips;
+    strip_tables_t  *tables;
+    uint16_t       (*machine)[256];
+
+    tables = strip_parser_tables(parser);
+    level = (parser->level > 1) ? parser->level - 1 : 0;
+    machine = tables->machines[parser->syntax][level];
+    skips = tables->skips[parser->syntax][level];
+    cuts = tables->cuts[parser->syntax][level];
+
+    state = parser->state;
+    mark = NULL;
+
+    strip_profile_buffer(last - pos);
+
+    for (writer = pos, reader = pos; reader < last; reader++) {
+
+        switch(skips[state].type) {
+            case strip_skip_none:
+                break;
+            case strip_skip_drop:
+                while (machine[state][*reader] == (state | STRIP_DROP)) {
+                    strip_profile_bytes(parser, state, 1, 1);
+                    if (++reader == last) {
+                        goto done;
+                    }
+                }
+                break;
+            default:
+                next = strip_scan(&skips[state], reader, last);
+                if (next != reader) {
+                    strip_profile_bytes(parser, state, next - reader, 0);
+                    if (writer != reader) {
+                        memmove(writer, reader, next - reader);
+                    }
+                    writer += next - reader;
+                    reader = next;
+                    if (reader == last) {
+                        goto done;
+                    }
+                }
+                break;
+        }
+
+        entry = machine[state][*reader];
+
+        strip_profile_entry(parser, state, entry);
+
+        if (entry & STRIP_EDIT) {
+
+            if (mark && (entry & STRIP_RETRACT)) {
+                strip_profile_edit(retracts);
+                writer = mark;
+                mark = NULL;
+                state = entry & STRIP_STATE;
+                continue;
+            }
+
+            if (mark && (entry & STRIP_CUT)) {
+                strip_profile_edit(cuts);
+                n = cuts[state];
+                memmove(mark, mark + n, writer - mark - n);
+                writer -= n;
+            }
+
+            if (mark && (entry & STRIP_UNQUOTE)) {
+                strip_profile_edit(unquotes);
+                memmove(mark, mark + 1, writer - mark - 2);
+                writer -= 2;
+                mark = NULL;
+            }
+
+            if (entry & STRIP_MARK) {
+                mark = writer;
+            }
+        }
+
+        *writer = *reader;
+        writer += !(entry & STRIP_DROP);
+        state = entry & STRIP_STATE;
+    }
+
+done:
+
+    parser->state = state;
+
+    return writer;
+}
+
+u_char *
+strip_ranges(strip_parser_t *parser, u_char *pos, u_char *last,
+    strip_range_t *ranges, size_t *n)
+{
+    u_char          *reader, *next, *start, *mark, *mark_start, *cuts;
+    size_t           max, mark_n;
+    uint16_t         entry;
+    unsigned         state, level;
+    strip_skip_t    *skips;
+    strip_tables_t  *tables;
+    uint16_t       (*machine)[256];
+
+    tables = strip_parser_tables(parser);
+    level = (parser->level > 1) ? parser->level - 1 : 0;
+    machine = tables->machines[parser->syntax][level];
+    skips = tables->skips[parser->syntax][level];
+    cuts = tables->cuts[parser->syntax][level];
+
+    state = parser->state;
+    max = *n;
+    *n = 0;
+
+    /* where the output stood at the mark, for a retract */
+
+    mark = NULL;
+    mark_start = NULL;
+    mark_n = 0;
+
+    strip_profile_buffer(last - pos);
+
+    for (start = pos, reader = pos; reader < last; reader++) {
+
+        switch(skips[state].type) {
+            case strip_skip_none:
+                break;
+            case strip_skip_drop:
+                if (machine[state][*reader] != (state | STRIP_DROP)) {
+                    break;
+                }
+                if (start < reader) {
+                    ranges[*n].pos = start;
+                    ranges[*n].last = reader;
+                    (*n)++;
+                }
+                do {
+                    strip_profile_bytes(parser, state, 1, 1);
+                    if (++reader == last) {
+                        start = reader;
+                        goto done;
+                    }
+                } while (machine[state][*reader] == (state | STRIP_DROP));
+                start = reader;
+                if (*n == max) {
+                    goto done;
+                }
+                break;
+            default:
+                next = strip_scan(&skips[state], reader, last);
+                strip_profile_bytes(parser, state, next - reader, 0);
+                reader = next;
+                if (reader == last) {
+                    goto done;
+                }
+                break;
+        }
+
+        entry = machine[state][*reader];
+
+        strip_profile_entry(parser, state, entry);
+
+        if (entry & STRIP_EDIT) {
+
+            /* an edit that does not fit is skipped like a lost mark */
+
+            if (mark && (entry & STRIP_RETRACT) && mark_n + 1 < max) {
+                strip_profile_edit(retracts);
+                *n = mark_n;
+                start = mark_start;
+                (void) strip_ranges_cut(ranges, n, max, &start, mark,
+                                        reader + 1, &mark_n);
+                mark = NULL;
+                state = entry & STRIP_STATE;
+                continue;
+            }
+
+            if (mark && (entry & STRIP_CUT)) {
+                strip_profile_edit(cuts);
+                mark = strip_ranges_cut(ranges, n, max, &start, mark,
+                                        mark + cuts[state],
+                                        &mark_n);
+                mark_start = mark;
+            }
+
+            if (mark && (entry & STRIP_UNQUOTE)) {
+                strip_profile_edit(unquotes);
+                if (max - *n > 2) {
+                    (void) strip_ranges_cut(ranges, n, max, &start,
+                                            reader - 1, reader, &mark_n);
+                    (void) strip_ranges_cut(ranges, n, max, &start,
+                                            mark, mark + 1, &mark_n);
+                }
+                mark = NULL;
+            }
+
+            if (entry & STRIP_MARK) {
+                mark = reader;
+                mark_start = start;
+                mark_n = *n;
+            }
+        }
+
+        state = entry & STRIP_STATE;
+
+        if (entry & STRIP_DROP) {
+            if (start < reader) {
+                ranges[*n].pos = start;
+                ranges[*n].last = reader;
+                (*n)++;
+            }
+
+            start = reader + 1;
+
+            if (*n == max) {
+                reader++;
+                goto done;
+            }
+        }
+    }
+
+done:
+
+    /* when the ranges ran out, start == reader and nothing is left */
+
+    if (start < reader) {
+        ranges[*n].pos = start;
+        ranges[*n].last = reader;
+        (*n)++;
+    }
+
+    parser->state = state;
+
+    return reader;
+}
+
+/*
+ * Takes the input from a to b out of the ranges found so far, the *n
+ * closed ones and the one open from *start; a to b lies within one of
+ * them.  Returns where the kept input after b starts, with *at set to the
+ * range that starts there, *n for the open one, or NULL if one more range
+ * does not fit.
+ */
+
+static u_char *
+strip_ranges_cut(strip_range_t *ranges, size_t *n, size_t max,
+    u_char **start, u_char *a, u_char *b, size_t *at)
+{
+    size_t  i;
+
+    if (*start <= a) {
+        if (*start < a) {
+            if (*n + 1 >= max) {
+                return NULL;
+            }
+
+            ranges[*n].pos = *start;
+            ranges[*n].last = a;
+            (*n)++;
+        }
+
+        *start = b;
+        *at = *n;
+
+        return b;
+    }
+
+    for (i = *n; i > 0 && ranges[i - 1].pos > a; i--) { /* void */ }
+
+    if (i == 0 || ranges[i - 1].last < b) {
+        return NULL;
+    }
+
+    i--;
+
+    if (ranges[i].last == b) {
+        if (ranges[i].pos == a) {
+            memmove(&ranges[i], &ranges[i + 1],
+                    (*n - i - 1) * sizeof(strip_range_t));
+            (*n)--;
+
+        } else {
+            ranges[i].last = a;
+            i++;
+        }
+
+        *at = i;
+
+        return (i < *n) ? ranges[i].pos : *start;
+    }
+
+    if (ranges[i].pos != a) {
+        if (*n + 1 >= max) {
+            return NULL;
+        }
+
+        memmove(&ranges[i + 2], &ranges[i + 1],
+                (*n - i - 1) * sizeof(strip_range_t));
+        (*n)++;
+
+        ranges[i + 1].last = ranges[i].last;
+        ranges[i].last = a;
+        i++;
+    }
+
+    ranges[i].pos = b;
+    *at = i;
+
+    return b;
+}
+
+void
+strip_init(void)
+{
+    (void) strip_init_tags(strip_default_tags,
+                           sizeof(strip_default_tags) / sizeof(char *),
+                           NULL, 0);
+}
+
+int
+strip_init_tags(char **tags, size_t ntags, char **comments, size_t ncomments)
+{
+    return strip_init_tables(&strip_default_tables, tags, ntags, comments,
+                             ncomments);
+}
+
+size_t
+strip_tables_size(void)
+{
+    return sizeof(strip_tables_t);
+}
+
+int
+strip_init_tables(strip_tables_t *tables, char **tags, size_t ntags,
+    char **comments, size_t ncomments)
+{
+    size_t     k, states, xml_states;
+    u_char    *c;
+    unsigned   syntax, level;
+
+    /* checked before the tables change, so that they are left as they were */
+
+    states = sizeof("script") - 1 + sizeof("style") - 1;
+
+    /* in XML script and style are preserved, the other names unused */
+
+    xml_states = 2 * (sizeof("script") - 1) + 3 + 2 * (sizeof("style") - 1) + 3
+                 + STRIP_XML_SPACE_STATES;
+
+    for (k = 0; k < ntags; k++) {
+        c = (u_char *) tags[k];
+
+        if (!isalpha(*c)) {
+            return -1;
+        }
+
+        for ( /* void */ ; *c; c++) {
+            if (!isalnum(*c) && *c != '-') {
+                return -1;
+            }
+        }
+
+        states += 2 * (c - (u_char *) tags[k]) + 3;
+    }
+
+    for (k = 0; k < ncomments; k++) {
+        c = (u_char *) comments[k];
+
+        if (*c == '\0') {
+            return -1;
+        }
+
+        for ( /* void */ ; *c; c++) {
+            if (strchr(STRIP_SPACE "->", *c)) {
+                return -1;
+            }
+        }
+
+        states += 2 * (c - (u_char *) comments[k]);
+        xml_states += 2 * (c - (u_char *) comments[k]);
+    }
+
+    states += 2 * STRIP_COMMENT_STATES + 1 + STRIP_SCRIPT_COMMENT_STATES;
+    xml_states += 2 * STRIP_COMMENT_STATES + 1;
+
+    for (k = 0; k < STRIP_OPTIONAL_TAGS; k++) {
+        states += strlen(strip_optional_tags[k].name) + 3;
+
+        if (strip_optional_tags[k].followers) {
+            states += strlen(strip_optional_tags[k].followers);
+        }
+    }
+
+    if (states > STRIP_STATES_MAX - STRIP_STATES
+        || xml_states > STRIP_STATES_MAX - STRIP_STATES)
+    {
+        return -1;
+    }
+
+    strip_tables = tables;
+
+#if (STRIP_AVX2)
+    __builtin_cpu_init();
+    strip_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    for (syntax = 0; syntax < STRIP_SYNTAXES; syntax++) {
+        for (level = 1; level <= STRIP_LEVELS; level++) {
+            strip_init_level(syntax, level, tags, ntags, comments, ncomments);
+        }
+    }
+
+    return 0;
+}
+
+static void
+strip_init_level(unsigned syntax, unsigned level, char **tags, size_t ntags,
+    char **comments, size_t ncomments)
+{
+    size_t         k;
+    unsigned       state, i;
+    strip_like_t  *like, *last;
+
+    strip_machine = strip_tables->machines[syntax][level - 1];
+    strip_cut = strip_tables->cuts[syntax][level - 1];
+    strip_level = level;
+
+    memset(strip_cut, 0, STRIP_STATES_MAX);
+
+    strip_cut[strip_state_tag_whitespace] = 1;
+    strip_cut[strip_state_tag_attribute_name_whitespace] = 1;
+    strip_cut[strip_state_js_operator_space] = 1;
+    strip_cut[strip_state_js_operand_space] = 1;
+    strip_cut[strip_state_js_keyword_space] = 1;
+    strip_cut[strip_state_css_space] = 1;
+
+    for (state = 0; state < STRIP_STATES; state++) {
+        for (i = 0; i < 256; i++) {
+            strip_machine[state][i] = (uint16_t) state;
+        }
+    }
+
+    strip_nstates = STRIP_STATES;
+
+    strip_profile_level(syntax, level);
+
+    if (syntax == STRIP_SYNTAX_JSON) {
+        strip_init_json();
+        strip_init_skips(strip_tables->skips[syntax][level - 1], syntax);
+        return;
+    }
+
+    last = strip_likes + sizeof(strip_likes) / sizeof(strip_like_t);
+
+    for (state = 0; state < STRIP_STATES; state++) {
+        for (like = strip_likes; like < last; like++) {
+            if (like->state == state) {
+                break;
+            }
+        }
+
+        if (like == last) {
+            strip_init_row(state);
+        }
+    }
+
+    for (like = strip_likes; like < last; like++) {
+        strip_copy_row(like->state, like->like);
+        strip_init_row(like->state);
+    }
+
+    if (syntax == STRIP_SYNTAX_XML) {
+        strip_init_xml();
+    }
+
+    /*
+     * element names are matched by a trie of states hung off "<", so that
+     * a tag costs one lookup per byte however many names there are
+     */
+
+    if (syntax == STRIP_SYNTAX_XML) {
+        strip_add_preserved("script");
+        strip_add_preserved("style");
+        strip_add_xml_space();
+
+    } else {
+        strip_add_tag("script", strip_state_script_attribute, strip_state_js);
+        strip_add_tag("style", strip_state_style_attribute, strip_state_css);
+        strip_add_script_comments();
+
+        for (k = 0; k < ntags; k++) {
+            strip_add_preserved(tags[k]);
+        }
+
+        if (level >= 3) {
+            strip_add_optional();
+        }
+    }
+
+    if (level >= 2) {
+        strip_add_comments(comments, ncomments);
+    }
+
+    strip_init_skips(strip_tables->skips[syntax][level - 1], syntax);
+}
+
+/*
+ * States that keep and loop on all but a few bytes can be skipped through
+ * in bulk up to the next byte that leaves them, and runs of bytes that a
+ * state drops while looping need no stores at all.  Text has a scan of
+ * its own, but in JSON strip_state_text is the space between tokens.
+ */
+
+static void
+strip_init_skips(strip_skip_t *skips, unsigned syntax)
+{
+    size_t     k;
+    uint16_t   entry;
+    unsigned   state, i, drop;
+
+    for (state = 0; state < strip_nstates; state++) {
+
+        drop = 0;
+
+        for (k = 0, i = 0; i < 256; i++) {
+            entry = strip_machine[state][i];
+
+            if (entry == (state | STRIP_DROP)) {
+                drop = 1;
+            }
+
+            if (entry != state) {
+                skips[state].c2 = skips[state].c;
+                skips[state].c = (u_char) i;
+                k++;
+            }
+        }
+
+        if (state == strip_state_text && syntax != STRIP_SYNTAX_JSON) {
+            skips[state].type = strip_skip_text;
+
+        } else if (drop) {
+            skips[state].type = strip_skip_drop;
+
+        } else if (k == 0) {
+            skips[state].type = strip_skip_all;
+
+        } else if (k == 1) {
+            skips[state].type = strip_skip_char;
+
+        } else if (k == 2) {
+            skips[state].type = strip_skip_pair;
+
+        } else {
+            skips[state].type = strip_skip_none;
+        }
+    }
+}
+
+/*
+ * What XML changes in the fixed states: "<?" starts a processing
+ * instruction rather than aborting, names may also start with '_', ':'
+ * or a byte past ASCII, and attribute values keep their quotes.
+ */
+
+static void
+strip_init_xml(void)
+{
+    unsigned   i;
+    uint16_t  *equals;
+
+    strip_machine[strip_state_tag]['?'] = strip_state_pi;
+    strip_machine[strip_state_tag]['_'] = strip_state_tag_name;
+    strip_machine[strip_state_tag][':'] = strip_state_tag_name;
+
+    for (i = 0x80; i < 256; i++) {
+        strip_machine[strip_state_tag][i] = strip_state_tag_name;
+    }
+
+    equals = strip_machine[strip_state_tag_attribute_equals];
+
+    equals['"'] = strip_state_tag_attribute_value_double_quote;
+    equals['\''] = strip_state_tag_attribute_value_single_quote;
+}
+
+static void
+strip_init_json(void)
+{
+    size_t  k;
+
+    for (k = 0; k < sizeof(strip_json_rules) / sizeof(strip_rule_t); k++) {
+        strip_set_rule(&strip_json_rules[k], 0);
+    }
+}
+
+static void
+strip_copy_row(unsigned state, unsigned like)
+{
+    memcpy(strip_machine[state], strip_machine[like],
+           sizeof(strip_machine[0]));
+}
+
+/* a state past the fixed ones, its row a copy of like's */
+
+static unsigned
+strip_new_state(unsigned like)
+{
+    unsigned  state;
+
+    state = strip_nstates++;
+
+    strip_copy_row(state, like);
+    strip_profile_state(state);
+
+    return state;
+}
+
+/* a state past the fixed ones that keeps every byte and stays */
+
+static unsigned
+strip_new_loop(void)
+{
+    unsigned  state, i;
+
+    state = strip_nstates++;
+
+    for (i = 0; i < 256; i++) {
+        strip_machine[state][i] = (uint16_t) state;
+    }
+
+    strip_profile_state(state);
+
+    return state;
+}
+
+/*
+ * Follows the bytes from p to last from state, letters in either case,
+ * and gives every state on the way that is not one from first on a copy
+ * of its own, so that the path can be told apart.  Returns where it ends.
+ */
+
+static unsigned
+strip_add_path(unsigned state, u_char *p, u_char *last, unsigned first)
+{
+    uint16_t  entry;
+    unsigned  next;
+
+    for ( /* void */ ; p < last; p++) {
+        entry = strip_machine[state][*p];
+        next = entry & STRIP_STATE;
+
+        if (next < first) {
+            next = strip_new_state(next);
+            entry = (entry & ~STRIP_STATE) | next;
+
+            strip_machine[state][tolower(*p)] = entry;
+            strip_machine[state][toupper(*p)] = entry;
+        }
+
+        state = next;
+    }
+
+    return state;
+}
+
+/*
+ * Adds a tag name to the trie.  Its prefixes read on like any other tag
+ * name; the full name goes to open on whitespace or '/', as attributes
+ * follow, and to close on '>'.
+ */
+
+static void
+strip_add_tag(char *name, unsigned open, unsigned close)
+{
+    u_char    *c;
+    unsigned   state;
+
+    strip_profile_reason(strip_reason_name);
+
+    /* no fixed state is only reached by a name */
+
+    state = strip_add_path(strip_state_tag, (u_char *) name,
+                           (u_char *) name + strlen(name), STRIP_STATES);
+
+    for (c = (u_char *) " \t\r\n/"; *c; c++) {
+        strip_machine[state][*c] = (uint16_t) open;
+    }
+
+    strip_machine[state]['>'] = (uint16_t) close;
+}
+
+/*
+ * Adds an element whose body, attributes included, is copied unchanged
+ * up to its end tag.
+ */
+
+static void
+strip_add_preserved(char *name)
+{
+    u_char    *c;
+    unsigned   body, angle, state, next;
+
+    strip_profile_reason(strip_reason_preserved);
+
+    body = strip_new_loop();
+
+    angle = strip_new_state(body);
+
+    strip_machine[body]['<'] = (uint16_t) angle;
+    strip_machine[angle]['<'] = (uint16_t) angle;
+
+    /* then '/' and the name a byte at a time, others go back to the body */
+
+    state = strip_new_state(body);
+    strip_machine[angle]['/'] = (uint16_t) state;
+
+    for (c = (u_char *) name; *c; c++) {
+        next = strip_new_state(body);
+
+        strip_machine[state][tolower(*c)] = (uint16_t) next;
+        strip_machine[state][toupper(*c)] = (uint16_t) next;
+
+        state = next;
+    }
+
+    strip_machine[state]['>'] = strip_state_text;
+
+    for (c = (u_char *) " \t\r\n/"; *c; c++) {
+        strip_machine[state][*c] = strip_state_end_tag_name;
+    }
+
+    strip_add_tag(name, body, body);
+}
+
+/*
+ * Adds the end tags of strip_optional_tags[].  Once one is written, a
+ * state of its own waits for the next tag, read by a copy of "<" that
+ * cuts the end tag out again when the name is one of those listed.  It
+ * drops the whitespace in between, or outside a table only the bytes that
+ * text drops, a space leading back to text and so keeping the end tag.  A
+ * listed end tag that is optional itself takes over the mark, so that
+ * "</td></tr><tr>" loses both.
+ */
+
+static void
+strip_add_optional(void)
+{
+    char      *name, *followers;
+    u_char    *p, *end, *c;
+    size_t     k, j, len;
+    unsigned   state, slash, first;
+    unsigned   lt[STRIP_OPTIONAL_TAGS], after[STRIP_OPTIONAL_TAGS];
+
+    strip_profile_reason(strip_reason_optional);
+
+    /* copied before the end tags are added, so that those do not chain */
+
+    for (k = 0; k < STRIP_OPTIONAL_TAGS; k++) {
+        if (strip_optional_tags[k].followers) {
+            lt[k] = strip_new_state(strip_state_tag);
+        }
+    }
+
+    first = strip_nstates;
+
+    slash = strip_add_path(strip_state_tag, (u_char *) "/",
+                           (u_char *) "/" + 1, first);
+
+    for (k = 0; k < STRIP_OPTIONAL_TAGS; k++) {
+        name = strip_optional_tags[k].name;
+
+        state = strip_add_path(slash, (u_char *) name,
+                               (u_char *) name + strlen(name), first);
+
+        if (strip_optional_tags[k].followers == NULL) {
+            strip_machine[state]['>'] = strip_state_text | STRIP_RETRACT;
+            continue;
+        }
+
+        after[k] = strip_new_state(strip_state_text);
+
+        for (c = (u_char *) STRIP_SPACE; *c; c++) {
+            if (strip_optional_tags[k].table
+                || (strip_machine[strip_state_text][*c] & STRIP_DROP))
+            {
+                strip_machine[after[k]][*c] = after[k] | STRIP_DROP;
+            }
+        }
+
+        strip_machine[after[k]]['<'] = (uint16_t) lt[k];
+        strip_machine[state]['>'] = (uint16_t) after[k];
+    }
+
+    first = strip_nstates;
+
+    for (k = 0; k < STRIP_OPTIONAL_TAGS; k++) {
+        followers = strip_optional_tags[k].followers;
+
+        if (followers == NULL) {
+            continue;
+        }
+
+        len = strlen(strip_optional_tags[k].name);
+
+        for (p = (u_char *) followers; *p; p = end + (*end == ' ')) {
+            end = p + strcspn((char *) p, " ");
+
+            state = strip_add_path(lt[k], p, end, first);
+
+            for (c = (u_char *) ((*p == '/') ? " \t\r\n>" : " \t\r\n/>");
+                 *c;
+                 c++)
+            {
+                strip_machine[state][*c] |= STRIP_CUT;
+            }
+
+            strip_cut[state] = (u_char) (len + 3);
+
+            if (*p != '/') {
+                continue;
+            }
+
+            for (j = 0; j < STRIP_OPTIONAL_TAGS; j++) {
+                name = strip_optional_tags[j].name;
+
+                if (strip_optional_tags[j].followers
+                    && strlen(name) == (size_t) (end - p - 1)
+                    && strncmp(name, (char *) p + 1, end - p - 1) == 0)
+                {
+                    strip_machine[state]['>'] = after[j] | STRIP_CUT;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * xml:space="preserve", read by a path of states off tag whitespace, moves
+ * the rest of the tag to copies of the tag states whose '>' enters the
+ * body of the element instead of text, unless the tag ends in "/>".  The
+ * body is copied unchanged, with the tags in it counted up to
+ * STRIP_XML_DEPTH deep so that its own end tag leads back to text.
+ */
+
+static void
+strip_add_xml_space(void)
+{
+    u_char     *q;
+    uint16_t    entry, *row;
+    unsigned    i, j, d, state, name, equals, slash, next, first;
+    unsigned   *b, copy[STRIP_STATES];
+    unsigned    body[STRIP_XML_DEPTH][strip_xml_states];
+
+    strip_profile_reason(strip_reason_xml_space);
+
+    for (d = 0; d < STRIP_XML_DEPTH; d++) {
+        for (i = 0; i < strip_xml_states; i++) {
+            body[d][i] = strip_new_loop();
+        }
+    }
+
+    for (d = 0; d < STRIP_XML_DEPTH; d++) {
+        b = body[d];
+
+        strip_machine[b[strip_xml_body]]['<'] = b[strip_xml_angle];
+
+        for (i = 0; i < 256; i++) {
+            strip_machine[b[strip_xml_angle]][i] = b[strip_xml_tag];
+        }
+
+        strip_machine[b[strip_xml_angle]]['/'] = b[strip_xml_end_tag];
+        strip_machine[b[strip_xml_angle]]['!'] = b[strip_xml_bang];
+        strip_machine[b[strip_xml_angle]]['?'] = b[strip_xml_bang_stuff];
+
+        /* a start tag, in the deepest body the tags are no longer counted */
+
+        next = (d + 1 < STRIP_XML_DEPTH) ? body[d + 1][strip_xml_body]
+                                         : b[strip_xml_body];
+
+        strip_machine[b[strip_xml_tag]]['>'] = (uint16_t) next;
+        strip_machine[b[strip_xml_tag]]['"'] = b[strip_xml_tag_double_quote];
+        strip_machine[b[strip_xml_tag]]['\''] = b[strip_xml_tag_single_quote];
+        strip_machine[b[strip_xml_tag]]['/'] = b[strip_xml_tag_slash];
+
+        strip_copy_row(b[strip_xml_tag_slash], b[strip_xml_tag]);
+        strip_machine[b[strip_xml_tag_slash]]['>'] = b[strip_xml_body];
+
+        strip_machine[b[strip_xml_tag_double_quote]]['"'] = b[strip_xml_tag];
+        strip_machine[b[strip_xml_tag_single_quote]]['\''] = b[strip_xml_tag];
+
+        next = d ? body[d - 1][strip_xml_body] : strip_state_text;
+
+        strip_machine[b[strip_xml_end_tag]]['>'] = (uint16_t) next;
+
+        /* "<!" starts a CDATA section, a comment or a declaration */
+
+        strip_machine[b[strip_xml_bang_stuff]]['>'] = b[strip_xml_body];
+
+        strip_copy_row(b[strip_xml_bang], b[strip_xml_bang_stuff]);
+        strip_machine[b[strip_xml_bang]]['['] = b[strip_xml_cdata];
+        strip_machine[b[strip_xml_bang]]['-'] = b[strip_xml_comment];
+
+        strip_machine[b[strip_xml_cdata]][']'] = b[strip_xml_cdata_bracket];
+
+        strip_copy_row(b[strip_xml_cdata_bracket], b[strip_xml_cdata]);
+        strip_machine[b[strip_xml_cdata_bracket]][']'] =
+                                             b[strip_xml_cdata_bracket_bracket];
+
+        strip_copy_row(b[strip_xml_cdata_bracket_bracket],
+                       b[strip_xml_cdata_bracket]);
+        strip_machine[b[strip_xml_cdata_bracket_bracket]]['>'] =
+                                                            b[strip_xml_body];
+
+        strip_machine[b[strip_xml_comment]]['-'] = b[strip_xml_comment_dash];
+
+        strip_copy_row(b[strip_xml_comment_dash], b[strip_xml_comment]);
+        strip_machine[b[strip_xml_comment_dash]]['-'] =
+                                                b[strip_xml_comment_dash_dash];
+
+        strip_copy_row(b[strip_xml_comment_dash_dash],
+                       b[strip_xml_comment_dash]);
+        strip_machine[b[strip_xml_comment_dash_dash]]['>'] = b[strip_xml_body];
+    }
+
+    /* the rest of the tag, in copies of its states with their edits */
+
+    memset(copy, 0, sizeof(copy));
+
+    for (i = 0; i < STRIP_XML_TAG_STATES; i++) {
+        state = strip_xml_tag_states[i];
+        copy[state] = strip_new_state(state);
+        strip_cut[copy[state]] = strip_cut[state];
+    }
+
+    for (i = 0; i < STRIP_XML_TAG_STATES; i++) {
+        state = copy[strip_xml_tag_states[i]];
+
+        for (j = 0; j < 256; j++) {
+            entry = strip_machine[state][j];
+            next = entry & STRIP_STATE;
+
+            if (next == strip_state_text) {
+                next = body[0][strip_xml_body];
+
+            } else if (next < STRIP_STATES && copy[next]) {
+                next = copy[next];
+            }
+
+            strip_machine[state][j] = (entry & ~STRIP_STATE) | next;
+        }
+    }
+
+    /* "/>" ends the element with the tag */
+
+    slash = strip_new_state(copy[strip_state_tag_attribute_name]);
+    strip_machine[slash]['>'] = strip_state_text;
+
+    strip_machine[copy[strip_state_tag_whitespace]]['/'] = (uint16_t) slash;
+    strip_machine[copy[strip_state_tag_attribute_name]]['/'] = (uint16_t) slash;
+    strip_machine[copy[strip_state_tag_attribute_name_whitespace]]['/'] =
+                                                              (uint16_t) slash;
+    strip_machine[copy[strip_state_tag_attribute_value]]['/'] =
+                                                              (uint16_t) slash;
+
+    /* no spaces around the '=', with them the attribute goes unnoticed */
+
+    first = strip_nstates;
+
+    name = strip_add_path(strip_state_tag_whitespace, (u_char *) "xml:space",
+                          (u_char *) "xml:space" + sizeof("xml:space") - 1,
+                          first);
+
+    /* at level 3 it can also follow an attribute without a value */
+
+    next = strip_machine[strip_state_tag_whitespace]['x'] & STRIP_STATE;
+    row = strip_machine[strip_state_tag_attribute_name_whitespace];
+
+    row['x'] = (row['x'] & ~STRIP_STATE) | next;
+    row['X'] = (row['X'] & ~STRIP_STATE) | next;
+
+    equals = strip_new_state(strip_state_tag_attribute_equals);
+    strip_machine[name]['='] = (uint16_t) equals;
+
+    for (q = (u_char *) "\"'"; *q; q++) {
+        next = strip_add_path(equals, q, q + 1, first);
+        next = strip_add_path(next, (u_char *) "preserve",
+                              (u_char *) "preserve" + sizeof("preserve") - 1,
+                              first);
+
+        strip_machine[next][*q] =
+                            (uint16_t) copy[strip_state_tag_attribute_value];
+    }
+}
+
+static void
+strip_add_comments(char **keep, size_t n)
+{
+    unsigned  tag;
+
+    strip_profile_reason(strip_reason_comment);
+
+    strip_add_comment_states(strip_state_tag, strip_state_text, keep, n);
+
+    /* after a space, so that the next whitespace is still cut */
+
+    tag = strip_new_state(strip_state_tag);
+
+    strip_machine[strip_state_text_whitespace]['<'] = tag | STRIP_MARK;
+
+    strip_add_comment_states(tag, strip_state_text_whitespace, keep, n);
+}
+
+/*
+ * Comments from tag on are taken back once their end is seen, and left in
+ * state end.  The body is dropped on the way, "<!--" and dashes are kept
+ * in case the mark is lost and the comment is left as an empty shell.  A
+ * comment that starts with one of the n prefixes in keep, after any
+ * whitespace, is kept whole, as are conditional comments.
+ */
+
+static void
+strip_add_comment_states(unsigned tag, unsigned end, char **keep, size_t n)
+{
+    u_char    *c;
+    size_t     k;
+    unsigned   i, bang, dash, body, body_dash, body_dash_dash, body_bang;
+    unsigned   space, start, start_dash, state, next, first;
+
+    bang = strip_new_state(strip_state_tag_bang);
+    strip_machine[tag]['!'] = (uint16_t) bang;
+
+    dash = strip_new_state(strip_state_tag_bang_dash);
+    strip_machine[bang]['-'] = (uint16_t) dash;
+
+    body = strip_new_state(strip_state_text);
+
+    for (i = 0; i < 256; i++) {
+        strip_machine[body][i] = body | STRIP_DROP;
+    }
+
+    body_dash = strip_new_state(body);
+    strip_machine[body]['-'] = (uint16_t) body_dash;
+
+    body_dash_dash = strip_new_state(body);
+    strip_machine[body_dash]['-'] = (uint16_t) body_dash_dash;
+    strip_machine[body_dash_dash]['-'] = (uint16_t) body_dash_dash;
+    strip_machine[body_dash_dash]['>'] = end | STRIP_RETRACT;
+
+    body_bang = strip_new_state(body);
+    strip_machine[body_dash_dash]['!'] = (uint16_t) body_bang;
+    strip_machine[body_bang]['>'] = end | STRIP_RETRACT;
+
+    space = strip_new_state(body);
+
+    for (c = (u_char *) STRIP_SPACE; *c; c++) {
+        strip_machine[space][*c] = (uint16_t) space;
+    }
+
+    first = strip_nstates;
+
+    for (k = 0; k < n; k++) {
+        state = space;
+
+        for (c = (u_char *) keep[k]; c[1]; c++) {
+            next = strip_machine[state][*c] & STRIP_STATE;
+
+            if (next == strip_state_comment) {
+                break;
+            }
+
+            if (next < first) {
+                next = strip_new_state(body);
+
+                strip_machine[state][tolower(*c)] = (uint16_t) next;
+                strip_machine[state][toupper(*c)] = (uint16_t) next;
+            }
+
+            state = next;
+        }
+
+        if (c[1] == '\0') {
+            strip_machine[state][tolower(*c)] = strip_state_comment;
+            strip_machine[state][toupper(*c)] = strip_state_comment;
+        }
+    }
+
+    start = strip_new_state(space);
+    strip_machine[dash]['-'] = (uint16_t) start;
+    strip_machine[start]['>'] = end | STRIP_RETRACT;
+    strip_machine[start]['['] = strip_state_comment;
+    strip_machine[start]['<'] = strip_state_comment;
+
+    start_dash = strip_new_state(body);
+    strip_machine[start]['-'] = (uint16_t) start_dash;
+    strip_machine[start_dash]['-'] = (uint16_t) body_dash_dash;
+    strip_machine[start_dash]['>'] = end | STRIP_RETRACT;
+}
+
+/*
+ * A JS or CSS comment after whitespace or punctuation is dropped whole:
+ * each state in strip_script_comment_states[] marks a '/' and has comment
+ * states of its own, whose end takes the comment back and goes on in that
+ * state.  A line comment keeps its line break, only its "//" being cut
+ * after a space.  A block comment with a line break after a space is
+ * emptied instead, as the break may end a statement; so is one right
+ * after a token, which it may keep apart from the next, and one whose
+ * mark is lost.
+ */
+
+static void
+strip_add_script_comments(void)
+{
+    size_t     k;
+    unsigned   state, slash, body, star, line, css, spaced, i;
+
+    strip_profile_reason(strip_reason_script_comment);
+
+    for (k = 0; k < sizeof(strip_script_comment_states); k++) {
+        state = strip_script_comment_states[k];
+
+        css = (state == strip_state_css || state == strip_state_css_space);
+        spaced = (state == strip_state_js_operator_space
+                  || state == strip_state_js_operand_space
+                  || state == strip_state_js_keyword_space);
+
+        slash = strip_new_state(strip_machine[state]['/'] & STRIP_STATE);
+        strip_machine[state]['/'] = slash | STRIP_MARK;
+
+        body = strip_new_state(css ? strip_state_css_comment
+                                   : strip_state_js_block_comment);
+        strip_machine[slash]['*'] = (uint16_t) body;
+
+        /* the copy loops on itself rather than going on in the original */
+
+        for (i = 0; i < 256; i++) {
+            if (strip_machine[body][i] & STRIP_DROP) {
+                strip_machine[body][i] = body | STRIP_DROP;
+            }
+        }
+
+        if (!css && !spaced) {
+            strip_machine[body]['\r'] = body | STRIP_DROP;
+            strip_machine[body]['\n'] = body | STRIP_DROP;
+        }
+
+        star = strip_new_state(body);
+        strip_machine[body]['*'] = (uint16_t) star;
+        strip_machine[star]['*'] = star | STRIP_DROP;
+        strip_machine[star]['/'] = state | STRIP_RETRACT;
+
+        if (css) {
+            continue;
+        }
+
+        line = strip_new_state(strip_state_js_line_comment);
+        strip_machine[slash]['/'] = (uint16_t) line;
+
+        for (i = 0; i < 256; i++) {
+            if (strip_machine[line][i] & STRIP_DROP) {
+                strip_machine[line][i] = line | STRIP_DROP;
+            }
+        }
+
+        if (spaced) {
+            strip_cut[line] = 2;
+            strip_machine[line]['\r'] =
+                                  strip_state_js_operator_newline | STRIP_CUT;
+            strip_machine[line]['\n'] =
+                                  strip_state_js_operator_newline | STRIP_CUT;
+
+        } else {
+            strip_machine[line]['\r'] = state | STRIP_RETRACT;
+            strip_machine[line]['\n'] = state | STRIP_RETRACT;
+        }
+    }
+}
+
+static void
+strip_init_row(unsigned state)
+{
+    strip_rule_t        *rule, *end;
+    strip_level_rule_t  *lrule, *lend;
+
+    end = strip_rules + sizeof(strip_rules) / sizeof(strip_rule_t);
+
+    /* catch-all rules first, so that rules for single bytes override them */
+
+    for (rule = strip_rules; rule < end; rule++) {
+        if (rule->state == state && rule->chars == NULL) {
+            strip_set_rule(rule, 0);
+        }
+    }
+
+    for (rule = strip_rules; rule < end; rule++) {
+        if (rule->state == state && rule->chars != NULL) {
+            strip_set_rule(rule, 0);
+        }
+    }
+
+    lend = strip_level_rules
+           + sizeof(strip_level_rules) / sizeof(strip_level_rule_t);
+
+    for (lrule = strip_level_rules; lrule < lend; lrule++) {
+        if (lrule->rule.state == state && lrule->level <= strip_level) {
+            strip_set_rule(&lrule->rule, lrule->edit);
+        }
+    }
+}
+
+static void
+strip_set_rule(strip_rule_t *rule, uint16_t edit)
+{
+    u_char    *c;
+    unsigned   i;
+    uint16_t   entry;
+
+    entry = rule->next | (rule->drop ? STRIP_DROP : 0) | edit;
+
+    if (rule->chars == NULL) {
+        for (i = 0; i < 256; i++) {
+            strip_machine[rule->state][i] = entry;
+        }
+
+        return;
+    }
+
+    for (c = (u_char *) rule->chars; *c; c++) {
+        strip_machine[rule->state][*c] = entry;
+    }
+}
+
+static u_char *
+strip_scan(strip_skip_t *skip, u_char *p, u_char *last)
+{
+    switch(skip->type) {
+        case strip_skip_text:
+            return strip_scan_text(p, last);
+        case strip_skip_char:
+            return strip_scan_char(p, last, skip->c);
+        case strip_skip_pair:
+            return strip_scan_pair(p, last, skip->c, skip->c2);
+        case strip_skip_all:
+            return last;
+        default:
+            return p;
+    }
+}
+
+static u_char *
+strip_scan_char(u_char *p, u_char *last, u_char c)
+{
+    u_char  *end;
+
+    /* most runs are short, don't pay for a call to find them */
+
+    end = (last - p > 16) ? p + 16 : last;
+
+    for ( /* void */ ; p < end; p++) {
+        if (*p == c) {
+            return p;
+        }
+    }
+
+    if (p == last) {
+        return p;
+    }
+
+    p = memchr(p, c, last - p);
+
+    return p ? p : last;
+}
+
+/* JSON strings and other states left on either of two bytes */
+
+static u_char *
+strip_scan_pair(u_char *p, u_char *last, u_char c, u_char c2)
+{
+    u_char   *end;
+#if (STRIP_SSE2)
+    int       mask;
+    __m128i   v, a, b;
+#endif
+
+    end = (last - p > 16) ? p + 16 : last;
+
+    for ( /* void */ ; p < end; p++) {
+        if (*p == c || *p == c2) {
+            return p;
+        }
+    }
+
+#if (STRIP_AVX2)
+    if (strip_avx2) {
+        p = strip_scan_pair_avx2(p, last, c, c2);
+    }
+#endif
+
+#if (STRIP_SSE2)
+    a = _mm_set1_epi8((char) c);
+    b = _mm_set1_epi8((char) c2);
+
+    for ( /* void */ ; last - p >= 16; p += 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, a),
+                                              _mm_cmpeq_epi8(v, b)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for ( /* void */ ; p < last; p++) {
+        if (*p == c || *p == c2) {
+            return p;
+        }
+    }
+
+    return p;
+}
+
+static u_char *
+strip_scan_text(u_char *p, u_char *last)
+{
+#if (STRIP_SSE2)
+    int      mask;
+    __m128i  v, w, m, n, lt, sp, cr, lf, ht;
+
+    lt = _mm_set1_epi8('<');
+    sp = _mm_set1_epi8(' ');
+    cr = _mm_set1_epi8('\r');
+    lf = _mm_set1_epi8('\n');
+    ht = _mm_set1_epi8('\t');
+
+    /*
+     * a single space between two words is a no-op for the state machine,
+     * so only stop at spaces followed by more whitespace or by a tag
+     */
+
+    while (last - p > 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+        w = _mm_loadu_si128((const __m128i *) (p + 1));
+
+        m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt),
+                                      _mm_cmpeq_epi8(v, cr)),
+                         _mm_or_si128(_mm_cmpeq_epi8(v, lf),
+                                      _mm_cmpeq_epi8(v, ht)));
+        n = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(w, lt),
+                                      _mm_cmpeq_epi8(w, sp)),
+                         _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(w, cr),
+                                                   _mm_cmpeq_epi8(w, lf)),
+                                      _mm_cmpeq_epi8(w, ht)));
+        m = _mm_or_si128(m, _mm_and_si128(_mm_cmpeq_epi8(v, sp), n));
+
+        mask = _mm_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+
+#if (STRIP_AVX2)
+        /*
+         * nearly all runs end within 16 bytes, and a call costs more than
+         * the wider scan saves on them: only longer ones go 32 at a time
+         */
+
+        if (strip_avx2) {
+            p = strip_scan_text_avx2(p, last);
+        }
+#endif
+    }
+#endif
+
+    for ( /* void */ ; p < last; p++) {
+        switch(*p) {
+            case '<':
+            case '\r':
+            case '\n':
+            case '\t':
+                return p;
+            case ' ':
+                if (p + 1 == last) {
+                    return p;
+                }
+                switch(p[1]) {
+                    case '<':
+                    case ' ':
+                    case '\r':
+                    case '\n':
+                    case '\t':
+                        return p;
+                    default:
+                        break;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return p;
+}
+
+#if (STRIP_AVX2)
+
+/*
+ * The scans above 32 bytes at a time: each returns the byte found, or
+ * where no more than 32 bytes are left, for the scan above to go on from.
+ */
+
+__attribute__((target("avx2")))
+static u_char *
+strip_scan_pair_avx2(u_char *p, u_char *last, u_char c, u_char c2)
+{
+    unsigned  mask;
+    __m256i   v, a, b;
+
+    a = _mm256_set1_epi8((char) c);
+    b = _mm256_set1_epi8((char) c2);
+
+    for ( /* void */ ; last - p >= 32; p += 32) {
+        v = _mm256_loadu_si256((const __m256i *) p);
+
+        mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, a),
+                                                    _mm256_cmpeq_epi8(v, b)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+
+    return p;
+}
+
+__attribute__((target("avx2")))
+static u_char *
+strip_scan_text_avx2(u_char *p, u_char *last)
+{
+    unsigned  mask;
+    __m256i   v, w, m, n, lt, sp, cr, lf, ht;
+
+    lt = _mm256_set1_epi8('<');
+    sp = _mm256_set1_epi8(' ');
+    cr = _mm256_set1_epi8('\r');
+    lf = _mm256_set1_epi8('\n');
+    ht = _mm256_set1_epi8('\t');
+
+    for ( /* void */ ; last - p > 32; p += 32) {
+        v = _mm256_loadu_si256((const __m256i *) p);
+        w = _mm256_loadu_si256((const __m256i *) (p + 1));
+
+        m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, lt),
+                                            _mm256_cmpeq_epi8(v, cr)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, lf),
+                                            _mm256_cmpeq_epi8(v, ht)));
+        n = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(w, lt),
+                                            _mm256_cmpeq_epi8(w, sp)),
+                            _mm256_or_si256(
+                                _mm256_or_si256(_mm256_cmpeq_epi8(w, cr),
+                                                _mm256_cmpeq_epi8(w, lf)),
+                                _mm256_cmpeq_epi8(w, ht)));
+        m = _mm256_or_si256(m, _mm256_and_si256(_mm256_cmpeq_epi8(v, sp), n));
+
+        mask = _mm256_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+
+    return p;
+}
+
+#endif
+
+int
+strip_aborted(strip_parser_t *parser)
+{
+    return parser->state == strip_state_abort;
+}
+
+
+#if (STRIP_PROFILE)
+
+static void
+strip_profile_buffer(size_t size)
+{
+    unsigned  i;
+
+    for (i = 0; size && i < STRIP_PROFILE_SIZES - 1; size >>= 1) {
+        i++;
+    }
+
+    strip_profile.buffers[i]++;
+}
+
+static void
+strip_profile_level(unsigned syntax, unsigned level)
+{
+    unsigned  state, i;
+
+    strip_reason = strip_tables->reasons[syntax][level - 1];
+
+    for (state = 0, i = 0; state < STRIP_STATES; state++) {
+
+        while (state > strip_profile_fixed[i].last) {
+            i++;
+        }
+
+        strip_reason[state] = (u_char) ((syntax == STRIP_SYNTAX_JSON)
+                                        ? strip_reason_json
+                                        : strip_profile_fixed[i].reason);
+    }
+}
+
+static void
+strip_profile_bytes(strip_parser_t *parser, unsigned state, size_t n,
+    unsigned drop)
+{
+    unsigned   reason;
+    u_char    *reasons;
+
+    reasons = strip_parser_tables(parser)->reasons[parser->syntax]
+                  [(parser->level > 1) ? parser->level - 1 : 0];
+    reason = reasons[state];
+
+    /* the states past the fixed ones by their reason */
+
+    if (state >= STRIP_STATES) {
+        state = STRIP_STATES + reason - strip_reason_comment;
+    }
+
+    strip_profile.bytes[state] += n;
+
+    if (drop) {
+        strip_profile.dropped[state] += n;
+        strip_profile.reasons[reason] += n;
+    }
+}
+
+static void
+strip_profile_entry(strip_parser_t *parser, unsigned state, uint16_t entry)
+{
+    unsigned   next;
+    u_char    *reasons;
+
+    reasons = strip_parser_tables(parser)->reasons[parser->syntax]
+                  [(parser->level > 1) ? parser->level - 1 : 0];
+    next = entry & STRIP_STATE;
+
+    strip_profile_bytes(parser, state, 1, entry & STRIP_DROP);
+
+    if (state >= STRIP_STATES) {
+        state = STRIP_STATES + reasons[state] - strip_reason_comment;
+    }
+
+    if (next >= STRIP_STATES) {
+        next = STRIP_STATES + reasons[next] - strip_reason_comment;
+    }
+
+    if (next != state) {
+        strip_profile.transitions[state][next]++;
+    }
+}
+
+void
+strip_profile_dump(void (*print)(void *data, char *line), void *data)
+{
+    char       line[128];
+    unsigned   i, j;
+
+    for (i = 0; i < STRIP_PROFILE_STATES; i++) {
+
+        if (strip_profile.bytes[i] == 0) {
+            continue;
+        }
+
+        snprintf(line, sizeof(line), "state %s: %llu bytes, %llu dropped",
+                 strip_profile_states[i],
+                 (unsigned long long) strip_profile.bytes[i],
+                 (unsigned long long) strip_profile.dropped[i]);
+        print(data, line);
+    }
+
+    for (i = 0; i < STRIP_PROFILE_STATES; i++) {
+        for (j = 0; j < STRIP_PROFILE_STATES; j++) {
+
+            if (strip_profile.transitions[i][j] == 0) {
+                continue;
+            }
+
+            snprintf(line, sizeof(line), "transition %s -> %s: %llu",
+                     strip_profile_states[i], strip_profile_states[j],
+                     (unsigned long long) strip_profile.transitions[i][j]);
+            print(data, line);
+        }
+    }
+
+    for (i = 0; i < STRIP_REASONS; i++) {
+        snprintf(line, sizeof(line), "dropped %s: %llu bytes",
+                 strip_profile_reasons[i],
+                 (unsigned long long) strip_profile.reasons[i]);
+        print(data, line);
+    }
+
+    snprintf(line, sizeof(line), "edits: %llu retracts, %llu cuts, "
+             "%llu unquotes",
+             (unsigned long long) strip_profile.retracts,
+             (unsigned long long) strip_profile.cuts,
+             (unsigned long long) strip_profile.unquotes);
+    print(data, line);
+
+    for (i = 0; i < STRIP_PROFILE_SIZES; i++) {
+
+        if (strip_profile.buffers[i] == 0) {
+            continue;
+        }
+
+        if (i < 2) {
+            snprintf(line, sizeof(line), "buffers of %u bytes: %llu", i,
+                     (unsigned long long) strip_profile.buffers[i]);
+
+        } else if (i < STRIP_PROFILE_SIZES - 1) {
+            snprintf(line, sizeof(line), "buffers of %lu to %lu bytes: %llu",
+                     1UL << (i - 1), (1UL << i) - 1,
+                     (unsigned long long) strip_profile.buffers[i]);
+
+        } else {
+            snprintf(line, sizeof(line), "buffers of %lu bytes or more: %llu",
+                     1UL << (i - 1),
+                     (unsigned long long) strip_profile.buffers[i]);
+        }
+
+        print(data, line);
+    }
+}
+
+#endif
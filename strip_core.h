@@ -0,0 +1,98 @@
+/*
+ * Copyright 2008 Evan Miller
+ */
+
+#ifndef _STRIP_CORE_H_INCLUDED_
+#define _STRIP_CORE_H_INCLUDED_
+
+#include <sys/types.h>
+
+/* the markup a parser reads */
+#define STRIP_SYNTAX_HTML  0
+#define STRIP_SYNTAX_XML   1
+#define STRIP_SYNTAX_JSON  2
+
+typedef struct strip_tables_s  strip_tables_t;
+
+typedef struct {
+    unsigned         state;
+
+    /*
+     * 0 or 1 strips whitespace, 2 also drops comments, 3 also cuts
+     * whitespace in tags, quotes that values do not need and optional end
+     * tags; set before the first call
+     */
+    unsigned         level;
+
+    /*
+     * STRIP_SYNTAX_HTML, or STRIP_SYNTAX_XML for XML rules: no elements
+     * but script and style are special, "<?...?>" is copied as is, the
+     * quotes of attribute values are kept, no end tag is left out, and
+     * the body of an element with xml:space="preserve" is copied
+     * unchanged; or STRIP_SYNTAX_JSON, where whitespace between tokens
+     * goes and strings are copied unchanged, at every level; set before
+     * the first call
+     */
+    unsigned         syntax;
+
+    /*
+     * tables built by strip_init_tables(), or NULL for those of
+     * strip_init() and strip_init_tags(); set before the first call
+     */
+    strip_tables_t  *tables;
+} strip_parser_t;
+
+typedef struct {
+    u_char    *pos;
+    u_char    *last;
+} strip_range_t;
+
+void strip_init(void);
+
+/*
+ * Builds the parser like strip_init(), but with the bodies of the ntags
+ * elements named in tags copied unchanged instead of those of pre and
+ * textarea, and with comments that start with one of the ncomments
+ * prefixes in comments kept at levels 2 and 3.  Returns -1, leaving the
+ * parser as it was, if a name is not a letter followed by letters, digits
+ * and dashes, if a prefix is empty or has whitespace, '-' or '>', or if
+ * they take more states than there is room for.
+ */
+int strip_init_tags(char **tags, size_t ntags, char **comments,
+    size_t ncomments);
+
+/*
+ * Builds the tables of strip_init_tags() into tables, strip_tables_size()
+ * bytes owned by the caller, rather than into those every parser shares,
+ * for the parsers whose tables member points to them.  The shared tables,
+ * and parsers using other tables, are left as they are.
+ */
+size_t strip_tables_size(void);
+int strip_init_tables(strip_tables_t *tables, char **tags, size_t ntags,
+    char **comments, size_t ncomments);
+u_char *strip_compact(strip_parser_t *parser, u_char *pos, u_char *last);
+
+/*
+ * Parses from pos up to last, or until *n ranges of kept bytes have been
+ * found, and returns where it stopped; *n is set to the number of ranges.
+ * The input is not modified.
+ */
+u_char *strip_ranges(strip_parser_t *parser, u_char *pos, u_char *last,
+    strip_range_t *ranges, size_t *n);
+int strip_aborted(strip_parser_t *parser);
+
+#if (STRIP_PROFILE)
+
+/*
+ * Built with -DSTRIP_PROFILE=1, the parser counts the bytes it reads and
+ * drops in each state, the transitions between states, its edits and the
+ * sizes of the buffers it is given, for the life of the process; without
+ * it none of this is compiled in.  The counters are not atomic, they are
+ * approximate when several threads strip at once.  strip_profile_dump()
+ * hands them to print one line of text at a time.
+ */
+void strip_profile_dump(void (*print)(void *data, char *line), void *data);
+
+#endif
+
+#endif /* _STRIP_CORE_H_INCLUDED_ */
@@ -0,0 +1,478 @@
+/*
+ * Copyright 2008 Evan Miller
+ */
+
+/*
+ * Offline stripper, same parser as the nginx filter:
+ *
+ *     cc -O2 -pthread -I. -o strip tools/strip.c strip_core.c
+ *     ./strip [-f] [-x] [-J] [-j threads] [-l level] [-p tag,...]
+ *             [-c prefix,...] [-s suffix] dir|file ...
+ *
+ * Every .html and .htm file under the given paths is stripped into a
+ * copy next to it, foo.html.stripped by default, which is what
+ * strip_static looks for; with -x so are .xhtml, .svg, .xml, .atom and
+ * .rss files, by the XML rules that strip_xml_types selects, and with -J
+ * .json files, as strip_json_types would.  A copy that is not older than
+ * its original is left alone unless -f is given; the copy gets the
+ * original's permissions.  The output is what the filter sends for the
+ * file in one buffer, given with -p the same elements as
+ * strip_preserve_tags and with -c the same prefixes as
+ * strip_keep_comments: the filter leaves in a comment, a space in a
+ * script or style sheet, some quotes or an end tag where one of its
+ * buffers ends inside them, and where they end depends on strip_slices,
+ * strip_buffer_size, strip_coalesce, gzip and the upstream; a file
+ * stripped here in one go never does that.
+ */
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "strip_core.h"
+
+typedef struct {
+    char      *path;
+    off_t      size;
+    time_t     mtime;
+    unsigned   syntax;
+} strip_file_t;
+
+typedef struct {
+    size_t     files;
+    size_t     skipped;
+    size_t     failed;
+    size_t     in;
+    size_t     out;
+} strip_stats_t;
+
+static strip_file_t   *files;
+static size_t          nfiles, nalloc;
+
+static const char     *suffix = ".stripped";
+static int             force;
+static int             xml;
+static int             json;
+static unsigned        level = 1;
+
+/* the next file to take, threads help themselves until the list is done */
+static size_t          next_file;
+
+static char  *strip_xml_extensions[] = {
+    ".xhtml", ".svg", ".xml", ".atom", ".rss"
+};
+
+/* the syntax of a file by its extension, or -1 if it is not stripped */
+
+static int
+strip_syntax(const char *path)
+{
+    size_t       i;
+    const char  *dot;
+
+    dot = strrchr(path, '.');
+
+    if (dot == NULL) {
+        return -1;
+    }
+
+    if (strcmp(dot, ".html") == 0 || strcmp(dot, ".htm") == 0) {
+        return STRIP_SYNTAX_HTML;
+    }
+
+    if (json && strcmp(dot, ".json") == 0) {
+        return STRIP_SYNTAX_JSON;
+    }
+
+    if (!xml) {
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(strip_xml_extensions) / sizeof(char *); i++) {
+        if (strcmp(dot, strip_xml_extensions[i]) == 0) {
+            return STRIP_SYNTAX_XML;
+        }
+    }
+
+    return -1;
+}
+
+static int
+strip_add(const char *path, const struct stat *sb, unsigned syntax)
+{
+    strip_file_t  *f;
+
+    if (nfiles == nalloc) {
+        nalloc = nalloc ? nalloc * 2 : 1024;
+
+        f = realloc(files, nalloc * sizeof(strip_file_t));
+        if (f == NULL) {
+            return -1;
+        }
+
+        files = f;
+    }
+
+    f = &files[nfiles];
+
+    f->path = strdup(path);
+    if (f->path == NULL) {
+        return -1;
+    }
+
+    f->size = sb->st_size;
+    f->mtime = sb->st_mtime;
+    f->syntax = syntax;
+
+    nfiles++;
+
+    return 0;
+}
+
+static int
+strip_collect(const char *path, const struct stat *sb, int type,
+    struct FTW *ftw)
+{
+    int  syntax;
+
+    /* the depth and base offset nftw() passes are not needed */
+
+    (void) ftw;
+
+    syntax = strip_syntax(path);
+
+    if (type != FTW_F || !S_ISREG(sb->st_mode) || syntax == -1) {
+        return 0;
+    }
+
+    return strip_add(path, sb, (unsigned) syntax);
+}
+
+static int
+strip_file(strip_file_t *f, strip_stats_t *stats)
+{
+    int             fd, out;
+    char           *name, *tmp;
+    u_char         *map, *last;
+    size_t          len;
+    ssize_t         n;
+    struct stat     sb;
+    strip_parser_t  parser;
+
+    len = strlen(f->path) + strlen(suffix);
+
+    name = malloc(2 * len + sizeof(".XXXXXX") + 1);
+    if (name == NULL) {
+        return -1;
+    }
+
+    tmp = name + len + 1;
+
+    sprintf(name, "%s%s", f->path, suffix);
+    sprintf(tmp, "%s%s.XXXXXX", f->path, suffix);
+
+    if (!force && stat(name, &sb) == 0 && sb.st_mtime >= f->mtime) {
+        stats->skipped++;
+        free(name);
+        return 0;
+    }
+
+    fd = open(f->path, O_RDONLY);
+    if (fd == -1) {
+        goto failed;
+    }
+
+    /* the file may have changed since the tree was walked */
+
+    if (fstat(fd, &sb) == -1) {
+        close(fd);
+        goto failed;
+    }
+
+    f->size = sb.st_size;
+
+    /* a private writable mapping: the parser compacts in place */
+
+    map = NULL;
+
+    if (f->size) {
+        map = mmap(NULL, f->size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            goto failed;
+        }
+    }
+
+    close(fd);
+
+    memset(&parser, 0, sizeof(strip_parser_t));
+    parser.level = level;
+    parser.syntax = f->syntax;
+
+    /* past an abort the parser copies the rest unchanged, as online */
+
+    last = map ? strip_compact(&parser, map, map + f->size) : map;
+
+    out = mkstemp(tmp);
+    if (out == -1) {
+        if (map) {
+            munmap(map, f->size);
+        }
+        goto failed;
+    }
+
+    len = last - map;
+
+    for (n = 0; len; len -= n) {
+        n = write(out, last - len, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            break;
+        }
+    }
+
+    if (map) {
+        munmap(map, f->size);
+    }
+
+    if (close(out) == -1 || n == -1
+        || fchmodat(AT_FDCWD, tmp, sb.st_mode & 07777, 0) == -1
+        || rename(tmp, name) == -1)
+    {
+        unlink(tmp);
+        goto failed;
+    }
+
+    stats->files++;
+    stats->in += f->size;
+    stats->out += last - map;
+
+    free(name);
+    return 0;
+
+failed:
+
+    fprintf(stderr, "strip: %s: %s\n", f->path, strerror(errno));
+    stats->failed++;
+    free(name);
+    return -1;
+}
+
+static void *
+strip_worker(void *data)
+{
+    size_t          i;
+    strip_stats_t  *stats = data;
+
+    for ( ;; ) {
+        i = __atomic_fetch_add(&next_file, 1, __ATOMIC_RELAXED);
+
+        if (i >= nfiles) {
+            return NULL;
+        }
+
+        strip_file(&files[i], stats);
+    }
+}
+
+/* a whole number from 1 to max, or -1 */
+
+static int
+strip_number(const char *s, long max)
+{
+    long   n;
+    char  *end;
+
+    errno = 0;
+    n = strtol(s, &end, 10);
+
+    if (end == s || *end != '\0' || errno || n < 1 || n > max) {
+        return -1;
+    }
+
+    return (int) n;
+}
+
+static void
+strip_usage(void)
+{
+    fprintf(stderr,
+            "usage: strip [-f] [-x] [-J] [-j threads] [-l level] "
+            "[-p tag,...] [-c prefix,...] [-s suffix] dir|file ...\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    int              c, i, n, threads, syntax;
+    char            *tags[64], *comments[64], *tag;
+    size_t           ntags, ncomments;
+    double           elapsed;
+    pthread_t       *tids;
+    struct stat      sb;
+    strip_stats_t   *stats, total;
+    struct timespec  start, end;
+
+    threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    ntags = 0;
+    ncomments = 0;
+
+    while ((c = getopt(argc, argv, "c:fj:Jl:p:s:x")) != -1) {
+        switch (c) {
+        case 'c':
+            for (tag = strtok(optarg, ","); tag; tag = strtok(NULL, ",")) {
+                if (ncomments == sizeof(comments) / sizeof(comments[0])) {
+                    strip_usage();
+                }
+
+                comments[ncomments++] = tag;
+            }
+            break;
+        case 'f':
+            force = 1;
+            break;
+        case 'j':
+            threads = strip_number(optarg, 1024);
+            if (threads == -1) {
+                strip_usage();
+            }
+            break;
+        case 'J':
+            json = 1;
+            break;
+        case 'l':
+            n = strip_number(optarg, 3);
+            if (n == -1) {
+                strip_usage();
+            }
+            level = (unsigned) n;
+            break;
+        case 'p':
+            for (tag = strtok(optarg, ","); tag; tag = strtok(NULL, ",")) {
+                if (ntags == sizeof(tags) / sizeof(tags[0])) {
+                    strip_usage();
+                }
+
+                tags[ntags++] = tag;
+            }
+            break;
+        case 's':
+            suffix = optarg;
+            break;
+        case 'x':
+            xml = 1;
+            break;
+        default:
+            strip_usage();
+        }
+    }
+
+    if (optind == argc || threads < 1 || *suffix == '\0') {
+        strip_usage();
+    }
+
+    if (ntags == 0 && ncomments == 0) {
+        strip_init();
+
+    } else {
+        if (ntags == 0) {
+            tags[ntags++] = "pre";
+            tags[ntags++] = "textarea";
+        }
+
+        if (strip_init_tags(tags, ntags, comments, ncomments) == -1) {
+            fprintf(stderr, "strip: invalid -p element or -c prefix list\n");
+            return 2;
+        }
+    }
+
+    for (i = optind; i < argc; i++) {
+
+        if (stat(argv[i], &sb) == -1) {
+            fprintf(stderr, "strip: %s: %s\n", argv[i], strerror(errno));
+            return 1;
+        }
+
+        if (S_ISREG(sb.st_mode)) {
+            /* files named explicitly are taken whatever their extension */
+
+            syntax = strip_syntax(argv[i]);
+
+            if (strip_add(argv[i], &sb, (syntax == -1) ? STRIP_SYNTAX_HTML
+                                                       : (unsigned) syntax)
+                == 0)
+            {
+                continue;
+            }
+
+        } else if (nftw(argv[i], strip_collect, 64, FTW_PHYS) == 0) {
+            continue;
+        }
+
+        fprintf(stderr, "strip: %s: %s\n", argv[i], strerror(errno));
+        return 1;
+    }
+
+    if ((size_t) threads > nfiles) {
+        threads = nfiles ? (int) nfiles : 1;
+    }
+
+    tids = calloc(threads, sizeof(pthread_t));
+    stats = calloc(threads, sizeof(strip_stats_t));
+    if (tids == NULL || stats == NULL) {
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, strip_worker, &stats[i]) != 0) {
+            fprintf(stderr, "strip: cannot create thread\n");
+            return 1;
+        }
+    }
+
+    memset(&total, 0, sizeof(strip_stats_t));
+
+    for (i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+
+        total.files += stats[i].files;
+        total.skipped += stats[i].skipped;
+        total.failed += stats[i].failed;
+        total.in += stats[i].in;
+        total.out += stats[i].out;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("%zu stripped, %zu up to date, %zu failed, %d threads\n",
+           total.files, total.skipped, total.failed, threads);
+
+    printf("%zu bytes in, %zu bytes out, %zu saved (%.1f%%)\n",
+           total.in, total.out, total.in - total.out,
+           total.in ? 100.0 * (total.in - total.out) / total.in : 0.0);
+
+    printf("%.3f s, %.1f MB/s\n",
+           elapsed, elapsed > 0 ? total.in / elapsed / 1e6 : 0.0);
+
+    return total.failed ? 1 : 0;
+}